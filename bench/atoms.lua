@@ -0,0 +1,65 @@
+-- Atom interning, single vs. bulk and cached vs. uncached.
+
+local xlib = require("xlib")
+
+local BULK = 32
+
+-- Every uncached lookup needs a name the server hasn't seen yet.
+local counter = 0
+local function unique_names(n)
+    local names = {}
+    for i = 1, n do
+        counter = counter + 1
+        names[i] = string.format("lua-xlib.bench.%d", counter)
+    end
+    return names
+end
+
+return {
+    {
+        name = "XInternAtom (cached)",
+        batch = 1000,
+        run = function(state, n)
+            for _ = 1, n do
+                xlib.XInternAtom(state.display, "WM_PROTOCOLS")
+            end
+        end,
+    },
+    {
+        name = "XInternAtom (uncached)",
+        run = function(state, n)
+            for _, name in ipairs(unique_names(n)) do
+                xlib.XInternAtom(state.display, name)
+            end
+        end,
+    },
+    {
+        name = string.format("XInternAtom x%d (uncached)", BULK),
+        batch = 10,
+        run = function(state, n)
+            for _ = 1, n do
+                for _, name in ipairs(unique_names(BULK)) do
+                    xlib.XInternAtom(state.display, name)
+                end
+            end
+        end,
+    },
+    {
+        name = string.format("XInternAtoms x%d (uncached)", BULK),
+        batch = 10,
+        run = function(state, n)
+            for _ = 1, n do
+                xlib.XInternAtoms(state.display, unique_names(BULK))
+            end
+        end,
+    },
+    {
+        name = string.format("intern_atoms_async x%d (uncached)", BULK),
+        batch = 10,
+        run = function(state, n)
+            for _ = 1, n do
+                xlib.intern_atoms_async(state.display, unique_names(BULK)):wait()
+            end
+        end,
+    },
+}
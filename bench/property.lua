@@ -0,0 +1,91 @@
+-- Property reads and element access.
+
+local xlib = require("xlib")
+local xrandr = require("xlib.xrandr")
+
+local XA_WM_NAME = 39
+
+-- Finds an output that has at least one property, and returns it with its first property.
+local function output_property(display, root)
+    local res = xrandr.XRRGetScreenResourcesCurrent(display, root)
+    for _, output in ipairs(res.outputs) do
+        local properties = xrandr.XRRListOutputProperties(display, output)
+        if properties[1] then
+            return { display = display, root = root, output = output, property = properties[1] }
+        end
+    end
+end
+
+local function output_property_buffer(display, root)
+    local state = output_property(display, root)
+    if not state then
+        return nil
+    end
+
+    state.buffer = xrandr.XRRGetOutputProperty(display, state.output, state.property, 0, 1024, false, false)
+    if not state.buffer or #state.buffer == 0 then
+        return nil
+    end
+    return state
+end
+
+return {
+    {
+        name = "XRRGetOutputProperty",
+        setup = output_property,
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.XRRGetOutputProperty(state.display, state.output, state.property, 0, 1024, false, false)
+            end
+        end,
+    },
+    {
+        name = "get_output_property_async",
+        setup = output_property,
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.get_output_property_async(state.display, state.output, state.property):wait()
+            end
+        end,
+    },
+    {
+        name = "output_property_stream (64 byte chunks)",
+        setup = output_property,
+        run = function(state, n)
+            for _ = 1, n do
+                for _ in xrandr.output_property_stream(state.display, state.output, state.property, 16) do
+                end
+            end
+        end,
+    },
+    {
+        name = "get_property_async (root WM_NAME)",
+        run = function(state, n)
+            for _ = 1, n do
+                xlib.get_property_async(state.display, state.root, XA_WM_NAME):wait()
+            end
+        end,
+    },
+    {
+        name = "XProperty element access",
+        batch = 10000,
+        setup = output_property_buffer,
+        run = function(state, n)
+            local buffer = state.buffer
+            for _ = 1, n do
+                local _ = buffer[1]
+            end
+        end,
+    },
+    {
+        name = "XProperty:totable",
+        batch = 1000,
+        setup = output_property_buffer,
+        run = function(state, n)
+            local buffer = state.buffer
+            for _ = 1, n do
+                buffer:totable()
+            end
+        end,
+    },
+}
@@ -0,0 +1,193 @@
+-- Runs the benchmark cases in `bench/*.lua` against a live X server and writes the results as JSON.
+--
+-- Usage: lua bench/run.lua [--output FILE] [--filter PATTERN] [--time SECONDS]
+--
+-- Requires either luasocket or luaposix, for a wall clock.
+--
+-- Every suite returns a list of cases:
+--
+-- - `name`
+-- - `run(state, n)` performs the operation `n` times
+-- - `batch` the number of operations per measurement, defaults to 100
+-- - `setup(display, root)` returns the state passed to `run`, or `nil` to skip the case
+-- - `prepare(state, n)` is called before every batch, outside of the measurement
+--
+-- Every case is run in batches until the time budget is used up. Latencies are reported per operation,
+-- in microseconds.
+
+package.path = "./bench/?.lua;" .. package.path
+
+local xlib = require("xlib")
+
+local SUITES = { "atoms", "xrandr", "property" }
+
+local function parse_args(args)
+    local options = { output = "bench.json", time = 1 }
+    local i = 1
+    while i <= #args do
+        local flag, value = args[i], args[i + 1]
+        if flag == "--output" then
+            options.output = value
+        elseif flag == "--filter" then
+            options.filter = value
+        elseif flag == "--time" then
+            options.time = tonumber(value)
+        else
+            error(string.format("unknown argument '%s'", flag))
+        end
+        i = i + 2
+    end
+    return options
+end
+
+-- `os.clock` measures CPU time, which doesn't include the time spent waiting for replies, so it would make
+-- round trips look free. A wall clock is required instead.
+local function find_clock()
+    local ok, socket = pcall(require, "socket")
+    if ok and socket.gettime then
+        return socket.gettime, "socket.gettime"
+    end
+
+    local ok_posix, posix_time = pcall(require, "posix.time")
+    if ok_posix and posix_time.clock_gettime then
+        return function()
+            local spec = posix_time.clock_gettime(posix_time.CLOCK_MONOTONIC)
+            return spec.tv_sec + spec.tv_nsec / 1e9
+        end, "posix.time.clock_gettime"
+    end
+
+    error("a wall clock is required, install either luasocket or luaposix", 0)
+end
+
+local function percentile(sorted, p)
+    local i = math.max(1, math.ceil(#sorted * p))
+    return sorted[i]
+end
+
+local function run_case(case, state, now, budget)
+    local batch = case.batch or 100
+    local samples = {}
+    local iterations = 0
+    local total = 0
+
+    -- Warm up caches and the connection, so the first batch isn't an outlier.
+    if case.prepare then
+        case.prepare(state, batch)
+    end
+    case.run(state, batch)
+
+    while total < budget do
+        -- Work that must not be measured, such as fetching fresh objects, happens in `prepare`.
+        if case.prepare then
+            case.prepare(state, batch)
+        end
+
+        local start = now()
+        case.run(state, batch)
+        local elapsed = now() - start
+
+        total = total + elapsed
+        iterations = iterations + batch
+        table.insert(samples, elapsed / batch)
+    end
+
+    table.sort(samples)
+    return {
+        name = case.name,
+        iterations = iterations,
+        total_s = total,
+        ops_per_s = iterations / total,
+        mean_us = total / iterations * 1e6,
+        median_us = percentile(samples, 0.5) * 1e6,
+        p95_us = percentile(samples, 0.95) * 1e6,
+    }
+end
+
+local function quote(s)
+    return '"' .. s:gsub('[%c"\\]', function(c)
+        return string.format("\\u%04x", c:byte())
+    end) .. '"'
+end
+
+local function encode(value, indent)
+    indent = indent or ""
+    local t = type(value)
+    if t == "table" then
+        if next(value) == nil then
+            return "[]"
+        end
+
+        local inner = indent .. "  "
+        local parts = {}
+        if #value > 0 then
+            for _, v in ipairs(value) do
+                table.insert(parts, inner .. encode(v, inner))
+            end
+            return "[\n" .. table.concat(parts, ",\n") .. "\n" .. indent .. "]"
+        end
+
+        local keys = {}
+        for k in pairs(value) do
+            table.insert(keys, k)
+        end
+        table.sort(keys)
+        for _, k in ipairs(keys) do
+            table.insert(parts, inner .. quote(k) .. ": " .. encode(value[k], inner))
+        end
+        return "{\n" .. table.concat(parts, ",\n") .. "\n" .. indent .. "}"
+    elseif t == "string" then
+        return quote(value)
+    elseif t == "number" then
+        if value ~= value or value == math.huge or value == -math.huge then
+            return "null"
+        end
+        return string.format("%.17g", value)
+    elseif t == "boolean" then
+        return tostring(value)
+    end
+    return "null"
+end
+
+local options = parse_args(arg)
+local now, clock_name = find_clock()
+local display = xlib.XOpenDisplay()
+local root = xlib.RootWindow(display, xlib.DefaultScreen(display))
+
+local results = {}
+for _, suite in ipairs(SUITES) do
+    for _, case in ipairs(require(suite)) do
+        local name = suite .. "." .. case.name
+        if not options.filter or name:match(options.filter) then
+            -- Cases return `nil` from `setup` when the server lacks what they need.
+            local state = { display = display, root = root }
+            if case.setup then
+                state = case.setup(display, root)
+            end
+
+            if state then
+                local result = run_case(case, state, now, options.time)
+                result.name = name
+                table.insert(results, result)
+                io.stdout:write(string.format(
+                    "%-48s %12.1f ops/s %10.2f us/op (p95 %.2f)\n",
+                    name,
+                    result.ops_per_s,
+                    result.mean_us,
+                    result.p95_us
+                ))
+            else
+                io.stdout:write(string.format("%-48s skipped\n", name))
+            end
+        end
+    end
+end
+
+local file = assert(io.open(options.output, "w"))
+file:write(encode({
+    lua = _VERSION,
+    clock = clock_name,
+    timestamp = os.time(),
+    results = results,
+}))
+file:write("\n")
+file:close()
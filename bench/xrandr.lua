@@ -0,0 +1,174 @@
+-- RandR queries, field access and mode conversion.
+
+local xrandr = require("xlib.xrandr")
+
+local function resources(display, root)
+    return { display = display, root = root, res = xrandr.XRRGetScreenResourcesCurrent(display, root) }
+end
+
+return {
+    {
+        name = "XRRGetScreenResources",
+        batch = 10,
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.XRRGetScreenResources(state.display, state.root)
+            end
+        end,
+    },
+    {
+        name = "XRRGetScreenResourcesCurrent",
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.XRRGetScreenResourcesCurrent(state.display, state.root)
+            end
+        end,
+    },
+    {
+        name = "get_screen_resources_async (current)",
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.get_screen_resources_async(state.display, state.root, true):wait()
+            end
+        end,
+    },
+    {
+        name = "snapshot (current)",
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.snapshot(state.display, state.root, true)
+            end
+        end,
+    },
+    {
+        name = "XRRGetOutputInfo (all outputs)",
+        setup = resources,
+        run = function(state, n)
+            for _ = 1, n do
+                for _, output in ipairs(state.res.outputs) do
+                    xrandr.XRRGetOutputInfo(state.display, state.res, output)
+                end
+            end
+        end,
+    },
+    {
+        name = "get_output_info_async (all outputs)",
+        setup = resources,
+        run = function(state, n)
+            for _ = 1, n do
+                local futures = {}
+                for i, output in ipairs(state.res.outputs) do
+                    futures[i] = xrandr.get_output_info_async(state.display, state.res, output)
+                end
+                for _, future in ipairs(futures) do
+                    future:wait()
+                end
+            end
+        end,
+    },
+    {
+        name = "__index scalar (resources.timestamp)",
+        batch = 10000,
+        setup = resources,
+        run = function(state, n)
+            local res = state.res
+            for _ = 1, n do
+                local _ = res.timestamp
+            end
+        end,
+    },
+    {
+        name = "__index list (resources.outputs)",
+        batch = 10000,
+        setup = resources,
+        run = function(state, n)
+            local res = state.res
+            for _ = 1, n do
+                local _ = res.outputs
+            end
+        end,
+    },
+    {
+        name = "__index unknown key",
+        batch = 10000,
+        setup = resources,
+        run = function(state, n)
+            local res = state.res
+            for _ = 1, n do
+                local _ = res.does_not_exist
+            end
+        end,
+    },
+    {
+        name = "__index (output_info.name)",
+        batch = 10000,
+        setup = function(display, root)
+            local state = resources(display, root)
+            local output = state.res.outputs[1]
+            if not output then
+                return nil
+            end
+            state.info = xrandr.XRRGetOutputInfo(display, state.res, output)
+            return state
+        end,
+        run = function(state, n)
+            local info = state.info
+            for _ = 1, n do
+                local _ = info.name
+            end
+        end,
+    },
+    {
+        name = "mode conversion (resources.modes)",
+        batch = 10,
+        setup = function(display, root)
+            return { display = display, root = root, pool = {} }
+        end,
+        prepare = function(state, n)
+            for i = 1, n do
+                state.pool[i] = xrandr.XRRGetScreenResourcesCurrent(state.display, state.root)
+            end
+        end,
+        run = function(state, n)
+            for i = 1, n do
+                local _ = state.pool[i].modes
+            end
+        end,
+    },
+    {
+        name = "mode_by_id",
+        batch = 1000,
+        setup = function(display, root)
+            local state = resources(display, root)
+            local mode = state.res.modes[1]
+            if not mode then
+                return nil
+            end
+            state.id = mode.id
+            return state
+        end,
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.mode_by_id(state.res, state.id)
+            end
+        end,
+    },
+    {
+        name = "find_mode",
+        batch = 1000,
+        setup = function(display, root)
+            local state = resources(display, root)
+            local mode = state.res.modes[1]
+            if not mode then
+                return nil
+            end
+            state.width, state.height = mode.width, mode.height
+            return state
+        end,
+        run = function(state, n)
+            for _ = 1, n do
+                xrandr.find_mode(state.res, state.width, state.height)
+            end
+        end,
+    },
+}
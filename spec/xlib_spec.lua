@@ -1,5 +1,12 @@
 local assert = require("luassert")
 local xlib = require("xlib")
+local xrandr = require("xlib.xrandr")
+
+local function from_hex(hex)
+    return (hex:gsub("%x%x", function(byte)
+        return string.char(tonumber(byte, 16))
+    end))
+end
 
 describe("xlib", function()
     local display = xlib.XOpenDisplay()
@@ -15,6 +22,26 @@ describe("xlib", function()
         it("returns `None` on non-existent Atom", function()
             assert.is_equal(0, xlib.XInternAtom(display, "lua-xlib.does_not_exist", true))
         end)
+
+        it("answers repeated lookups from the cache", function()
+            local name = "lua-xlib.cached"
+            xlib.XInternAtom(display, name)
+            local hits, misses = xlib.atom_cache_stats(display)
+
+            xlib.XInternAtom(display, name)
+            local new_hits, new_misses = xlib.atom_cache_stats(display)
+            assert.is_equal(hits + 1, new_hits)
+            assert.is_equal(misses, new_misses)
+        end)
+
+        it("knows predefined atoms without asking the server", function()
+            local _, misses = xlib.atom_cache_stats(display)
+            assert.is_equal(31, xlib.XInternAtom(display, "STRING"))
+            assert.is_equal("WM_NAME", xlib.XGetAtomName(display, 39))
+
+            local _, new_misses = xlib.atom_cache_stats(display)
+            assert.is_equal(misses, new_misses)
+        end)
     end)
 
     describe("XInternAtoms", function()
@@ -29,6 +56,21 @@ describe("xlib", function()
             assert.is_not_equal(0, status)
             assert.is_same({ first, second }, list)
         end)
+
+        it("handles lists larger than the Lua stack", function()
+            local names = {}
+            for i = 1, 100000 do
+                names[i] = "lua-xlib.bulk_" .. (i % 1000)
+            end
+
+            local status, atoms = xlib.XInternAtoms(display, names)
+            assert.is_not_equal(0, status)
+            assert.is_equal(#names, #atoms)
+            assert.is_equal(xlib.XInternAtom(display, names[1]), atoms[1])
+
+            local _, list = xlib.XGetAtomNames(display, atoms)
+            assert.is_same(names, list)
+        end)
     end)
 
     describe("XGetAtomName", function()
@@ -53,4 +95,645 @@ describe("xlib", function()
             assert.is_same({ first_name, second_name }, list)
         end)
     end)
+
+    describe("capture", function()
+        local root = xlib.RootWindow(display, 0)
+
+        it("reads the same pixels with and without shared memory", function()
+            local shared = xlib.capture(display, 16, 16)
+            local copied = xlib.capture(display, 16, 16, false)
+            assert.is_true(shared.shm)
+            assert.is_false(copied.shm)
+
+            assert.is_true(shared:grab(root, 8, 8))
+            assert.is_true(copied:grab(root, 8, 8))
+            assert.is_equal(copied:pixels(), shared:pixels())
+        end)
+
+        it("clips regions to the buffer", function()
+            local capture = xlib.capture(display, 16, 16)
+            local _, width, height, stride = capture:crop(12, 12, 8, 8)
+            assert.is_equal(4, width)
+            assert.is_equal(4, height)
+            assert.is_equal(capture.stride, stride)
+            assert.is_nil(capture:crop(16, 0))
+        end)
+
+        it("reports areas outside of the drawable", function()
+            local capture = xlib.capture(display, 16, 16)
+            local ok, err = capture:grab(root, xlib.DisplayWidth(display, 0), 0)
+            assert.is_nil(ok)
+            assert.is_string(err)
+        end)
+
+        it("updates only after tracking damage", function()
+            local capture = xlib.capture(display, 16, 16)
+            assert.has_error(function()
+                capture:update()
+            end)
+
+            assert.is_true(capture:track(root))
+            assert.is_true(capture.tracking)
+            assert.is_table(capture:update())
+        end)
+    end)
+
+    describe("snapshot", function()
+        local root = xlib.RootWindow(display, 0)
+
+        it("matches the synchronous queries", function()
+            local snapshot = xrandr.snapshot(display, root, true)
+            local res = xrandr.XRRGetScreenResourcesCurrent(display, root)
+
+            assert.is_equal(res.timestamp, snapshot.timestamp)
+            assert.is_equal(res.configTimestamp, snapshot.configTimestamp)
+            assert.is_same(res.outputs, snapshot.resources.outputs)
+            assert.is_same(res.crtcs, snapshot.resources.crtcs)
+            assert.is_equal(#res.modes, #snapshot.modes)
+
+            for _, output in ipairs(res.outputs) do
+                local info = xrandr.XRRGetOutputInfo(display, res, output)
+                assert.is_equal(info.name, snapshot.outputs[output].name)
+                assert.is_equal(info.connection, snapshot.outputs[output].connection)
+                assert.is_equal(info.crtc, snapshot.outputs[output].crtc)
+            end
+
+            for _, crtc in ipairs(res.crtcs) do
+                local info = xrandr.XRRGetCrtcInfo(display, res, crtc)
+                assert.is_equal(info.mode, snapshot.crtcs[crtc].mode)
+                assert.is_equal(info.width, snapshot.crtcs[crtc].width)
+                assert.is_equal(info.height, snapshot.crtcs[crtc].height)
+            end
+
+            assert.is_equal(xrandr.XRRGetOutputPrimary(display, root), snapshot.primary)
+        end)
+
+        it("finds no changes without reconfiguration", function()
+            local snapshot = xrandr.snapshot(display, root, true)
+            assert.is_nil(xrandr.diff(snapshot, snapshot))
+            assert.is_nil(xrandr.diff(snapshot, xrandr.snapshot(display, root, true)))
+        end)
+    end)
+
+    describe("edid_parse", function()
+        -- 1920x1080 at 60 Hz, 600x340 mm, named "DELL U2720Q".
+        local blob = from_hex(
+            "00FFFFFFFFFFFF0010ACEC404C3032410C1E0104B53C22780000000000000000"
+                .. "00000000000000000000000000000000000000000000023A801871382D40582C"
+                .. "450058542100001E000000FC0044454C4C205532373230510A20000000FF0041"
+                .. "42433132330A20202020202000000010000000000000000000000000000000CA"
+        )
+
+        it("decodes the base block", function()
+            assert.is_equal(128, #blob)
+
+            local edid = xrandr.edid_parse(blob)
+            assert.is_equal("DEL", edid.manufacturer)
+            assert.is_equal(0x40EC, edid.product)
+            assert.is_equal(0x4132304C, edid.serial)
+            assert.is_equal("DELL U2720Q", edid.name)
+            assert.is_equal("ABC123", edid.serial_string)
+            assert.is_equal(2020, edid.year)
+            assert.is_equal(12, edid.week)
+            assert.is_equal("1.4", edid.version)
+            assert.is_equal(600, edid.mm_width)
+            assert.is_equal(340, edid.mm_height)
+            assert.is_equal(0, edid.extensions)
+            assert.is_same({}, edid.extension_tags)
+            assert.is_equal(blob, edid.raw)
+
+            local preferred = edid.preferred
+            assert.is_equal(1920, preferred.width)
+            assert.is_equal(1080, preferred.height)
+            assert.is_equal(148500, preferred.clock)
+            assert.is_near(60, preferred.refresh, 0.01)
+            assert.is_false(preferred.interlaced)
+        end)
+
+        it("rejects a bad checksum", function()
+            local corrupted = blob:sub(1, 127) .. string.char((blob:byte(128) + 1) % 256)
+            local edid, err = xrandr.edid_parse(corrupted)
+            assert.is_nil(edid)
+            assert.is_equal("invalid EDID checksum", err)
+        end)
+
+        it("rejects data shorter than one block", function()
+            local edid, err = xrandr.edid_parse(blob:sub(1, 100))
+            assert.is_nil(edid)
+            assert.is_equal("EDID data is shorter than one block", err)
+        end)
+
+        it("returns nothing for outputs without EDID", function()
+            local root = xlib.RootWindow(display, 0)
+            local output = xrandr.XRRGetScreenResourcesCurrent(display, root).outputs[1]
+            -- Without the atom, there would be nothing to ask the server for.
+            xlib.XInternAtom(display, "EDID")
+
+            assert.is_nil(xrandr.get_edid(display, output))
+            assert.is_nil(xrandr.get_edid(display, output))
+            assert.is_nil(xrandr.get_edid(display, output, true))
+        end)
+    end)
+
+    describe("fingerprint", function()
+        local root = xlib.RootWindow(display, 0)
+
+        it("is the same for two snapshots of the same topology", function()
+            local fingerprint = xrandr.fingerprint(display, xrandr.snapshot(display, root, true))
+            assert.is_equal(16, #fingerprint)
+            assert.is_equal(fingerprint, xrandr.fingerprint(display, xrandr.snapshot(display, root)))
+        end)
+    end)
+
+    describe("profile_set", function()
+        local root = xlib.RootWindow(display, 0)
+
+        it("returns the fingerprint for unknown setups", function()
+            local snapshot = xrandr.snapshot(display, root, true)
+            local name, fingerprint = xrandr.profile_set():match(display, snapshot)
+            assert.is_nil(name)
+            assert.is_equal(xrandr.fingerprint(display, snapshot), fingerprint)
+        end)
+
+        it("resolves a stored profile to a layout that apply_layout accepts", function()
+            local snapshot = xrandr.snapshot(display, root, true)
+            local outputs = {}
+            for _, output in ipairs(snapshot.resources.outputs) do
+                local info = snapshot.outputs[output]
+                local crtc = info and info.crtc ~= 0 and snapshot.crtcs[info.crtc]
+                if crtc then
+                    local mode = xrandr.mode_by_id(snapshot.resources, crtc.mode)
+                    outputs[info.name] = {
+                        width = mode.width,
+                        height = mode.height,
+                        refresh = mode.refresh,
+                        x = crtc.x,
+                        y = crtc.y,
+                        rotation = crtc.rotation,
+                    }
+                end
+            end
+
+            local profiles = xrandr.profile_set()
+            profiles:add("current", xrandr.fingerprint(display, snapshot), outputs)
+            assert.is_equal(1, profiles.count)
+
+            local name, layout = profiles:match(display, snapshot)
+            assert.is_equal("current", name)
+            assert.is_table(layout.crtcs)
+            assert.is_table(assert(xrandr.apply_layout(display, root, snapshot, layout)))
+        end)
+    end)
+
+    describe("apply_layout", function()
+        local root = xlib.RootWindow(display, 0)
+
+        -- Returns the first CRTC that is enabled, and its info.
+        local function active_crtc(snapshot)
+            for _, crtc in ipairs(snapshot.resources.crtcs) do
+                local info = snapshot.crtcs[crtc]
+                if info and info.mode ~= 0 then
+                    return crtc, info
+                end
+            end
+        end
+
+        it("rejects stale snapshots without changing anything", function()
+            local snapshot = xrandr.snapshot(display, root, true)
+            local crtc, info = active_crtc(snapshot)
+            assert.is_number(crtc)
+
+            -- Setting the same configuration again still moves the server's timestamp forward, but only once
+            -- a millisecond has passed.
+            local status
+            for _ = 1, 1000 do
+                status = xrandr.XRRSetCrtcConfig(
+                    display,
+                    snapshot.resources,
+                    crtc,
+                    0,
+                    info.x,
+                    info.y,
+                    info.mode,
+                    info.rotation,
+                    info.outputs
+                )
+                if status ~= 0 or xrandr.snapshot(display, root, true).timestamp ~= snapshot.timestamp then
+                    break
+                end
+            end
+            assert.is_equal(0, status)
+
+            local touched, err = xrandr.apply_layout(display, root, snapshot, { crtcs = { { crtc = crtc, mode = 0 } } })
+            assert.is_nil(touched)
+            assert.is_truthy(err:find("the topology changed since the snapshot was taken", 1, true))
+            assert.is_nil(err:find("rollback failed", 1, true))
+            assert.is_equal(info.mode, xrandr.snapshot(display, root, true).crtcs[crtc].mode)
+        end)
+
+        it("doesn't set CRTCs that already have the desired configuration", function()
+            local snapshot = xrandr.snapshot(display, root, true)
+            local layout = { crtcs = {} }
+            for _, crtc in ipairs(snapshot.resources.crtcs) do
+                local info = snapshot.crtcs[crtc]
+                if info then
+                    table.insert(layout.crtcs, {
+                        crtc = crtc,
+                        mode = info.mode,
+                        x = info.x,
+                        y = info.y,
+                        rotation = info.rotation,
+                        outputs = info.outputs,
+                    })
+                end
+            end
+
+            assert.is_same({}, assert(xrandr.apply_layout(display, root, snapshot, layout)))
+            -- Any modeset would have moved the server's timestamp forward.
+            assert.is_equal(snapshot.timestamp, xrandr.snapshot(display, root, true).timestamp)
+        end)
+    end)
+
+    describe("futures", function()
+        local root = xlib.RootWindow(display, 0)
+
+        it("resolves cached atoms without a request", function()
+            local name = "lua-xlib.async_cached"
+            local atom = xlib.XInternAtom(display, name)
+
+            local future = xlib.intern_atom_async(display, name)
+            assert.is_true(future.done)
+            assert.is_equal(atom, future:wait())
+        end)
+
+        it("sends a request for uncached atoms", function()
+            local name = "lua-xlib.async_uncached"
+            local _, misses = xlib.atom_cache_stats(display)
+
+            local future = xlib.intern_atom_async(display, name)
+            assert.is_false(future.done)
+            local _, new_misses = xlib.atom_cache_stats(display)
+            assert.is_equal(misses + 1, new_misses)
+
+            local atom = future:wait()
+            assert.is_true(future.done)
+            assert.is_equal(atom, xlib.XInternAtom(display, name))
+        end)
+
+        it("resolves to nothing for missing properties", function()
+            -- Nothing ever sets this property.
+            local property = xlib.XInternAtom(display, "lua-xlib.async_missing")
+
+            local future = xlib.get_property_async(display, root, property)
+            assert.is_equal(0, select("#", future:wait()))
+        end)
+
+        it("returns the same results from wait after poll", function()
+            local name = "lua-xlib.async_poll"
+            local future = xlib.intern_atom_async(display, name)
+            while not future:poll() do
+            end
+
+            local atom = future:wait()
+            assert.is_equal(atom, future:wait())
+            assert.is_equal(atom, xlib.XInternAtom(display, name))
+        end)
+
+        it("returns an error message for bad windows", function()
+            local future = xlib.get_property_async(display, 0x1, xlib.XInternAtom(display, "WM_NAME"))
+            local value, err = future:wait()
+            assert.is_nil(value)
+            assert.is_string(err)
+        end)
+    end)
+
+    describe("await", function()
+        local function uncached_names(prefix, n)
+            local names = {}
+            for i = 1, n do
+                names[i] = "lua-xlib." .. prefix .. "_" .. i
+            end
+            return names
+        end
+
+        it("yields inside a coroutine until the replies have arrived", function()
+            if _VERSION == "Lua 5.1" or _VERSION == "Lua 5.2" then
+                return
+            end
+
+            local names = uncached_names("await_yield", 1000)
+            local co = coroutine.create(function()
+                return xlib.intern_atoms_async(display, names):await()
+            end)
+
+            local yields = 0
+            local results = { coroutine.resume(co) }
+            while coroutine.status(co) == "suspended" do
+                assert.is_true(results[1])
+                assert.is_equal(xlib.ConnectionNumber(display), results[2])
+                yields = yields + 1
+                results = { coroutine.resume(co) }
+            end
+
+            assert.is_true(yields > 0)
+            assert.is_true(results[1])
+            assert.is_not_equal(0, results[2])
+            assert.is_equal(#names, #results[3])
+            assert.is_equal(xlib.XInternAtom(display, names[1]), results[3][1])
+        end)
+
+        it("finds replies that other calls read while it was suspended", function()
+            if _VERSION == "Lua 5.1" or _VERSION == "Lua 5.2" then
+                return
+            end
+
+            local name = "lua-xlib.await_read_elsewhere"
+            local co = coroutine.create(function()
+                return xlib.intern_atom_async(display, name):await()
+            end)
+
+            local results = { coroutine.resume(co) }
+            if coroutine.status(co) == "suspended" then
+                -- Its reply comes after the one of the future, so XCB reads both off the socket.
+                xlib.XInternAtom(display, "lua-xlib.await_read_elsewhere_sync")
+                results = { coroutine.resume(co) }
+            end
+
+            assert.is_equal("dead", coroutine.status(co))
+            assert.is_true(results[1])
+            assert.is_equal(xlib.XInternAtom(display, name), results[2])
+        end)
+
+        it("blocks like wait outside of a coroutine", function()
+            local name = "lua-xlib.await_blocking"
+            local future = xlib.intern_atom_async(display, name)
+
+            local atom = future:await()
+            assert.is_true(future.done)
+            assert.is_equal(xlib.XInternAtom(display, name), atom)
+        end)
+
+        it("resolves cached and uncached names in order", function()
+            local cached = "lua-xlib.await_cached"
+            local uncached = "lua-xlib.await_uncached"
+            local atom = xlib.XInternAtom(display, cached)
+            local hits, misses = xlib.atom_cache_stats(display)
+
+            local status, atoms = xlib.intern_atoms_async(display, { uncached, cached }):await()
+            local new_hits, new_misses = xlib.atom_cache_stats(display)
+            assert.is_equal(hits + 1, new_hits)
+            assert.is_equal(misses + 1, new_misses)
+
+            assert.is_not_equal(0, status)
+            assert.is_same({ xlib.XInternAtom(display, uncached), atom }, atoms)
+        end)
+    end)
+
+    describe("stats", function()
+        it("counts blocking calls until reset", function()
+            xlib.enable_stats(display)
+
+            -- Names that aren't in the atom cache take one round trip each.
+            xlib.XInternAtom(display, "lua-xlib.stats_one")
+            xlib.XInternAtom(display, "lua-xlib.stats_two")
+
+            local stats = xlib.stats(display)
+            assert.is_equal(2, stats.requests)
+            assert.is_equal(2, stats.round_trips)
+            assert.is_true(stats.bytes_read > 0)
+            assert.is_true(stats.bytes_written > 0)
+            assert.is_equal(2, stats.bindings.XInternAtom.calls)
+            assert.is_equal(2, stats.bindings.XInternAtom.round_trips)
+
+            xlib.reset_stats(display)
+            stats = xlib.stats(display)
+            assert.is_equal(0, stats.requests)
+            assert.is_equal(0, stats.round_trips)
+            assert.is_equal(0, stats.bytes_read)
+            assert.is_equal(0, stats.bytes_written)
+            assert.is_same({}, stats.bindings)
+
+            xlib.enable_stats(display, false)
+            assert.is_nil(xlib.stats(display))
+        end)
+
+        it("shows that outputs without EDID are only read once", function()
+            local root = xlib.RootWindow(display, 0)
+            local output = xrandr.XRRGetScreenResourcesCurrent(display, root).outputs[1]
+            xlib.XInternAtom(display, "EDID")
+            xrandr.get_edid(display, output, true)
+
+            xlib.enable_stats(display)
+            assert.is_nil(xrandr.get_edid(display, output))
+            assert.is_nil(xrandr.get_edid(display, output))
+            assert.is_nil(xlib.stats(display).bindings.get_edid)
+
+            assert.is_nil(xrandr.get_edid(display, output, true))
+            assert.is_equal(1, xlib.stats(display).bindings.get_edid.calls)
+            xlib.enable_stats(display, false)
+        end)
+    end)
+
+    describe("dump_trace", function()
+        local json = require("dkjson")
+
+        local function complete_events(trace)
+            local events = {}
+            for _, event in ipairs(trace.traceEvents) do
+                if event.ph == "X" then
+                    table.insert(events, event)
+                end
+            end
+            return events
+        end
+
+        it("records one event per blocking call", function()
+            xlib.enable_trace(display)
+            for i = 1, 3 do
+                xlib.XInternAtom(display, "lua-xlib.trace_" .. i)
+            end
+
+            local trace = assert(json.decode(xlib.dump_trace(display, true)))
+            local events = complete_events(trace)
+            assert.is_equal(3, #events)
+            for _, event in ipairs(events) do
+                assert.is_equal("XInternAtom", event.name)
+                assert.is_equal(1, event.args.round_trips)
+                assert.is_truthy(event.args.where:find("xlib_spec.lua", 1, true))
+            end
+            assert.is_equal(0, trace.otherData.dropped)
+
+            assert.is_equal(0, #complete_events(json.decode(xlib.dump_trace(display))))
+            xlib.enable_trace(display, false)
+            assert.is_nil(xlib.dump_trace(display))
+        end)
+
+        it("drops the oldest events once the buffer is full", function()
+            xlib.enable_trace(display, true, 2)
+            for i = 1, 5 do
+                xlib.XInternAtom(display, "lua-xlib.trace_wrap_" .. i)
+            end
+
+            local trace = assert(json.decode(xlib.dump_trace(display)))
+            assert.is_equal(2, #complete_events(trace))
+            assert.is_equal(3, trace.otherData.dropped)
+            xlib.enable_trace(display, false)
+        end)
+
+        it("rejects capacities that can't be allocated", function()
+            assert.has_error(function()
+                xlib.enable_trace(display, true, 2 ^ 62)
+            end)
+            assert.is_nil(xlib.dump_trace(display))
+        end)
+    end)
+
+    describe("get_errors", function()
+        local root = xlib.RootWindow(display, 0)
+
+        it("queues errors instead of exiting", function()
+            -- The first RandR request on a connection queries the extension first.
+            xrandr.XRRSelectInput(display, root, {})
+
+            local first = xlib.NextRequest(display)
+            xrandr.XRRSelectInput(display, 0x1, {})
+
+            -- Any request that waits for a reply makes Xlib read the error.
+            xlib.XInternAtom(display, "lua-xlib.errors")
+
+            local errors, complete = xlib.get_errors(display, first)
+            assert.is_true(complete)
+            assert.is_equal(1, #errors)
+            assert.is_equal(first, errors[1].serial)
+            -- `BadWindow`
+            assert.is_equal(3, errors[1].error_code)
+            assert.is_equal(0x1, errors[1].resourceid)
+            assert.is_string(errors[1].message)
+
+            assert.is_same({}, (xlib.get_errors(display, first)))
+        end)
+    end)
+
+    describe("get_property", function()
+        local root = xlib.RootWindow(display, 0)
+        local utf8_string = xlib.XInternAtom(display, "UTF8_STRING")
+        local cardinal = xlib.XInternAtom(display, "CARDINAL")
+
+        it("decodes strings and cardinals", function()
+            local string_property = xlib.XInternAtom(display, "lua-xlib.property_string")
+            local utf8_property = xlib.XInternAtom(display, "lua-xlib.property_utf8")
+            local cardinal_property = xlib.XInternAtom(display, "lua-xlib.property_cardinal")
+
+            xlib.XChangeProperty(display, root, string_property, 0, nil, "hello")
+            xlib.XChangeProperty(display, root, utf8_property, 0, utf8_string, "h\195\169llo")
+            xlib.XChangeProperty(display, root, cardinal_property, 0, cardinal, { 1, 2, 3 })
+
+            for _, cached in ipairs({ false, true }) do
+                local value, type = xlib.get_property(display, root, string_property, cached)
+                assert.is_equal("hello", value)
+                assert.is_equal(xlib.XInternAtom(display, "STRING"), type)
+
+                value, type = xlib.get_property(display, root, utf8_property, cached)
+                assert.is_equal("h\195\169llo", value)
+                assert.is_equal(utf8_string, type)
+
+                value, type = xlib.get_property(display, root, cardinal_property, cached)
+                assert.is_same({ 1, 2, 3 }, value)
+                assert.is_equal(cardinal, type)
+            end
+        end)
+
+        it("drops cached values on change and delete", function()
+            local property = xlib.XInternAtom(display, "lua-xlib.property_local")
+
+            xlib.XChangeProperty(display, root, property, 0, nil, "one")
+            assert.is_equal("one", xlib.get_property(display, root, property, true))
+
+            xlib.XChangeProperty(display, root, property, 0, nil, "two")
+            assert.is_equal("two", xlib.get_property(display, root, property, true))
+
+            xlib.XDeleteProperty(display, root, property)
+            assert.is_nil(xlib.get_property(display, root, property, true))
+            assert.is_nil(xlib.get_property(display, root, property))
+        end)
+
+        it("drops cached values on PropertyNotify", function()
+            local other = xlib.XOpenDisplay()
+            local property = xlib.XInternAtom(display, "lua-xlib.property_remote")
+
+            xlib.XChangeProperty(display, root, property, 0, nil, "one")
+            assert.is_equal("one", xlib.get_property(display, root, property, true))
+
+            xlib.XChangeProperty(other, root, property, 0, nil, "two")
+            -- Make sure the server has processed the change, and this client has read the event.
+            xlib.XGetWindowProperty(other, root, property, 0, 0, false)
+            xlib.XGetWindowProperty(display, root, property, 0, 0, false)
+            assert.is_equal("one", xlib.get_property(display, root, property, true))
+
+            xlib.drain_events(display)
+            assert.is_equal("two", xlib.get_property(display, root, property, true))
+
+            xlib.XDeleteProperty(display, root, property)
+            xlib.XCloseDisplay(other)
+        end)
+
+        it("doesn't queue errors for missing windows", function()
+            local first = xlib.NextRequest(display)
+            assert.is_nil(xlib.get_property(display, 0x1, xlib.XInternAtom(display, "WM_NAME"), true))
+            assert.is_same({}, (xlib.get_errors(display, first)))
+        end)
+    end)
+
+    describe("window_tree", function()
+        local root = xlib.RootWindow(display, 0)
+
+        local function find(tree, window)
+            for i = 1, tree.count do
+                if tree.ids[i] == window then
+                    return i
+                end
+            end
+        end
+
+        it("lists windows with their parent and geometry", function()
+            local child = xlib.XCreateSimpleWindow(display, root, 10, 20, 30, 40, 1)
+            xlib.XMapWindow(display, child)
+
+            local tree = xlib.window_tree(display, root)
+            xlib.XDestroyWindow(display, child)
+
+            assert.is_equal(root, tree.root)
+            assert.is_equal(root, tree.ids[1])
+            assert.is_equal(0, tree.parents[1])
+
+            local i = find(tree, child)
+            assert.is_number(i)
+            assert.is_equal(root, tree.parents[i])
+            assert.is_equal(10, tree.x[i])
+            assert.is_equal(20, tree.y[i])
+            assert.is_equal(30, tree.width[i])
+            assert.is_equal(40, tree.height[i])
+            assert.is_equal(1, tree.border_width[i])
+            assert.is_equal("viewable", tree.map_state[i])
+            assert.is_false(tree.override_redirect[i])
+        end)
+
+        it("reports added, changed and removed windows", function()
+            local before = xlib.window_tree(display, root)
+            assert.is_nil(xlib.window_tree_diff(before, before))
+            assert.is_nil(xlib.window_tree_diff(before, xlib.window_tree(display, root)))
+
+            local child = xlib.XCreateSimpleWindow(display, root, 0, 0, 10, 10)
+            local created = xlib.window_tree(display, root)
+            assert.is_same({ added = { child } }, xlib.window_tree_diff(before, created))
+
+            xlib.XMoveResizeWindow(display, child, 5, 5, 20, 20)
+            local moved = xlib.window_tree(display, root)
+            assert.is_same({ changed = { child } }, xlib.window_tree_diff(created, moved))
+
+            xlib.XDestroyWindow(display, child)
+            local destroyed = xlib.window_tree(display, root)
+            assert.is_same({ removed = { child } }, xlib.window_tree_diff(moved, destroyed))
+        end)
+    end)
 end)
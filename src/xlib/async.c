@@ -0,0 +1,404 @@
+#include "async.h"
+
+#include "lua_util.h"
+#include "property.h"
+#include "xlib.h"
+
+#include <X11/Xlib-xcb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xcbext.h>
+
+
+future_t* push_future_batch(lua_State* L, int display_index, int count, future_convert_t convert, int context) {
+    display_index = display_index < 0 ? lua_gettop(L) + display_index + 1 : display_index;
+    context = context < 0 ? lua_gettop(L) + context + 1 : context;
+    display_t* display = luaL_checkudata(L, display_index, LUA_XLIB_DISPLAY);
+
+    future_t* future =
+        luaU_newuserdata(L, sizeof(future_t) + (size_t) count * sizeof(future->requests[0]), LUA_XLIB_FUTURE);
+    future->display = display;
+    future->convert = convert;
+    future->done = False;
+    future->nresults = 0;
+    future->error = NULL;
+    future->received = 0;
+    future->count = count;
+    for (int i = 0; i < count; ++i) {
+        future->requests[i].sequence = 0;
+        future->requests[i].reply = NULL;
+    }
+
+    // The display is kept alive for as long as the future may still need it.
+    lua_createtable(L, 3, 0);
+    lua_pushvalue(L, display_index);
+    lua_rawseti(L, -2, 1);
+    if (context) {
+        lua_pushvalue(L, context);
+        lua_rawseti(L, -2, 2);
+    }
+    lua_setuservalue(L, -2);
+
+    return future;
+}
+
+future_t* push_future(lua_State* L, int display_index, unsigned int sequence, future_convert_t convert, int context) {
+    future_t* future = push_future_batch(L, display_index, 1, convert, context);
+    future->requests[0].sequence = sequence;
+    return future;
+}
+
+// Stores the result of the next request. Takes ownership of `reply` and `error`.
+void future_receive(future_t* future, void* reply, xcb_generic_error_t* error) {
+    stats_sequence(future->display->stats, future->requests[future->received].sequence);
+    future->requests[future->received++].reply = reply;
+    if (error && !future->error) {
+        future->error = error;
+    } else {
+        free(error);
+    }
+}
+
+void future_free_replies(future_t* future) {
+    for (int i = 0; i < future->received; ++i) {
+        free(future->requests[i].reply);
+        future->requests[i].reply = NULL;
+    }
+    free(future->error);
+    future->error = NULL;
+}
+
+// Converts the replies and stores the results in the user value of the future at `index`, after the display
+// and the context.
+void future_complete(lua_State* L, int index, future_t* future) {
+    int top = lua_gettop(L);
+    lua_getuservalue(L, index);
+    lua_rawgeti(L, top + 1, 1);
+    lua_rawgeti(L, top + 1, 2);
+
+    Bool failed = future->error != NULL;
+    for (int i = 0; i < future->count; ++i) {
+        failed = failed || !future->requests[i].reply;
+    }
+
+    // If the conversion raises an error, the future stays pending and keeps its replies, so the next call to
+    // `wait` or `await` converts them again and raises the error again. If it is never waited on again, they are
+    // released by `__gc`.
+    int n = 0;
+    if (!failed) {
+        n = future->convert(L, top + 2, top + 3, future->requests, future->count);
+    } else {
+        char text[128] = "request failed";
+        if (future->error) {
+            XGetErrorText(future->display->inner, future->error->error_code, text, sizeof(text));
+        }
+        lua_pushnil(L);
+        lua_pushstring(L, text);
+        n = 2;
+    }
+
+    for (int i = n; i > 0; --i) {
+        lua_rawseti(L, top + 1, 2 + i);
+    }
+    future->nresults = n;
+    future->done = True;
+    future_free_replies(future);
+
+    lua_settop(L, top);
+}
+
+// Takes the replies that have already arrived off the connection, without blocking.
+// Returns `True` if the future is done.
+Bool future_poll_replies(lua_State* L, int index, future_t* future) {
+    if (future->done || future->display->closed) {
+        return future->done;
+    }
+
+    // XCB only looks at replies that have already been read. Let Xlib flush the output buffer and read
+    // from the socket without blocking, so that events still end up in Xlib's queue.
+    XEventsQueued(future->display->inner, QueuedAfterFlush);
+
+    xcb_connection_t* conn = XGetXCBConnection(future->display->inner);
+    while (future->received < future->count) {
+        void* reply = NULL;
+        xcb_generic_error_t* error = NULL;
+        if (!xcb_poll_for_reply(conn, future->requests[future->received].sequence, &reply, &error)) {
+            return False;
+        }
+        future_receive(future, reply, error);
+    }
+
+    future_complete(L, index, future);
+    return True;
+}
+
+int future_push_results(lua_State* L, int index, const future_t* future) {
+    lua_getuservalue(L, index);
+    int uservalue = lua_gettop(L);
+    luaL_checkstack(L, future->nresults, NULL);
+    for (int i = 1; i <= future->nresults; ++i) {
+        lua_rawgeti(L, uservalue, 2 + i);
+    }
+
+    return future->nresults;
+}
+
+int future_wait(lua_State* L) {
+    future_t* future = luaL_checkudata(L, 1, LUA_XLIB_FUTURE);
+
+    if (!future->done) {
+        if (future->display->closed) {
+            return luaL_error(L, "display connection is closed");
+        }
+
+        if (future->received < future->count) {
+            xcb_connection_t* conn = XGetXCBConnection(future->display->inner);
+            double start = stats_begin(future->display->stats);
+            while (future->received < future->count) {
+                xcb_generic_error_t* error = NULL;
+                void* reply = xcb_wait_for_reply(conn, future->requests[future->received].sequence, &error);
+                future_receive(future, reply, error);
+            }
+            // All requests of a future are sent together, so they share a single round trip.
+            stats_record(L, future->display->stats, "XFuture:wait", 1, start);
+        }
+        future_complete(L, 1, future);
+    }
+
+    return future_push_results(L, 1, future);
+}
+
+#if LUA_VERSION_NUM >= 503
+int future_await_continue(lua_State* L, int status, lua_KContext ctx) {
+    (void) status;
+    (void) ctx;
+    // Drop whatever the coroutine was resumed with.
+    lua_settop(L, 1);
+    future_t* future = luaL_checkudata(L, 1, LUA_XLIB_FUTURE);
+
+    // Replies may have been read off the socket by other calls while the coroutine was suspended, so the
+    // descriptor would never become readable for them. Only yield once polling finds nothing new.
+    int received;
+    do {
+        received = future->received;
+        if (future_poll_replies(L, 1, future)) {
+            return future_push_results(L, 1, future);
+        }
+        if (future->display->closed) {
+            return luaL_error(L, "display connection is closed");
+        }
+    } while (future->received != received);
+
+    lua_pushinteger(L, ConnectionNumber(future->display->inner));
+    return lua_yieldk(L, 1, 0, future_await_continue);
+}
+#endif
+
+int future_await(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_FUTURE);
+
+#if LUA_VERSION_NUM >= 503
+    if (lua_isyieldable(L)) {
+        return future_await_continue(L, LUA_OK, 0);
+    }
+#endif
+
+    return future_wait(L);
+}
+
+int future_poll(lua_State* L) {
+    future_t* future = luaL_checkudata(L, 1, LUA_XLIB_FUTURE);
+    lua_pushboolean(L, future_poll_replies(L, 1, future));
+    return 1;
+}
+
+int future__gc(lua_State* L) {
+    future_t* future = luaL_checkudata(L, 1, LUA_XLIB_FUTURE);
+
+    // Otherwise, XCB keeps the replies around for as long as the connection is open.
+    if (!future->done && !future->display->closed) {
+        xcb_connection_t* conn = XGetXCBConnection(future->display->inner);
+        for (int i = future->received; i < future->count; ++i) {
+            xcb_discard_reply(conn, future->requests[i].sequence);
+        }
+    }
+    future_free_replies(future);
+
+    return 0;
+}
+
+int future__index(lua_State* L) {
+    future_t* future = luaL_checkudata(L, 1, LUA_XLIB_FUTURE);
+
+    switch (luaU_checkfield(L, 2)) {
+    case FUTURE_WAIT:
+        lua_pushcfunction(L, future_wait);
+        break;
+    case FUTURE_AWAIT:
+        lua_pushcfunction(L, future_await);
+        break;
+    case FUTURE_POLL:
+        lua_pushcfunction(L, future_poll);
+        break;
+    case FUTURE_DONE:
+        lua_pushboolean(L, future->done);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+int convert_intern_atom(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) count;
+    xcb_intern_atom_reply_t* reply = requests[0].reply;
+
+    // With `only_if_exists`, the atom may still be created later, so a `None` result must not be cached.
+    if (reply->atom != XCB_ATOM_NONE) {
+        display_push_cache(L, display_index, "atoms");
+        atom_cache_insert(L, reply->atom, lua_tostring(L, context));
+        lua_pop(L, 1);
+    }
+
+    lua_pushinteger(L, reply->atom);
+    return 1;
+}
+
+int xlib_intern_atom_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    size_t length = 0;
+    const char* name = luaL_checklstring(L, 2, &length);
+    Bool only_if_exists = lua_toboolean(L, 3);
+
+    display_push_cache(L, 1, "atoms");
+    lua_getfield(L, -1, name);
+    if (lua_type(L, -1) == LUA_TNUMBER) {
+        display->atom_hits++;
+        // A future that is already done, with the atom as its only result.
+        future_t* future = push_future_batch(L, 1, 0, NULL, 0);
+        future->done = True;
+        future->nresults = 1;
+        lua_getuservalue(L, -1);
+        lua_pushvalue(L, -3);
+        lua_rawseti(L, -2, 3);
+        lua_pop(L, 1);
+        return 1;
+    }
+    lua_pop(L, 2);
+
+    display->atom_misses++;
+    xcb_intern_atom_cookie_t cookie =
+        xcb_intern_atom(XGetXCBConnection(display->inner), (uint8_t) only_if_exists, (uint16_t) length, name);
+    push_future(L, 1, cookie.sequence, convert_intern_atom, 2);
+    return 1;
+}
+
+// The context is a list with the atom for every name that was found in the cache,
+// and the name for every other one.
+int convert_intern_atoms(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) count;
+    int n = (int) lua_rawlen(L, context);
+    Status status = 1;
+
+    display_push_cache(L, display_index, "atoms");
+    lua_createtable(L, n, 0);
+    int next = 0;
+    for (int i = 1; i <= n; ++i) {
+        lua_rawgeti(L, context, i);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            xcb_atom_t atom = ((xcb_intern_atom_reply_t*) requests[next++].reply)->atom;
+            if (atom != XCB_ATOM_NONE) {
+                lua_pushvalue(L, -3);
+                atom_cache_insert(L, atom, lua_tostring(L, -2));
+                lua_pop(L, 1);
+            } else {
+                status = 0;
+            }
+            lua_pop(L, 1);
+            lua_pushinteger(L, atom);
+        }
+        lua_rawseti(L, -2, i);
+    }
+    lua_remove(L, -2);
+
+    lua_pushinteger(L, status);
+    lua_insert(L, -2);
+    return 2;
+}
+
+int xlib_intern_atoms_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    Bool only_if_exists = lua_toboolean(L, 3);
+    lua_settop(L, 3);
+
+    int n = (int) lua_rawlen(L, 2);
+    display_push_cache(L, 1, "atoms");
+    lua_createtable(L, n, 0);
+    int count = 0;
+    for (int i = 1; i <= n; ++i) {
+        lua_rawgeti(L, 2, i);
+        if (lua_type(L, -1) != LUA_TSTRING) {
+            return luaL_error(L, "names must only contain strings, got %s at %d", luaL_typename(L, -1), i);
+        }
+        lua_pushvalue(L, -1);
+        lua_rawget(L, 4);
+        if (lua_type(L, -1) == LUA_TNUMBER) {
+            display->atom_hits++;
+            lua_remove(L, -2);
+        } else {
+            display->atom_misses++;
+            lua_pop(L, 1);
+            ++count;
+        }
+        lua_rawseti(L, 5, i);
+    }
+
+    // Create the future before sending anything, so that no error can be raised while requests are in flight.
+    future_t* future = push_future_batch(L, 1, count, convert_intern_atoms, 5);
+    xcb_connection_t* conn = XGetXCBConnection(display->inner);
+    int next = 0;
+    for (int i = 1; i <= n; ++i) {
+        lua_rawgeti(L, 5, i);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            size_t length = 0;
+            const char* name = lua_tolstring(L, -1, &length);
+            future->requests[next++].sequence =
+                xcb_intern_atom(conn, (uint8_t) only_if_exists, (uint16_t) length, name).sequence;
+        }
+        lua_pop(L, 1);
+    }
+
+    return 1;
+}
+
+int convert_get_property(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) display_index;
+    (void) context;
+    (void) count;
+    xcb_get_property_reply_t* reply = requests[0].reply;
+
+    if (reply->type == XCB_ATOM_NONE) {
+        return 0;
+    }
+
+    push_property_packed(
+        L, xcb_get_property_value(reply), reply->value_len, reply->format, reply->type, reply->bytes_after);
+    return 1;
+}
+
+int xlib_get_property_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    xcb_window_t window = (xcb_window_t) luaL_checkinteger(L, 2);
+    xcb_atom_t property = (xcb_atom_t) luaL_checkinteger(L, 3);
+    uint32_t offset = (uint32_t) luaL_optinteger(L, 4, 0);
+    uint32_t length = (uint32_t) luaL_optinteger(L, 5, 1024);
+    uint8_t delete = (uint8_t) lua_toboolean(L, 6);
+    xcb_atom_t req_type = (xcb_atom_t) luaL_optinteger(L, 7, XCB_GET_PROPERTY_TYPE_ANY);
+
+    xcb_get_property_cookie_t cookie =
+        xcb_get_property(XGetXCBConnection(display->inner), delete, window, property, req_type, offset, length);
+    push_future(L, 1, cookie.sequence, convert_get_property, 0);
+    return 1;
+}
@@ -0,0 +1,154 @@
+/** Asynchronous requests.
+ *
+ * The regular bindings wait for the reply to each request before they return, so every call costs a full
+ * round trip. The `*_async` variants send their request through the XCB connection that backs the `Display`
+ * and return a @{XFuture} right away. Any number of requests can be sent before waiting for the first reply,
+ * so they all share a single round trip.
+ *
+ * @submodule xlib
+ */
+#ifndef async_h_INCLUDED
+#define async_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <xcb/xcb.h>
+
+#define LUA_XLIB_FUTURE "xlib.future"
+
+
+// A request of a future, and its reply once it has been received.
+typedef struct {
+    unsigned int sequence;
+    void* reply;
+} future_request_t;
+
+// Converts the replies to all requests of a future into Lua values and returns their number. Receives
+// the stack indices of the display and of the context value that was passed to `push_future`, and the list
+// of requests. Only called if all requests succeeded. The replies are freed by the caller.
+typedef int (*future_convert_t)(lua_State*, int, int, const future_request_t*, int);
+
+/**
+ * The pending replies to one or more requests.
+ *
+ * Results are converted once, when the last reply is taken off the connection, and returned again
+ * by every later call to `wait` or `await`.
+ *
+ * @table XFuture
+ * @field[type=function] wait `future:wait()` blocks until the reply has arrived, and returns the same
+ *   values as the synchronous binding. If the server answered with an error, it returns `nil` and
+ *   an error message instead.
+ * @field[type=function] poll `future:poll()` flushes pending requests, reads whatever replies have already
+ *   arrived without blocking, and returns `true` if this future is done.
+ * @field[type=function] await `future:await()` works like `wait`, but when called from a coroutine on
+ *   Lua 5.3 or later, it yields the file descriptor of the connection instead of blocking. Resume the coroutine
+ *   once the descriptor is readable, and it continues waiting, or returns the results. Resuming it early
+ *   is harmless. Outside of a coroutine, or on older versions of Lua, it blocks like `wait`.
+ *   The descriptor is only a hint: other calls on the same connection while the coroutine is suspended, like
+ *   `XPending`, `drain_events` or waiting on another future, may read the reply off the socket, after which
+ *   the descriptor doesn't become readable for it. Resume awaiting coroutines after such calls as well, or
+ *   wait for the descriptor with a timeout.
+ * @field[type=boolean] done
+ * @usage
+ * local futures = {}
+ * for _, name in ipairs(names) do
+ *     futures[name] = xlib.intern_atom_async(display, name)
+ * end
+ * for name, future in pairs(futures) do
+ *     atoms[name] = future:wait()
+ * end
+ * @usage
+ * -- Inside a coroutine driven by an event loop that waits for the yielded descriptor.
+ * local status, atoms = xlib.intern_atoms_async(display, { "_NET_WM_NAME", "UTF8_STRING" }):await()
+ */
+typedef struct {
+    display_t* display;
+    future_convert_t convert;
+    Bool done;
+    int nresults;
+    // The first error that the server returned for any of the requests.
+    xcb_generic_error_t* error;
+    // Replies are taken off the connection in order. `received` counts the ones that already were.
+    int received;
+    int count;
+    future_request_t requests[];
+} future_t;
+
+enum {
+    FUTURE_WAIT = 1,
+    FUTURE_AWAIT,
+    FUTURE_POLL,
+    FUTURE_DONE,
+};
+
+static const char* const future_fields[] = {
+    "wait", "await", "poll", "done", NULL,
+};
+
+int future__gc(lua_State*);
+int future__index(lua_State*);
+
+// Creates a future for `count` requests on the connection of the display at `display_index`. The caller sets
+// their sequence numbers, in the order they were sent. The value at `context_index` is passed on to `convert`.
+// It may be `0` for none.
+future_t* push_future_batch(lua_State*, int, int, future_convert_t, int);
+
+// Creates a future for the request with the given sequence number. See `push_future_batch`.
+future_t* push_future(lua_State*, int, unsigned int, future_convert_t, int);
+
+/** Sends an `InternAtom` request.
+ *
+ * Names that are already in the atom cache of the display are resolved without a request.
+ * See @{XInternAtom}.
+ *
+ * @function intern_atom_async
+ * @tparam Display display
+ * @tparam string name
+ * @tparam[opt=false] boolean only_if_exists
+ * @treturn XFuture Resolves to the atom.
+ */
+int xlib_intern_atom_async(lua_State*);
+
+/** Sends an `InternAtom` request for every name.
+ *
+ * Only names that aren't in the atom cache of the display are sent. See @{XInternAtoms}.
+ *
+ * @function intern_atoms_async
+ * @tparam Display display
+ * @tparam table names A list of strings.
+ * @tparam[opt=false] boolean only_if_exists
+ * @treturn XFuture Resolves to an Xlib `Status` and the list of atoms.
+ */
+int xlib_intern_atoms_async(lua_State*);
+
+/** Sends a `GetProperty` request.
+ *
+ * @function get_property_async
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number property An X11 `Atom`.
+ * @tparam[opt=0] number offset In 32-bit units.
+ * @tparam[opt=1024] number length In 32-bit units.
+ * @tparam[opt=false] boolean delete
+ * @tparam[opt] number req_type An X11 `Atom`. Defaults to `AnyPropertyType` (`0`).
+ * @treturn XFuture Resolves to an @{XProperty}, or to nothing if the property doesn't exist.
+ */
+int xlib_get_property_async(lua_State*);
+
+
+static const struct luaL_Reg future_mt[] = {
+    {"__gc", future__gc},
+    { NULL,  NULL      }
+};
+
+static const struct luaL_Reg async_lib[] = {
+    {"intern_atom_async",   xlib_intern_atom_async },
+    { "intern_atoms_async", xlib_intern_atoms_async},
+    { "get_property_async", xlib_get_property_async},
+    { NULL,                 NULL                   }
+};
+
+#endif // async_h_INCLUDED
@@ -0,0 +1,372 @@
+#include "capture.h"
+
+#include "damage.h"
+#include "error.h"
+#include "lua_util.h"
+#include "stats.h"
+#include "xlib.h"
+#include "xrandr.h"
+
+#include <X11/Xutil.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+
+// Positions in the user value.
+enum {
+    CAPTURE_DISPLAY = 1,
+};
+
+
+// Returns the CRTC info at `index`, or `NULL` if the value is something else.
+crtc_info_t* capture_to_crtc(lua_State* L, int index) {
+    void* data = lua_touserdata(L, index);
+    if (data == NULL || !lua_getmetatable(L, index)) {
+        return NULL;
+    }
+
+    luaL_getmetatable(L, LUA_XRANDR_CRTC_INFO);
+    Bool is_crtc = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return is_crtc ? data : NULL;
+}
+
+Bool capture_clip(const capture_t* capture, int x, int y, int width, int height, capture_region_t* region) {
+    int x0 = x > 0 ? x : 0;
+    int y0 = y > 0 ? y : 0;
+    int x1 = x + width < capture->image->width ? x + width : capture->image->width;
+    int y1 = y + height < capture->image->height ? y + height : capture->image->height;
+    if (x1 <= x0 || y1 <= y0) {
+        return False;
+    }
+
+    region->x = x0;
+    region->y = y0;
+    region->width = x1 - x0;
+    region->height = y1 - y0;
+    return True;
+}
+
+// Reads the region given at `arg` and the following arguments and clips it to the buffer.
+// Returns `False` if nothing of it is left.
+Bool capture_check_region(lua_State* L, const capture_t* capture, int arg, capture_region_t* region) {
+    int x, y, w, h;
+
+    crtc_info_t* crtc = capture_to_crtc(L, arg);
+    if (crtc != NULL) {
+        x = crtc->inner->x - capture->x;
+        y = crtc->inner->y - capture->y;
+        w = (int) crtc->inner->width;
+        h = (int) crtc->inner->height;
+    } else {
+        x = (int) luaL_optinteger(L, arg, 0);
+        y = (int) luaL_optinteger(L, arg + 1, 0);
+        w = (int) luaL_optinteger(L, arg + 2, capture->image->width - x);
+        h = (int) luaL_optinteger(L, arg + 3, capture->image->height - y);
+    }
+
+    return capture_clip(capture, x, y, w, h, region);
+}
+
+char* capture_region_data(const capture_t* capture, const capture_region_t* region) {
+    const XImage* image = capture->image;
+    return image->data + (size_t) region->y * image->bytes_per_line + (size_t) region->x * image->bits_per_pixel / 8;
+}
+
+// Creates the image in a shared memory segment and attaches it on the server. Returns `False` if any step fails,
+// e.g. because the server can't access the segment.
+Bool capture_attach_shm(lua_State* L, capture_t* capture, Visual* visual, int depth, int width, int height) {
+    Display* dpy = capture->display->inner;
+    XImage* image = XShmCreateImage(dpy, visual, (unsigned int) depth, ZPixmap, NULL, &capture->shm, width, height);
+    if (image == NULL) {
+        return False;
+    }
+
+    capture->shm.shmid = shmget(IPC_PRIVATE, (size_t) image->bytes_per_line * image->height, IPC_CREAT | 0600);
+    if (capture->shm.shmid < 0) {
+        XDestroyImage(image);
+        return False;
+    }
+
+    capture->shm.shmaddr = shmat(capture->shm.shmid, NULL, 0);
+    if (capture->shm.shmaddr == (char*) -1) {
+        shmctl(capture->shm.shmid, IPC_RMID, NULL);
+        XDestroyImage(image);
+        return False;
+    }
+    capture->shm.readOnly = False;
+    image->data = capture->shm.shmaddr;
+
+    unsigned long request = NextRequest(dpy);
+    double start = stats_begin(capture->display->stats);
+    Status status = XShmAttach(dpy, &capture->shm);
+    XSync(dpy, False);
+    stats_record(L, capture->display->stats, "XShmAttach", 1, start);
+
+    // Once the server has attached it, the segment can be marked for removal. It is only destroyed once both sides
+    // have detached.
+    shmctl(capture->shm.shmid, IPC_RMID, NULL);
+
+    XErrorEvent error;
+    if (!status || display_take_error(capture->display, request, request, &error)) {
+        shmdt(capture->shm.shmaddr);
+        image->data = NULL;
+        XDestroyImage(image);
+        return False;
+    }
+
+    capture->image = image;
+    capture->use_shm = True;
+    return True;
+}
+
+int capture__gc(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    if (capture->image == NULL) {
+        return 0;
+    }
+
+    capture_untrack(capture);
+    if (capture->use_shm) {
+        // The server detaches by itself when the connection is closed.
+        if (!capture->display->closed) {
+            XShmDetach(capture->display->inner, &capture->shm);
+        }
+        shmdt(capture->shm.shmaddr);
+        capture->image->data = NULL;
+    }
+    XDestroyImage(capture->image);
+    capture->image = NULL;
+    return 0;
+}
+
+int xlib_capture(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    lua_Integer width = luaL_checkinteger(L, 2);
+    lua_Integer height = luaL_checkinteger(L, 3);
+    Bool shm = lua_isnone(L, 4) || lua_toboolean(L, 4);
+    luaL_argcheck(L, width > 0 && width <= 0x7fff, 2, "width must be between 1 and 32767");
+    luaL_argcheck(L, height > 0 && height <= 0x7fff, 3, "height must be between 1 and 32767");
+    if (display->closed) {
+        return luaL_error(L, "display connection is closed");
+    }
+
+    capture_t* capture = lua_newuserdata(L, sizeof(capture_t));
+    memset(capture, 0, sizeof(capture_t));
+    capture->display = display;
+    luaL_getmetatable(L, LUA_XLIB_CAPTURE);
+    lua_setmetatable(L, -2);
+
+    // Keeps the display alive for as long as the capture.
+    lua_createtable(L, 1, 0);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, CAPTURE_DISPLAY);
+    lua_setuservalue(L, -2);
+
+    int screen = DefaultScreen(display->inner);
+    Visual* visual = DefaultVisual(display->inner, screen);
+    int depth = DefaultDepth(display->inner, screen);
+
+    if (shm && XShmQueryExtension(display->inner)
+        && capture_attach_shm(L, capture, visual, depth, (int) width, (int) height)) {
+        return 1;
+    }
+
+    capture->image = XCreateImage(display->inner,
+                                  visual,
+                                  (unsigned int) depth,
+                                  ZPixmap,
+                                  0,
+                                  NULL,
+                                  (unsigned int) width,
+                                  (unsigned int) height,
+                                  32,
+                                  0);
+    if (capture->image == NULL) {
+        return luaL_error(L, "failed to create image");
+    }
+    capture->image->data = malloc((size_t) capture->image->bytes_per_line * capture->image->height);
+    if (capture->image->data == NULL) {
+        return luaL_error(L, "failed to allocate memory for image");
+    }
+
+    return 1;
+}
+
+Bool capture_read(lua_State* L, capture_t* capture, Drawable drawable, int x, int y, const capture_region_t* region) {
+    display_t* display = capture->display;
+    XImage* image = capture->image;
+    double start = stats_begin(display->stats);
+
+    if (!capture->use_shm) {
+        Bool ok = XGetSubImage(display->inner,
+                               drawable,
+                               x + region->x,
+                               y + region->y,
+                               (unsigned int) region->width,
+                               (unsigned int) region->height,
+                               AllPlanes,
+                               ZPixmap,
+                               image,
+                               region->x,
+                               region->y)
+                  != NULL;
+        stats_record(L, display->stats, "XGetSubImage", 1, start);
+        return ok;
+    }
+
+    // The server writes rows with the stride of the image it is given, so a band of full rows lines up with
+    // the buffer. Xlib derives the offset into the segment from the image's data pointer.
+    XImage band = *image;
+    band.height = region->height;
+    band.data = image->data + (size_t) region->y * image->bytes_per_line;
+    Bool ok = XShmGetImage(display->inner, drawable, &band, x, y + region->y, AllPlanes);
+    stats_record(L, display->stats, "XShmGetImage", 1, start);
+    return ok;
+}
+
+int capture_check_errors(lua_State* L, capture_t* capture, unsigned long first, Bool ok) {
+    display_t* display = capture->display;
+    XErrorEvent error;
+    if (display_take_error(display, first, NextRequest(display->inner) - 1, &error)) {
+        char message[256];
+        XGetErrorText(display->inner, error.error_code, message, sizeof(message));
+        lua_pushnil(L);
+        lua_pushstring(L, message);
+        return 2;
+    }
+    if (!ok) {
+        lua_pushnil(L);
+        lua_pushstring(L, "failed to capture image");
+        return 2;
+    }
+    return 0;
+}
+
+int capture_grab(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    Drawable drawable = (Drawable) luaL_checkinteger(L, 2);
+    int x = (int) luaL_optinteger(L, 3, 0);
+    int y = (int) luaL_optinteger(L, 4, 0);
+    if (capture->display->closed) {
+        return luaL_error(L, "display connection is closed");
+    }
+
+    capture_region_t all = { 0, 0, capture->image->width, capture->image->height };
+    unsigned long first = NextRequest(capture->display->inner);
+    Bool ok = capture_read(L, capture, drawable, x, y, &all);
+    int n = capture_check_errors(L, capture, first, ok);
+    if (n > 0) {
+        return n;
+    }
+
+    capture->x = x;
+    capture->y = y;
+    lua_pushboolean(L, True);
+    return 1;
+}
+
+int capture_crop(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    capture_region_t region;
+    if (!capture_check_region(L, capture, 2, &region)) {
+        return 0;
+    }
+
+    lua_pushlightuserdata(L, capture_region_data(capture, &region));
+    lua_pushinteger(L, region.width);
+    lua_pushinteger(L, region.height);
+    lua_pushinteger(L, capture->image->bytes_per_line);
+    return 4;
+}
+
+int capture_pixels(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    capture_region_t region;
+    if (!capture_check_region(L, capture, 2, &region)) {
+        return 0;
+    }
+
+    const char* data = capture_region_data(capture, &region);
+    size_t row = (size_t) region.width * capture->image->bits_per_pixel / 8;
+    if (region.width == capture->image->width && (size_t) capture->image->bytes_per_line == row) {
+        lua_pushlstring(L, data, row * region.height);
+        return 1;
+    }
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (int i = 0; i < region.height; ++i) {
+        luaL_addlstring(&b, data + (size_t) i * capture->image->bytes_per_line, row);
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+int capture__index(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    const XImage* image = capture->image;
+
+    switch (luaU_checkfield(L, 2)) {
+    case CAPTURE_GRAB:
+        lua_pushcfunction(L, capture_grab);
+        break;
+    case CAPTURE_CROP:
+        lua_pushcfunction(L, capture_crop);
+        break;
+    case CAPTURE_PIXELS:
+        lua_pushcfunction(L, capture_pixels);
+        break;
+    case CAPTURE_WIDTH:
+        lua_pushinteger(L, image->width);
+        break;
+    case CAPTURE_HEIGHT:
+        lua_pushinteger(L, image->height);
+        break;
+    case CAPTURE_STRIDE:
+        lua_pushinteger(L, image->bytes_per_line);
+        break;
+    case CAPTURE_DEPTH:
+        lua_pushinteger(L, image->depth);
+        break;
+    case CAPTURE_BITS_PER_PIXEL:
+        lua_pushinteger(L, image->bits_per_pixel);
+        break;
+    case CAPTURE_RED_MASK:
+        lua_pushinteger(L, (lua_Integer) image->red_mask);
+        break;
+    case CAPTURE_GREEN_MASK:
+        lua_pushinteger(L, (lua_Integer) image->green_mask);
+        break;
+    case CAPTURE_BLUE_MASK:
+        lua_pushinteger(L, (lua_Integer) image->blue_mask);
+        break;
+    case CAPTURE_BYTE_ORDER:
+        lua_pushstring(L, image->byte_order == LSBFirst ? "lsb" : "msb");
+        break;
+    case CAPTURE_SHM:
+        lua_pushboolean(L, capture->use_shm);
+        break;
+    case CAPTURE_X:
+        lua_pushinteger(L, capture->x);
+        break;
+    case CAPTURE_Y:
+        lua_pushinteger(L, capture->y);
+        break;
+    case CAPTURE_TRACK:
+        lua_pushcfunction(L, capture_track);
+        break;
+    case CAPTURE_UPDATE:
+        lua_pushcfunction(L, capture_update);
+        break;
+    case CAPTURE_TRACKING:
+        lua_pushboolean(L, capture->damage != None);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
@@ -0,0 +1,197 @@
+/** Screen capture.
+ *
+ * A capture owns an image buffer of a fixed size, that every @{XCapture:grab} reads the contents of a drawable
+ * into. With the MIT-SHM extension, the buffer is a shared memory segment that the server writes to directly,
+ * so the pixels don't travel through the connection at all. Without it, e.g. on a remote display, the pixels are
+ * read with `XGetSubImage` into the same buffer.
+ *
+ * Either way, the buffer stays in place for the lifetime of the capture, so the pointer returned by
+ * @{XCapture:crop} stays valid across grabs. It can be handed to the LuaJIT FFI or other native code without
+ * copying. @{XCapture:pixels} copies a region into a Lua string instead.
+ *
+ * @submodule xlib
+ */
+#ifndef capture_h_INCLUDED
+#define capture_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+#define LUA_XLIB_CAPTURE "xlib.capture"
+
+
+/**
+ * An image buffer for repeated captures.
+ *
+ * Pixels are stored in the server's `ZPixmap` format for the default visual, in rows of `stride` bytes.
+ * Most servers use 32 bits per pixel, in BGRX order on little-endian machines.
+ *
+ * @table XCapture
+ * @field[type=number] width
+ * @field[type=number] height
+ * @field[type=number] stride The number of bytes per row.
+ * @field[type=number] depth
+ * @field[type=number] bits_per_pixel
+ * @field[type=number] red_mask
+ * @field[type=number] green_mask
+ * @field[type=number] blue_mask
+ * @field[type=string] byte_order Either `lsb` or `msb`.
+ * @field[type=boolean] shm `true` if the buffer is a shared memory segment.
+ * @field[type=number] x The position the last @{XCapture:grab} started at.
+ * @field[type=number] y
+ * @field[type=boolean] tracking `true` while damage is tracked. See @{XCapture:track}.
+ */
+typedef struct {
+    display_t* display;
+    XImage* image;
+    XShmSegmentInfo shm;
+    Bool use_shm;
+    // The drawable position of the top left pixel of the buffer, as of the last grab.
+    int x;
+    int y;
+    // Set while damage is tracked. `parts` receives the damaged area on every update.
+    Drawable drawable;
+    Damage damage;
+    XserverRegion parts;
+} capture_t;
+
+// A region of the buffer, already clipped to it.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} capture_region_t;
+
+enum {
+    CAPTURE_GRAB = 1,
+    CAPTURE_CROP,
+    CAPTURE_PIXELS,
+    CAPTURE_WIDTH,
+    CAPTURE_HEIGHT,
+    CAPTURE_STRIDE,
+    CAPTURE_DEPTH,
+    CAPTURE_BITS_PER_PIXEL,
+    CAPTURE_RED_MASK,
+    CAPTURE_GREEN_MASK,
+    CAPTURE_BLUE_MASK,
+    CAPTURE_BYTE_ORDER,
+    CAPTURE_SHM,
+    CAPTURE_X,
+    CAPTURE_Y,
+    CAPTURE_TRACK,
+    CAPTURE_UPDATE,
+    CAPTURE_TRACKING,
+};
+
+static const char* const capture_fields[] = {
+    "grab",  "crop",           "pixels",   "width",      "height",    "stride",
+    "depth", "bits_per_pixel", "red_mask", "green_mask", "blue_mask", "byte_order",
+    "shm",   "x",              "y",        "track",      "update",    "tracking",
+    NULL,
+};
+
+int capture__gc(lua_State*);
+int capture__index(lua_State*);
+
+// Clips a region, given relative to the buffer. Returns `False` if nothing of it is left.
+Bool capture_clip(const capture_t*, int, int, int, int, capture_region_t*);
+
+// Reads a region of the buffer from the drawable, whose area starts at the given position. With shared memory,
+// whole rows are read.
+Bool capture_read(lua_State*, capture_t*, Drawable, int, int, const capture_region_t*);
+
+// Pushes `nil` and an error message, and returns `2`, if one of the requests since `first` failed or `ok`
+// is `False`. Returns `0` otherwise.
+int capture_check_errors(lua_State*, capture_t*, unsigned long, Bool);
+
+/** Creates a capture buffer.
+ *
+ * The shared memory segment is attached once, here, and reused by every grab. It is marked for removal right
+ * away, so it doesn't outlive the process, even if the capture is never collected.
+ *
+ * @function capture
+ * @tparam Display display
+ * @tparam number width
+ * @tparam number height
+ * @tparam[opt=true] boolean shm Set to `false` to always read pixels through the connection.
+ * @treturn XCapture
+ * @usage
+ * local capture = xlib.capture(display, xlib.DisplayWidth(display, 0), xlib.DisplayHeight(display, 0))
+ * assert(capture:grab(root))
+ */
+int xlib_capture(lua_State*);
+
+/** Reads the contents of a drawable into the buffer.
+ *
+ * The area starting at `x`, `y` must be at least as large as the buffer.
+ *
+ * @function XCapture:grab
+ * @tparam number drawable A window or pixmap, e.g. the root window.
+ * @tparam[opt=0] number x
+ * @tparam[opt=0] number y
+ * @treturn[1] boolean `true`
+ * @treturn[2] nil
+ * @treturn[2] string The error message, e.g. when the area is outside of the drawable or the window isn't viewable.
+ */
+int capture_grab(lua_State*);
+
+/** Returns a view of a region of the buffer, without copying.
+ *
+ * The region is either given by position and size, relative to the buffer, or as a CRTC, whose position is relative
+ * to the root window. CRTC regions are translated by the position of the last grab. Either way, the region is
+ * clipped to the buffer.
+ *
+ * @function XCapture:crop
+ * @tparam[opt] number|xrandr.XRRCrtcInfo x Defaults to the whole buffer.
+ * @tparam[opt] number y
+ * @tparam[opt] number width
+ * @tparam[opt] number height
+ * @treturn[1] userdata A light userdata pointing to the top left pixel of the region.
+ * @treturn[1] number The width of the region.
+ * @treturn[1] number The height of the region.
+ * @treturn[1] number The stride, in bytes. The same as for the whole buffer.
+ * @treturn[2] nil If the region lies outside of the buffer.
+ * @usage
+ * local ffi = require("ffi")
+ * for _, crtc in pairs(snapshot.crtcs) do
+ *     local data, width, height, stride = capture:crop(crtc)
+ *     if data then
+ *         encode(ffi.cast("uint8_t*", data), width, height, stride)
+ *     end
+ * end
+ */
+int capture_crop(lua_State*);
+
+/** Copies a region of the buffer into a string.
+ *
+ * Takes the same arguments as @{XCapture:crop}. Rows are packed, without any padding between them.
+ *
+ * @function XCapture:pixels
+ * @tparam[opt] number|xrandr.XRRCrtcInfo x
+ * @tparam[opt] number y
+ * @tparam[opt] number width
+ * @tparam[opt] number height
+ * @treturn[opt] string
+ */
+int capture_pixels(lua_State*);
+
+
+static const struct luaL_Reg capture_mt[] = {
+    {"__gc", capture__gc},
+    { NULL,  NULL       }
+};
+
+static const struct luaL_Reg capture_lib[] = {
+    {"capture", xlib_capture},
+    { NULL,     NULL        }
+};
+
+#endif // capture_h_INCLUDED
@@ -0,0 +1,212 @@
+#include "damage.h"
+
+#include "capture.h"
+#include "event.h"
+#include "lua_util.h"
+#include "stats.h"
+#include "xlib.h"
+
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <stdlib.h>
+
+
+const char* damage_event_name(const XEvent* event, int code) {
+    (void) event;
+    return code == XDamageNotify ? "XDamageNotify" : NULL;
+}
+
+int damage_event_index(lua_State* L, const XEvent* event, int code, int field) {
+    if (code != XDamageNotify) {
+        return 0;
+    }
+
+    const XDamageNotifyEvent* notify = (const XDamageNotifyEvent*) event;
+    switch (field) {
+    case EVENT_DRAWABLE:
+        lua_pushinteger(L, (lua_Integer) notify->drawable);
+        break;
+    case EVENT_DAMAGE:
+        lua_pushinteger(L, (lua_Integer) notify->damage);
+        break;
+    case EVENT_MORE:
+        lua_pushboolean(L, notify->more);
+        break;
+    case EVENT_TIMESTAMP:
+        lua_pushinteger(L, (lua_Integer) notify->timestamp);
+        break;
+    case EVENT_X:
+        lua_pushinteger(L, notify->area.x);
+        break;
+    case EVENT_Y:
+        lua_pushinteger(L, notify->area.y);
+        break;
+    case EVENT_WIDTH:
+        lua_pushinteger(L, notify->area.width);
+        break;
+    case EVENT_HEIGHT:
+        lua_pushinteger(L, notify->area.height);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+static const event_extension_t damage_events = {
+    damage_event_name,
+    damage_event_index,
+    NULL,
+};
+
+int compare_regions_by_row(const void* a, const void* b) {
+    const capture_region_t* left = a;
+    const capture_region_t* right = b;
+    return left->y - right->y;
+}
+
+void capture_untrack(capture_t* capture) {
+    if (capture->damage == None) {
+        return;
+    }
+
+    // The server destroys both along with the connection.
+    if (!capture->display->closed) {
+        XDamageDestroy(capture->display->inner, capture->damage);
+        XFixesDestroyRegion(capture->display->inner, capture->parts);
+    }
+    capture->damage = None;
+    capture->parts = None;
+    capture->drawable = None;
+}
+
+int capture_track(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    Drawable drawable = (Drawable) luaL_checkinteger(L, 2);
+    int x = (int) luaL_optinteger(L, 3, 0);
+    int y = (int) luaL_optinteger(L, 4, 0);
+    display_t* display = capture->display;
+    if (display->closed) {
+        return luaL_error(L, "display connection is closed");
+    }
+
+    capture_untrack(capture);
+
+    // Both libraries negotiate the protocol version the first time an extension is queried on a connection.
+    int event_base = 0;
+    int error_base = 0;
+    if (!XFixesQueryExtension(display->inner, &event_base, &error_base)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "XFIXES extension not available");
+        return 2;
+    }
+    if (!XDamageQueryExtension(display->inner, &event_base, &error_base)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "DAMAGE extension not available");
+        return 2;
+    }
+    display_add_event_extension(display, event_base, XDamageNumberEvents, &damage_events);
+
+    // Errors for these show up with the reply to the read.
+    unsigned long first = NextRequest(display->inner);
+    capture->damage = XDamageCreate(display->inner, drawable, XDamageReportNonEmpty);
+    capture->parts = XFixesCreateRegion(display->inner, NULL, 0);
+    capture->drawable = drawable;
+
+    capture_region_t all = { 0, 0, capture->image->width, capture->image->height };
+    Bool ok = capture_read(L, capture, drawable, x, y, &all);
+    int n = capture_check_errors(L, capture, first, ok);
+    if (n > 0) {
+        capture_untrack(capture);
+        return n;
+    }
+
+    capture->x = x;
+    capture->y = y;
+    lua_pushboolean(L, True);
+    return 1;
+}
+
+int capture_update(lua_State* L) {
+    capture_t* capture = luaL_checkudata(L, 1, LUA_XLIB_CAPTURE);
+    display_t* display = capture->display;
+    if (display->closed) {
+        return luaL_error(L, "display connection is closed");
+    }
+    if (capture->damage == None) {
+        return luaL_error(L, "capture doesn't track any damage");
+    }
+
+    // Moves the accumulated damage into `parts`, and resets it, so the next change sends a new event.
+    unsigned long first = NextRequest(display->inner);
+    double start = stats_begin(display->stats);
+    XDamageSubtract(display->inner, capture->damage, None, capture->parts);
+    int nrects = 0;
+    XRectangle* rects = XFixesFetchRegion(display->inner, capture->parts, &nrects);
+    stats_record(L, display->stats, "XDamageSubtract", 1, start);
+    if (rects == NULL) {
+        nrects = 0;
+    }
+
+    // Clipped to the buffer, and translated to it.
+    capture_region_t* regions = lua_newuserdata(L, (nrects > 0 ? nrects : 1) * sizeof(capture_region_t));
+    int nregions = 0;
+    for (int i = 0; i < nrects; ++i) {
+        const XRectangle* rect = &rects[i];
+        if (capture_clip(capture,
+                         rect->x - capture->x,
+                         rect->y - capture->y,
+                         rect->width,
+                         rect->height,
+                         &regions[nregions])) {
+            ++nregions;
+        }
+    }
+    if (rects != NULL) {
+        XFree(rects);
+    }
+
+    Bool ok = True;
+    if (capture->use_shm) {
+        // Reads cover whole rows, so areas on overlapping rows are merged into a single band.
+        qsort(regions, (size_t) nregions, sizeof(capture_region_t), compare_regions_by_row);
+        for (int i = 0; i < nregions && ok;) {
+            capture_region_t band = { 0, regions[i].y, capture->image->width, regions[i].height };
+            int end = band.y + band.height;
+            for (++i; i < nregions && regions[i].y <= end; ++i) {
+                if (regions[i].y + regions[i].height > end) {
+                    end = regions[i].y + regions[i].height;
+                }
+            }
+            band.height = end - band.y;
+            ok = capture_read(L, capture, capture->drawable, capture->x, capture->y, &band);
+        }
+    } else {
+        for (int i = 0; i < nregions && ok; ++i) {
+            ok = capture_read(L, capture, capture->drawable, capture->x, capture->y, &regions[i]);
+        }
+    }
+
+    int n = capture_check_errors(L, capture, first, ok);
+    if (n > 0) {
+        // The damage was already taken from the server. Put it back, so that the next update reads it again.
+        XDamageAdd(display->inner, capture->drawable, capture->parts);
+        return n;
+    }
+
+    lua_createtable(L, nregions, 0);
+    for (int i = 0; i < nregions; ++i) {
+        lua_createtable(L, 0, 4);
+        lua_pushinteger(L, regions[i].x);
+        lua_setfield(L, -2, "x");
+        lua_pushinteger(L, regions[i].y);
+        lua_setfield(L, -2, "y");
+        lua_pushinteger(L, regions[i].width);
+        lua_setfield(L, -2, "width");
+        lua_pushinteger(L, regions[i].height);
+        lua_setfield(L, -2, "height");
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
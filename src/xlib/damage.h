@@ -0,0 +1,68 @@
+/** Incremental capture with the DAMAGE extension.
+ *
+ * Once a capture tracks a drawable, the server accumulates the areas of it that were drawn to. @{XCapture:update}
+ * then reads only those areas into the buffer, instead of the whole drawable. On a mostly static screen, most
+ * updates don't read any pixels at all, and cost a single round trip.
+ *
+ * The server also sends an `XDamageNotify` event whenever the accumulated damage becomes non-empty, so an event loop
+ * can wait for it instead of updating on a fixed interval. There is at most one such event per update.
+ *
+ * @submodule xlib
+ * @usage
+ * local capture = xlib.capture(display, width, height)
+ * assert(capture:track(root))
+ * while true do
+ *     local event = xlib.XNextEvent(display)
+ *     if event.name == "XDamageNotify" then
+ *         for _, region in ipairs(assert(capture:update())) do
+ *             send(capture:pixels(region.x, region.y, region.width, region.height))
+ *         end
+ *     end
+ * end
+ */
+#ifndef damage_h_INCLUDED
+#define damage_h_INCLUDED
+
+#include "capture.h"
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+// Stops tracking damage, if the capture tracks any.
+void capture_untrack(capture_t*);
+
+
+/** Starts tracking damage to a drawable, and reads it into the buffer once.
+ *
+ * The damage is tracked before the drawable is read, so no change can be missed. Tracking a different drawable
+ * stops tracking the previous one.
+ *
+ * @function XCapture:track
+ * @tparam number drawable A window or pixmap, e.g. the root window.
+ * @tparam[opt=0] number x The position in the drawable that the buffer starts at. See @{XCapture:grab}.
+ * @tparam[opt=0] number y
+ * @treturn[1] boolean `true`
+ * @treturn[2] nil
+ * @treturn[2] string The error message, e.g. if the server doesn't support the DAMAGE extension.
+ */
+int capture_track(lua_State*);
+
+/** Reads the areas of the tracked drawable that were damaged since the last update into the buffer.
+ *
+ * Every damaged area takes one round trip. With shared memory, whole rows are read, and areas on the same rows
+ * share a read.
+ *
+ * @function XCapture:update
+ * @treturn[1] table A list of the regions that changed, relative to the buffer. Each is a table with the fields
+ *   `x`, `y`, `width` and `height`. Empty if nothing changed.
+ * @treturn[2] nil
+ * @treturn[2] string The error message, e.g. if the drawable was destroyed. The damage is kept, so that the
+ *   next update reads those areas again.
+ */
+int capture_update(lua_State*);
+
+#endif // damage_h_INCLUDED
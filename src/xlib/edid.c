@@ -0,0 +1,340 @@
+#include "edid.h"
+
+#include "lua_util.h"
+#include "property.h"
+#include "xlib.h"
+
+#include <string.h>
+
+// EDID allows up to 255 extension blocks.
+#define EDID_MAX_LENGTH (256 * EDID_BLOCK_SIZE)
+
+static const unsigned char edid_header[8] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+
+
+// Copies the text of a display descriptor, which is terminated by a line feed and padded with spaces.
+void edid_copy_text(char* out, const unsigned char* descriptor) {
+    int len = 0;
+    for (int i = 5; i < 18 && descriptor[i] != '\n'; ++i) {
+        out[len++] = (char) descriptor[i];
+    }
+    while (len > 0 && out[len - 1] == ' ') {
+        --len;
+    }
+    out[len] = '\0';
+}
+
+void edid_decode_timing(edid_timing_t* timing, const unsigned char* d) {
+    timing->clock = (uint32_t) (d[0] | d[1] << 8) * 10;
+    timing->width = d[2] | (d[4] & 0xF0) << 4;
+    timing->hblank = d[3] | (d[4] & 0x0F) << 8;
+    timing->height = d[5] | (d[7] & 0xF0) << 4;
+    timing->vblank = d[6] | (d[7] & 0x0F) << 8;
+    timing->mm_width = d[12] | (d[14] & 0xF0) << 4;
+    timing->mm_height = d[13] | (d[14] & 0x0F) << 8;
+    timing->interlaced = (d[17] & 0x80) != 0;
+}
+
+// Decodes the base block. Returns an error message, or `NULL` on success.
+const char* edid_decode(edid_t* edid, const unsigned char* data, size_t length) {
+    if (length < EDID_BLOCK_SIZE) {
+        return "EDID data is shorter than one block";
+    }
+    if (memcmp(data, edid_header, sizeof(edid_header)) != 0) {
+        return "invalid EDID header";
+    }
+
+    unsigned char sum = 0;
+    for (int i = 0; i < EDID_BLOCK_SIZE; ++i) {
+        sum += data[i];
+    }
+    if (sum != 0) {
+        return "invalid EDID checksum";
+    }
+
+    // Three letters, five bits each, big endian, with `1` meaning `A`.
+    edid->manufacturer[0] = (char) ('@' + ((data[8] >> 2) & 0x1F));
+    edid->manufacturer[1] = (char) ('@' + (((data[8] & 0x03) << 3) | (data[9] >> 5)));
+    edid->manufacturer[2] = (char) ('@' + (data[9] & 0x1F));
+    edid->manufacturer[3] = '\0';
+
+    edid->product = (uint16_t) (data[10] | data[11] << 8);
+    edid->serial = (uint32_t) data[12] | (uint32_t) data[13] << 8 | (uint32_t) data[14] << 16
+                   | (uint32_t) data[15] << 24;
+    edid->week = data[16];
+    edid->year = (uint16_t) (data[17] + 1990);
+    edid->version = data[18];
+    edid->revision = data[19];
+    edid->mm_width = (uint16_t) (data[21] * 10);
+    edid->mm_height = (uint16_t) (data[22] * 10);
+
+    edid->name[0] = '\0';
+    edid->serial_string[0] = '\0';
+    edid->has_preferred = False;
+    for (int offset = 54; offset < 126; offset += 18) {
+        const unsigned char* d = data + offset;
+
+        if (d[0] != 0 || d[1] != 0) {
+            // The first detailed timing is the preferred one.
+            if (!edid->has_preferred) {
+                edid_decode_timing(&edid->preferred, d);
+                edid->has_preferred = True;
+            }
+        } else if (d[3] == 0xFC) {
+            edid_copy_text(edid->name, d);
+        } else if (d[3] == 0xFF) {
+            edid_copy_text(edid->serial_string, d);
+        }
+    }
+
+    // Only count the extension blocks that are actually present.
+    int extensions = data[126];
+    if ((size_t) (extensions + 1) * EDID_BLOCK_SIZE > length) {
+        extensions = (int) (length / EDID_BLOCK_SIZE) - 1;
+    }
+    edid->extensions = extensions;
+    edid->length = (size_t) (extensions + 1) * EDID_BLOCK_SIZE;
+
+    return NULL;
+}
+
+int push_edid(lua_State* L, const unsigned char* data, size_t length) {
+    if (length > EDID_MAX_LENGTH) {
+        length = EDID_MAX_LENGTH;
+    }
+
+    edid_t decoded;
+    const char* error = edid_decode(&decoded, data, length);
+    if (error) {
+        lua_pushnil(L);
+        lua_pushstring(L, error);
+        return 2;
+    }
+
+    edid_t* edid = luaU_newuserdata(L, sizeof(edid_t) + decoded.length, LUA_XRANDR_EDID);
+    *edid = decoded;
+    memcpy(edid->data, data, decoded.length);
+
+    return 1;
+}
+
+void edid_timing_to_lua(lua_State* L, const edid_timing_t* timing) {
+    lua_createtable(L, 0, 7);
+
+    lua_pushinteger(L, timing->width);
+    lua_setfield(L, -2, "width");
+
+    lua_pushinteger(L, timing->height);
+    lua_setfield(L, -2, "height");
+
+    unsigned long total = (unsigned long) (timing->width + timing->hblank) * (timing->height + timing->vblank);
+    lua_pushnumber(L, total > 0 ? (double) timing->clock * 1000 / (double) total : 0);
+    lua_setfield(L, -2, "refresh");
+
+    lua_pushinteger(L, timing->clock);
+    lua_setfield(L, -2, "clock");
+
+    lua_pushinteger(L, timing->mm_width);
+    lua_setfield(L, -2, "mm_width");
+
+    lua_pushinteger(L, timing->mm_height);
+    lua_setfield(L, -2, "mm_height");
+
+    lua_pushboolean(L, timing->interlaced);
+    lua_setfield(L, -2, "interlaced");
+}
+
+int edid__index(lua_State* L) {
+    edid_t* edid = luaL_checkudata(L, 1, LUA_XRANDR_EDID);
+
+    switch (luaU_checkfield(L, 2)) {
+    case EDID_MANUFACTURER:
+        lua_pushstring(L, edid->manufacturer);
+        break;
+    case EDID_PRODUCT:
+        lua_pushinteger(L, edid->product);
+        break;
+    case EDID_SERIAL:
+        lua_pushinteger(L, edid->serial);
+        break;
+    case EDID_SERIAL_STRING:
+        if (edid->serial_string[0]) {
+            lua_pushstring(L, edid->serial_string);
+        } else {
+            lua_pushnil(L);
+        }
+        break;
+    case EDID_NAME:
+        if (edid->name[0]) {
+            lua_pushstring(L, edid->name);
+        } else {
+            lua_pushnil(L);
+        }
+        break;
+    case EDID_YEAR:
+        lua_pushinteger(L, edid->year);
+        break;
+    case EDID_WEEK:
+        lua_pushinteger(L, edid->week);
+        break;
+    case EDID_VERSION:
+        lua_pushfstring(L, "%d.%d", edid->version, edid->revision);
+        break;
+    case EDID_MM_WIDTH:
+        lua_pushinteger(L, edid->mm_width);
+        break;
+    case EDID_MM_HEIGHT:
+        lua_pushinteger(L, edid->mm_height);
+        break;
+    case EDID_PREFERRED:
+        if (!edid->has_preferred) {
+            lua_pushnil(L);
+        } else if (!luaU_pushcached(L, 1, 2)) {
+            edid_timing_to_lua(L, &edid->preferred);
+            luaU_cache(L, 1, 2);
+        }
+        break;
+    case EDID_EXTENSIONS:
+        lua_pushinteger(L, edid->extensions);
+        break;
+    case EDID_EXTENSION_TAGS:
+        if (!luaU_pushcached(L, 1, 2)) {
+            lua_createtable(L, edid->extensions, 0);
+            for (int i = 0; i < edid->extensions; ++i) {
+                lua_pushinteger(L, edid->data[(i + 1) * EDID_BLOCK_SIZE]);
+                lua_rawseti(L, -2, i + 1);
+            }
+            luaU_cache(L, 1, 2);
+        }
+        break;
+    case EDID_RAW:
+        lua_pushlstring(L, (const char*) edid->data, edid->length);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+void display_push_edid(lua_State* L, int display_index, RROutput output, Bool refresh) {
+    display_index = display_index < 0 ? lua_gettop(L) + display_index + 1 : display_index;
+    display_t* display = luaL_checkudata(L, display_index, LUA_XLIB_DISPLAY);
+
+    display_push_cache(L, display_index, "edid");
+    if (!refresh) {
+        lua_rawgeti(L, -1, (lua_Integer) output);
+        if (!lua_isnil(L, -1)) {
+            lua_remove(L, -2);
+            // `false` marks outputs that are known to have no EDID.
+            if (!lua_toboolean(L, -1)) {
+                lua_pop(L, 1);
+                lua_pushnil(L);
+            }
+            return;
+        }
+        lua_pop(L, 1);
+    }
+
+    Atom atom = display_intern_atom(L, display_index, "EDID", True);
+    Atom actual_type = None;
+    int actual_format = 0;
+    unsigned long nitems = 0;
+    unsigned long bytes_after = 0;
+    unsigned char* prop = NULL;
+    int status = BadAtom;
+    if (atom != None) {
+        double start = stats_begin(display->stats);
+        status = XRRGetOutputProperty(display->inner,
+                                      output,
+                                      atom,
+                                      0,
+                                      EDID_MAX_LENGTH / 4,
+                                      False,
+                                      False,
+                                      AnyPropertyType,
+                                      &actual_type,
+                                      &actual_format,
+                                      &nitems,
+                                      &bytes_after,
+                                      &prop);
+        stats_record(L, display->stats, "get_edid", 1, start);
+    }
+
+    int pushed = 0;
+    if (status == Success && prop && actual_format == 8) {
+        pushed = push_edid(L, prop, nitems);
+    }
+    if (pushed != 1) {
+        lua_pop(L, pushed);
+        lua_pushboolean(L, False);
+    }
+    if (prop) {
+        XFree(prop);
+    }
+
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, (lua_Integer) output);
+    lua_remove(L, -2);
+
+    if (!lua_toboolean(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+    }
+}
+
+void display_invalidate_edid(lua_State* L, int display_index, RROutput output) {
+    display_push_cache(L, display_index, "edid");
+    lua_pushnil(L);
+    lua_rawseti(L, -2, (lua_Integer) output);
+    lua_pop(L, 1);
+}
+
+void display_update_output_connection(lua_State* L, int display_index, RROutput output, Connection connection) {
+    display_push_cache(L, display_index, "connections");
+    lua_rawgeti(L, -1, (lua_Integer) output);
+    // When the previous state is unknown, the EDID may just as well be stale.
+    Bool changed = lua_isnil(L, -1) || lua_tointeger(L, -1) != connection;
+    lua_pop(L, 1);
+
+    if (changed) {
+        lua_pushinteger(L, connection);
+        lua_rawseti(L, -2, (lua_Integer) output);
+        display_invalidate_edid(L, display_index, output);
+    }
+    lua_pop(L, 1);
+}
+
+void display_output_property_changed(lua_State* L, int display_index, RROutput output, Atom property) {
+    // `display_push_edid` interns the atom before caching anything. If it isn't in the atom cache yet,
+    // there is nothing to invalidate, and checking this way doesn't need a round trip.
+    display_push_cache(L, display_index, "atoms");
+    lua_rawgeti(L, -1, (lua_Integer) property);
+    Bool is_edid = lua_type(L, -1) == LUA_TSTRING && strcmp(lua_tostring(L, -1), "EDID") == 0;
+    lua_pop(L, 2);
+
+    if (is_edid) {
+        display_invalidate_edid(L, display_index, output);
+    }
+}
+
+int xrandr_edid_parse(lua_State* L) {
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        size_t length = 0;
+        const char* data = lua_tolstring(L, 1, &length);
+        return push_edid(L, (const unsigned char*) data, length);
+    }
+
+    property_t* prop = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY);
+    luaL_argcheck(L, prop->format == 8, 1, "EDID properties must have format 8");
+    return push_edid(L, prop->data, prop->nitems);
+}
+
+int xrandr_get_edid(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    RROutput output = (RROutput) luaL_checkinteger(L, 2);
+    Bool refresh = lua_toboolean(L, 3);
+
+    display_push_edid(L, 1, output, refresh);
+    return 1;
+}
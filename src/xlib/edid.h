@@ -0,0 +1,167 @@
+/** Decoding of EDID data.
+ *
+ * Monitors describe themselves through an EDID blob, which RandR exposes as the `EDID` output property.
+ * See @{RR_OUTPUT}.
+ *
+ * @submodule xrandr
+ */
+#ifndef edid_h_INCLUDED
+#define edid_h_INCLUDED
+
+#include "lua_util.h"
+
+#include <X11/extensions/Xrandr.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LUA_XRANDR_EDID "xlib.xrandr.edid"
+
+#define EDID_BLOCK_SIZE 128
+
+
+/**
+ * The timing the monitor prefers, taken from the first detailed timing descriptor.
+ *
+ * @table XRREdidTiming
+ * @field[type=number] width
+ * @field[type=number] height
+ * @field[type=number] refresh The vertical refresh rate in Hz.
+ * @field[type=number] clock The pixel clock in kHz.
+ * @field[type=number] mm_width
+ * @field[type=number] mm_height
+ * @field[type=boolean] interlaced
+ */
+typedef struct {
+    uint32_t clock;
+    uint16_t width;
+    uint16_t height;
+    uint16_t hblank;
+    uint16_t vblank;
+    uint16_t mm_width;
+    uint16_t mm_height;
+    Bool interlaced;
+} edid_timing_t;
+
+/**
+ * A decoded EDID blob.
+ *
+ * @table XRREdid
+ * @field[type=string] manufacturer The three letter PNP ID, e.g. `DEL`.
+ * @field[type=number] product The manufacturer's product code.
+ * @field[type=number] serial The numeric serial number. `0` if not set.
+ * @field[type=string] serial_string The serial number from the display descriptors, if any.
+ * @field[type=string] name The monitor name from the display descriptors, if any.
+ * @field[type=number] year The year of manufacture.
+ * @field[type=number] week The week of manufacture. `0` if not set, `255` if `year` is the model year.
+ * @field[type=string] version The EDID version, e.g. `1.4`.
+ * @field[type=number] mm_width The physical width. `0` for projectors and similar devices.
+ * @field[type=number] mm_height The physical height.
+ * @field[type=XRREdidTiming] preferred The preferred timing, if any.
+ * @field[type=number] extensions The number of extension blocks.
+ * @field[type=table<number>] extension_tags The tag of every extension block, e.g. `2` for CTA-861.
+ * @field[type=string] raw The undecoded blob.
+ */
+typedef struct {
+    char manufacturer[4];
+    uint16_t product;
+    uint32_t serial;
+    // NUL-terminated, empty if there is no such descriptor.
+    char name[14];
+    char serial_string[14];
+    uint8_t week;
+    uint16_t year;
+    uint8_t version;
+    uint8_t revision;
+    uint16_t mm_width;
+    uint16_t mm_height;
+    Bool has_preferred;
+    edid_timing_t preferred;
+    int extensions;
+    size_t length;
+    // The raw blob, `length` bytes.
+    unsigned char data[];
+} edid_t;
+
+enum {
+    EDID_MANUFACTURER = 1,
+    EDID_PRODUCT,
+    EDID_SERIAL,
+    EDID_SERIAL_STRING,
+    EDID_NAME,
+    EDID_YEAR,
+    EDID_WEEK,
+    EDID_VERSION,
+    EDID_MM_WIDTH,
+    EDID_MM_HEIGHT,
+    EDID_PREFERRED,
+    EDID_EXTENSIONS,
+    EDID_EXTENSION_TAGS,
+    EDID_RAW,
+};
+
+static const char* const edid_fields[] = {
+    "manufacturer", "product",   "serial",    "serial_string", "name",       "year",           "week",
+    "version",      "mm_width",  "mm_height", "preferred",     "extensions", "extension_tags", "raw",
+    NULL,
+};
+
+int edid__index(lua_State*);
+
+// Decodes the blob and pushes it as userdata. Pushes `nil` and an error message if it isn't valid EDID.
+// Returns the number of values pushed.
+int push_edid(lua_State*, const unsigned char*, size_t);
+
+// Pushes the EDID of the output, using the per-connection cache of the display at `display_index`.
+// Pushes `nil` if the output has no EDID.
+void display_push_edid(lua_State*, int, RROutput, Bool);
+
+// Drops the cached EDID of the output.
+void display_invalidate_edid(lua_State*, int, RROutput);
+
+// Records the connection state reported by an `RROutputChangeNotify` event,
+// and drops the cached EDID if the state changed.
+void display_update_output_connection(lua_State*, int, RROutput, Connection);
+
+// Drops the cached EDID if the property reported by an `RROutputPropertyNotify` event is `EDID`.
+void display_output_property_changed(lua_State*, int, RROutput, Atom);
+
+/** Decodes an EDID blob.
+ *
+ * @function edid_parse
+ * @tparam string|xlib.XProperty data
+ * @treturn[1] XRREdid
+ * @treturn[2] nil
+ * @treturn[2] string An error message.
+ */
+int xrandr_edid_parse(lua_State*);
+
+/** Returns the decoded EDID of an output.
+ *
+ * Results are cached per display connection. Entries are dropped when an `RROutputPropertyNotify` event for
+ * the `EDID` property, or an `RROutputChangeNotify` event with a new connection state is taken off the queue.
+ * Make sure to select these events with @{XRRSelectInput}, or pass `refresh` to bypass the cache.
+ *
+ * @function get_edid
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number output The XID of the output.
+ * @tparam[opt=false] boolean refresh Re-read the property, even if there is a cached value.
+ * @treturn[opt] XRREdid `nil` if the output has no valid EDID, e.g. because it is disconnected.
+ * @usage
+ * xrandr.XRRSelectInput(display, root, { output = true, output_property = true })
+ * local edid = xrandr.get_edid(display, output)
+ * if edid then
+ *     printf("%s %s (%dx%d mm)", edid.manufacturer, edid.name, edid.mm_width, edid.mm_height)
+ * end
+ */
+int xrandr_get_edid(lua_State*);
+
+
+static const struct luaL_Reg edid_lib[] = {
+    {"edid_parse", xrandr_edid_parse},
+    { "get_edid",  xrandr_get_edid  },
+    { NULL,        NULL             }
+};
+
+#endif // edid_h_INCLUDED
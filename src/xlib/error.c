@@ -0,0 +1,144 @@
+#include "error.h"
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// Xlib's error handler is process-wide, and only receives the `Display*`. So it has to find the `display_t`
+// that belongs to it in this list. Lua states aren't shared across threads, so there's no locking.
+static display_t** registered_displays = NULL;
+static int nregistered_displays = 0;
+static int registered_displays_capacity = 0;
+
+static int (*previous_error_handler)(Display*, XErrorEvent*) = NULL;
+static Bool error_handler_installed = False;
+
+
+void error_handler_install(void) {
+    if (!error_handler_installed) {
+        previous_error_handler = XSetErrorHandler(display_error_handler);
+        error_handler_installed = True;
+    }
+}
+
+int display_error_handler(Display* inner, XErrorEvent* event) {
+    for (int i = 0; i < nregistered_displays; ++i) {
+        display_t* display = registered_displays[i];
+        if (display->inner != inner) {
+            continue;
+        }
+
+        if (display->nerrors == DISPLAY_MAX_ERRORS) {
+            memmove(&display->errors[0], &display->errors[1], (DISPLAY_MAX_ERRORS - 1) * sizeof(XErrorEvent));
+            display->nerrors--;
+        }
+        display->errors[display->nerrors++] = *event;
+        return 0;
+    }
+
+    if (previous_error_handler != NULL) {
+        return previous_error_handler(inner, event);
+    }
+    return 0;
+}
+
+void display_register_errors(display_t* display) {
+    display->nerrors = 0;
+
+    if (nregistered_displays == registered_displays_capacity) {
+        int capacity = registered_displays_capacity > 0 ? registered_displays_capacity * 2 : 4;
+        display_t** displays = realloc(registered_displays, (size_t) capacity * sizeof(display_t*));
+        if (displays == NULL) {
+            // Errors on this connection go to the previous handler instead.
+            return;
+        }
+        registered_displays = displays;
+        registered_displays_capacity = capacity;
+    }
+
+    registered_displays[nregistered_displays++] = display;
+}
+
+void display_unregister_errors(display_t* display) {
+    for (int i = 0; i < nregistered_displays; ++i) {
+        if (registered_displays[i] == display) {
+            registered_displays[i] = registered_displays[--nregistered_displays];
+            return;
+        }
+    }
+}
+
+Bool display_take_error(display_t* display, unsigned long first, unsigned long last, XErrorEvent* out) {
+    for (int i = 0; i < display->nerrors; ++i) {
+        if (display->errors[i].serial >= first && display->errors[i].serial <= last) {
+            *out = display->errors[i];
+            memmove(&display->errors[i],
+                    &display->errors[i + 1],
+                    (size_t) (display->nerrors - i - 1) * sizeof(XErrorEvent));
+            display->nerrors--;
+            return True;
+        }
+    }
+    return False;
+}
+
+display_t* error_check_display(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    if (display->closed) {
+        luaL_error(L, "display connection is closed");
+    }
+    return display;
+}
+
+int xlib_next_request(lua_State* L) {
+    display_t* display = error_check_display(L);
+    lua_pushinteger(L, (lua_Integer) NextRequest(display->inner));
+    return 1;
+}
+
+int xlib_last_known_request_processed(lua_State* L) {
+    display_t* display = error_check_display(L);
+    lua_pushinteger(L, (lua_Integer) LastKnownRequestProcessed(display->inner));
+    return 1;
+}
+
+int xlib_get_errors(lua_State* L) {
+    display_t* display = error_check_display(L);
+    unsigned long first = (unsigned long) luaL_optinteger(L, 2, 0);
+    unsigned long last = (unsigned long) luaL_optinteger(L, 3, (lua_Integer) (NextRequest(display->inner) - 1));
+
+    lua_newtable(L);
+    int n = 0;
+    XErrorEvent event;
+    while (display_take_error(display, first, last, &event)) {
+        lua_createtable(L, 0, 6);
+
+        lua_pushinteger(L, (lua_Integer) event.serial);
+        lua_setfield(L, -2, "serial");
+
+        lua_pushinteger(L, event.error_code);
+        lua_setfield(L, -2, "error_code");
+
+        lua_pushinteger(L, event.request_code);
+        lua_setfield(L, -2, "request_code");
+
+        lua_pushinteger(L, event.minor_code);
+        lua_setfield(L, -2, "minor_code");
+
+        lua_pushinteger(L, (lua_Integer) event.resourceid);
+        lua_setfield(L, -2, "resourceid");
+
+        char text[128];
+        XGetErrorText(display->inner, event.error_code, text, sizeof(text));
+        lua_pushstring(L, text);
+        lua_setfield(L, -2, "message");
+
+        lua_rawseti(L, -2, ++n);
+    }
+
+    lua_pushboolean(L, LastKnownRequestProcessed(display->inner) >= last);
+    return 2;
+}
@@ -0,0 +1,86 @@
+/** Protocol errors.
+ *
+ * Xlib reports protocol errors asynchronously, through a process-wide error handler. The default handler
+ * prints the error and exits. Instead, the first call to @{XOpenDisplay} installs a handler that appends errors
+ * on connections opened by this module to a queue per display, tagged with the sequence number of the request
+ * that failed. Errors on other connections are passed on to the previous handler.
+ *
+ * An error only shows up in the queue once Xlib has read it from the connection. That happens whenever a later
+ * request waits for its reply, or events are read. So a batch of requests that don't have replies can be checked
+ * for errors once some later reply has arrived, rather than with an `XSync` after every one of them.
+ * Requests sent by the `*_async` variants report their errors through their @{XFuture} instead.
+ *
+ * @submodule xlib
+ * @usage
+ * local first = xlib.NextRequest(display)
+ * set_window_properties(display, window)
+ * -- ...
+ * local errors, complete = xlib.get_errors(display, first)
+ */
+#ifndef error_h_INCLUDED
+#define error_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+// Installs the error handler, unless it is already installed.
+void error_handler_install(void);
+
+// The error handler. Queues errors for displays that were registered with `display_register_errors`.
+int display_error_handler(Display*, XErrorEvent*);
+
+// Starts or stops queueing errors for the display.
+void display_register_errors(display_t*);
+void display_unregister_errors(display_t*);
+
+// Removes the oldest queued error for a request with a sequence number between `first` and `last`,
+// inclusive, and copies it to `out`. Returns `False` if there is none.
+Bool display_take_error(display_t*, unsigned long, unsigned long, XErrorEvent*);
+
+
+/** Returns the sequence number that the next request will have.
+ *
+ * @function NextRequest
+ * @tparam Display display
+ * @treturn number
+ */
+int xlib_next_request(lua_State*);
+
+/** Returns the sequence number of the last request that the server is known to have processed.
+ *
+ * @function LastKnownRequestProcessed
+ * @tparam Display display
+ * @treturn number
+ */
+int xlib_last_known_request_processed(lua_State*);
+
+/** Takes the queued errors for a range of requests off the queue.
+ *
+ * The queue holds up to 64 errors. Once it is full, the oldest ones are dropped.
+ *
+ * @function get_errors
+ * @tparam Display display
+ * @tparam[opt=0] number first The sequence number of the first request, as returned by @{NextRequest}
+ *   before it was sent.
+ * @tparam[opt] number last The sequence number of the last request. Defaults to the last request that was sent.
+ * @treturn table A list of errors, oldest first. Each is a table with the fields `serial`, `error_code`,
+ *   `request_code`, `minor_code`, `resourceid` and `message`.
+ * @treturn boolean `true` if the server is known to have processed request `last`. Errors for the range
+ *   may still arrive otherwise.
+ */
+int xlib_get_errors(lua_State*);
+
+
+static const struct luaL_Reg error_lib[] = {
+    {"NextRequest",                xlib_next_request                },
+    { "LastKnownRequestProcessed", xlib_last_known_request_processed},
+    { "get_errors",                xlib_get_errors                  },
+    { NULL,                        NULL                             }
+};
+
+#endif // error_h_INCLUDED
@@ -0,0 +1,198 @@
+#include "event.h"
+
+#include "lua_util.h"
+#include "window_property.h"
+#include "xlib.h"
+
+
+// Names of the core events, indexed by event code. Codes `0` and `1` are reserved for errors and replies.
+static const char* const event_names[LASTEvent] = {
+    NULL,
+    NULL,
+    "KeyPress",
+    "KeyRelease",
+    "ButtonPress",
+    "ButtonRelease",
+    "MotionNotify",
+    "EnterNotify",
+    "LeaveNotify",
+    "FocusIn",
+    "FocusOut",
+    "KeymapNotify",
+    "Expose",
+    "GraphicsExpose",
+    "NoExpose",
+    "VisibilityNotify",
+    "CreateNotify",
+    "DestroyNotify",
+    "UnmapNotify",
+    "MapNotify",
+    "MapRequest",
+    "ReparentNotify",
+    "ConfigureNotify",
+    "ConfigureRequest",
+    "GravityNotify",
+    "ResizeRequest",
+    "CirculateNotify",
+    "CirculateRequest",
+    "PropertyNotify",
+    "SelectionClear",
+    "SelectionRequest",
+    "SelectionNotify",
+    "ColormapNotify",
+    "ClientMessage",
+    "MappingNotify",
+    "GenericEvent",
+};
+
+
+// Keys of the table passed to `XSelectInput`.
+static const struct {
+    const char* name;
+    long mask;
+} event_masks[] = {
+    {"key_press",              KeyPressMask            },
+    { "key_release",           KeyReleaseMask          },
+    { "button_press",          ButtonPressMask         },
+    { "button_release",        ButtonReleaseMask       },
+    { "enter_window",          EnterWindowMask         },
+    { "leave_window",          LeaveWindowMask         },
+    { "pointer_motion",        PointerMotionMask       },
+    { "pointer_motion_hint",   PointerMotionHintMask   },
+    { "button1_motion",        Button1MotionMask       },
+    { "button2_motion",        Button2MotionMask       },
+    { "button3_motion",        Button3MotionMask       },
+    { "button4_motion",        Button4MotionMask       },
+    { "button5_motion",        Button5MotionMask       },
+    { "button_motion",         ButtonMotionMask        },
+    { "keymap_state",          KeymapStateMask         },
+    { "exposure",              ExposureMask            },
+    { "visibility_change",     VisibilityChangeMask    },
+    { "structure_notify",      StructureNotifyMask     },
+    { "resize_redirect",       ResizeRedirectMask      },
+    { "substructure_notify",   SubstructureNotifyMask  },
+    { "substructure_redirect", SubstructureRedirectMask},
+    { "focus_change",          FocusChangeMask         },
+    { "property_change",       PropertyChangeMask      },
+    { "colormap_change",       ColormapChangeMask      },
+    { "owner_grab_button",     OwnerGrabButtonMask     },
+};
+
+
+// Takes the next event off the queue, blocking if necessary, and pushes it as userdata.
+event_t* push_next_event(lua_State* L, int display_index) {
+    display_t* display = lua_touserdata(L, display_index);
+
+    event_t* event = lua_newuserdata(L, sizeof(event_t));
+    luaL_getmetatable(L, LUA_XLIB_EVENT);
+    lua_setmetatable(L, -2);
+
+    XNextEvent(display->inner, &event->inner);
+
+    int type = event->inner.type;
+    event->ext = NULL;
+    event->code = type;
+    for (int i = 0; i < display->nevent_extensions; ++i) {
+        int base = display->event_extensions[i].base;
+        if (type >= base && type < base + display->event_extensions[i].count) {
+            event->ext = display->event_extensions[i].ext;
+            event->code = type - base;
+            break;
+        }
+    }
+
+    if (event->ext && event->ext->dispatch) {
+        event->ext->dispatch(L, display_index, &event->inner, event->code);
+    } else if (!event->ext) {
+        display_window_event(L, display_index, &event->inner);
+    }
+
+    return event;
+}
+
+int event__index(lua_State* L) {
+    event_t* event = luaL_checkudata(L, 1, LUA_XLIB_EVENT);
+    int field = luaU_checkfield(L, 2);
+
+    switch (field) {
+    case EVENT_TYPE:
+        lua_pushinteger(L, event->inner.type);
+        break;
+    case EVENT_NAME: {
+        const char* name = NULL;
+        if (event->ext) {
+            name = event->ext->name(&event->inner, event->code);
+        } else if (event->code >= 0 && event->code < LASTEvent) {
+            name = event_names[event->code];
+        }
+        lua_pushstring(L, name);
+        break;
+    }
+    case EVENT_SERIAL:
+        lua_pushinteger(L, event->inner.xany.serial);
+        break;
+    case EVENT_SEND_EVENT:
+        lua_pushboolean(L, event->inner.xany.send_event);
+        break;
+    case EVENT_WINDOW:
+        lua_pushinteger(L, event->inner.xany.window);
+        break;
+    default:
+        if (field == 0 || !event->ext || !event->ext->index(L, &event->inner, event->code, field)) {
+            lua_pushnil(L);
+        }
+    }
+
+    return 1;
+}
+
+int xlib_pending(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    lua_pushinteger(L, XPending(display->inner));
+    return 1;
+}
+
+int xlib_next_event(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    push_next_event(L, 1);
+    return 1;
+}
+
+int xlib_drain_events(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    lua_Integer max = luaL_optinteger(L, 2, -1);
+
+    int pending = XPending(display->inner);
+    lua_createtable(L, pending, 0);
+
+    int count = 0;
+    while (pending > 0 && count != max) {
+        push_next_event(L, 1);
+        lua_rawseti(L, -2, ++count);
+
+        // Pick up whatever arrived in the meantime, without flushing or blocking.
+        if (--pending == 0) {
+            pending = XEventsQueued(display->inner, QueuedAfterReading);
+        }
+    }
+
+    return 1;
+}
+
+int xlib_select_input(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    long mask = NoEventMask;
+    for (size_t i = 0; i < sizeof(event_masks) / sizeof(event_masks[0]); ++i) {
+        lua_getfield(L, 3, event_masks[i].name);
+        if (lua_toboolean(L, -1)) {
+            mask |= event_masks[i].mask;
+        }
+        lua_pop(L, 1);
+    }
+
+    XSelectInput(display->inner, window, mask);
+    return 0;
+}
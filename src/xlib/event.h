@@ -0,0 +1,150 @@
+/** Event delivery.
+ *
+ * Events are returned as userdata that wrap the `XEvent` memory filled by Xlib. Fields are only decoded
+ * when they are accessed, so draining a busy queue doesn't create a table per event.
+ *
+ * @submodule xlib
+ */
+#ifndef event_h_INCLUDED
+#define event_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+#define LUA_XLIB_EVENT "xlib.event"
+
+// Fields of events, as looked up by `event__index`. See `luaU_setindex`. Extensions share the list, so that a
+// single table can resolve the fields of every event. Enum values are the positions in the list of names.
+
+enum {
+    EVENT_TYPE = 1,
+    EVENT_NAME,
+    EVENT_SERIAL,
+    EVENT_SEND_EVENT,
+    EVENT_WINDOW,
+    EVENT_SUBTYPE,
+    EVENT_ROOT,
+    EVENT_TIMESTAMP,
+    EVENT_CONFIG_TIMESTAMP,
+    EVENT_SIZE_INDEX,
+    EVENT_SUBPIXEL_ORDER,
+    EVENT_ROTATION,
+    EVENT_X,
+    EVENT_Y,
+    EVENT_WIDTH,
+    EVENT_HEIGHT,
+    EVENT_MWIDTH,
+    EVENT_MHEIGHT,
+    EVENT_CRTC,
+    EVENT_MODE,
+    EVENT_OUTPUT,
+    EVENT_CONNECTION,
+    EVENT_PROPERTY,
+    EVENT_STATE,
+    EVENT_DRAWABLE,
+    EVENT_DAMAGE,
+    EVENT_MORE,
+};
+
+static const char* const event_fields[] = {
+    // All events.
+    "type", "name", "serial", "send_event", "window",
+    // RandR, see `xrandr_event_index`.
+    "subtype", "root", "timestamp", "config_timestamp", "size_index", "subpixel_order", "rotation", "x", "y", "width",
+    "height", "mwidth", "mheight", "crtc", "mode", "output", "connection", "property", "state",
+    // DAMAGE, see `damage_event_index`.
+    "drawable", "damage", "more", NULL,
+};
+
+
+/**
+ * An event taken off the queue.
+ *
+ * Besides the fields listed here, events of extensions known to the display connection provide
+ * their own fields. See @{xrandr.XRRSelectInput}.
+ *
+ * @table XEvent
+ * @field[type=number] type The raw event code.
+ * @field[type=string] name The name of the event type, e.g. `PropertyNotify`, if known.
+ * @field[type=number] serial The serial number of the last request processed by the server.
+ * @field[type=boolean] send_event `true` if this event was sent with `XSendEvent`.
+ * @field[type=number] window The window the event was reported relative to.
+ */
+typedef struct {
+    XEvent inner;
+    // The extension that generated this event, or `NULL` for core events.
+    const event_extension_t* ext;
+    // The event code, relative to the extension's event base.
+    int code;
+} event_t;
+
+int event__index(lua_State*);
+
+/** Returns the number of events that have been received, but not yet removed from the queue.
+ *
+ * This flushes the output buffer and reads whatever is available on the connection, but never blocks.
+ *
+ * @function XPending
+ * @tparam Display display
+ * @treturn number
+ */
+int xlib_pending(lua_State*);
+
+/** Removes the next event from the queue.
+ *
+ * Blocks until an event is available.
+ *
+ * @function XNextEvent
+ * @tparam Display display
+ * @treturn XEvent
+ */
+int xlib_next_event(lua_State*);
+
+/** Removes all events that can be received without blocking.
+ *
+ * @function drain_events
+ * @tparam Display display
+ * @tparam[opt] number max The maximum number of events to return.
+ * @treturn table<XEvent> The events, in the order they were received. Empty if there were none.
+ * @usage
+ * local fd = xlib.ConnectionNumber(display)
+ * loop:poll(fd, "r", function()
+ *     for _, event in ipairs(xlib.drain_events(display)) do
+ *         print(event.name, event.window)
+ *     end
+ * end)
+ */
+int xlib_drain_events(lua_State*);
+
+/** Selects the events this client receives for a window.
+ *
+ * This replaces the previous selection of this client for the window. Other clients are not affected.
+ *
+ * @function XSelectInput
+ * @tparam Display display
+ * @tparam number window
+ * @tparam table mask A table of booleans, one for each of the core event masks, in snake case:
+ *   `key_press`, `key_release`, `button_press`, `button_release`, `enter_window`, `leave_window`,
+ *   `pointer_motion`, `pointer_motion_hint`, `button1_motion` to `button5_motion`, `button_motion`,
+ *   `keymap_state`, `exposure`, `visibility_change`, `structure_notify`, `resize_redirect`,
+ *   `substructure_notify`, `substructure_redirect`, `focus_change`, `property_change`, `colormap_change` and
+ *   `owner_grab_button`.
+ * @usage
+ * xlib.XSelectInput(display, root, { property_change = true, substructure_notify = true })
+ */
+int xlib_select_input(lua_State*);
+
+
+static const struct luaL_Reg event_lib[] = {
+    {"XPending",      xlib_pending     },
+    { "XNextEvent",   xlib_next_event  },
+    { "drain_events", xlib_drain_events},
+    { "XSelectInput", xlib_select_input},
+    { NULL,           NULL             }
+};
+
+#endif // event_h_INCLUDED
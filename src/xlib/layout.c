@@ -0,0 +1,495 @@
+#include "layout.h"
+
+#include "error.h"
+#include "lua_util.h"
+#include "snapshot.h"
+#include "xlib.h"
+#include "xrandr.h"
+
+#include <X11/Xlib.h>
+#include <X11/extensions/randr.h>
+#include <stdio.h>
+#include <string.h>
+
+
+typedef struct {
+    display_t* owner;
+    Display* display;
+    Window window;
+    XRRScreenResources* res;
+    int ncrtc;
+    // The state in the snapshot, and the desired state. Both follow the order of `res->crtcs`.
+    crtc_config_t* current;
+    crtc_config_t* target;
+    // CRTCs whose configuration is set by the transaction.
+    Bool* listed;
+    // CRTCs that have been changed, and need to be restored on rollback.
+    Bool* touched;
+    int screen;
+    unsigned int width;
+    unsigned int height;
+    unsigned int current_width;
+    unsigned int current_height;
+    Bool resized;
+    RROutput primary;
+    RROutput current_primary;
+    Bool primary_changed;
+    // The snapshot's timestamp, until the first change has been made.
+    Time timestamp;
+    // For the stats of the display.
+    int round_trips;
+    // The sequence number of the first request of the current step. Errors for it and any later request
+    // make the step fail.
+    unsigned long request;
+    char error[256];
+} transaction_t;
+
+
+void crtc_config_disabled(crtc_config_t* config) {
+    config->mode = None;
+    config->x = 0;
+    config->y = 0;
+    config->rotation = RR_Rotate_0;
+    config->noutput = 0;
+    config->outputs = NULL;
+    config->width = 0;
+    config->height = 0;
+}
+
+void crtc_config_from_info(crtc_config_t* config, const XRRCrtcInfo* info) {
+    crtc_config_disabled(config);
+    if (info && info->mode != None) {
+        config->mode = info->mode;
+        config->x = info->x;
+        config->y = info->y;
+        config->rotation = info->rotation;
+        config->noutput = info->noutput;
+        config->outputs = info->outputs;
+        config->width = info->width;
+        config->height = info->height;
+    }
+}
+
+Bool crtc_config_has_output(const crtc_config_t* config, RROutput output) {
+    for (int i = 0; i < config->noutput; ++i) {
+        if (config->outputs[i] == output) {
+            return True;
+        }
+    }
+    return False;
+}
+
+Bool crtc_config_equal(const crtc_config_t* a, const crtc_config_t* b) {
+    if (a->mode != b->mode) {
+        return False;
+    }
+    if (a->mode == None) {
+        return True;
+    }
+    if (a->x != b->x || a->y != b->y || a->rotation != b->rotation || a->noutput != b->noutput) {
+        return False;
+    }
+    // The order of outputs doesn't matter to the server.
+    for (int i = 0; i < a->noutput; ++i) {
+        if (!crtc_config_has_output(b, a->outputs[i])) {
+            return False;
+        }
+    }
+    return True;
+}
+
+// Whether one of the current outputs of CRTC `j` is driven by another CRTC in the target state.
+Bool transaction_loses_output(const transaction_t* t, int j) {
+    for (int i = 0; i < t->current[j].noutput; ++i) {
+        RROutput output = t->current[j].outputs[i];
+        for (int k = 0; k < t->ncrtc; ++k) {
+            if (k != j && t->target[k].mode != None && crtc_config_has_output(&t->target[k], output)) {
+                return True;
+            }
+        }
+    }
+    return False;
+}
+
+lua_Integer crtc_config_field(lua_State* L, int index, const char* name, lua_Integer def) {
+    lua_getfield(L, index, name);
+    lua_Integer value = def;
+    if (lua_isnumber(L, -1)) {
+        value = lua_tointeger(L, -1);
+    } else if (!lua_isnil(L, -1)) {
+        luaL_error(L, "field '%s' must be a number", name);
+    }
+    lua_pop(L, 1);
+    return value;
+}
+
+// Reads the `crtcs` of the layout at `index` into `t->target`. `outputs` provides space for `t->res->noutput`
+// outputs per CRTC.
+void transaction_check_layout(lua_State* L, int index, transaction_t* t, screen_resources_t* res, RROutput* outputs) {
+    lua_getfield(L, index, "crtcs");
+    luaL_argcheck(L, lua_istable(L, -1), index, "the layout has no list of CRTCs");
+    int list = lua_gettop(L);
+
+    int n = (int) lua_rawlen(L, list);
+    for (int i = 1; i <= n; ++i) {
+        lua_rawgeti(L, list, i);
+        if (!lua_istable(L, -1)) {
+            luaL_error(L, "CRTC configuration %d is not a table", i);
+        }
+        int entry = lua_gettop(L);
+
+        RRCrtc crtc = (RRCrtc) crtc_config_field(L, entry, "crtc", None);
+        int j = find_xid(t->res->crtcs, t->ncrtc, crtc, i - 1);
+        if (j < 0) {
+            luaL_error(L, "unknown CRTC %d", (int) crtc);
+        }
+
+        crtc_config_t* config = &t->target[j];
+        crtc_config_disabled(config);
+        config->mode = (RRMode) crtc_config_field(L, entry, "mode", None);
+        config->x = (int) crtc_config_field(L, entry, "x", 0);
+        config->y = (int) crtc_config_field(L, entry, "y", 0);
+        config->rotation = (Rotation) crtc_config_field(L, entry, "rotation", RR_Rotate_0);
+        config->outputs = outputs + (size_t) j * t->res->noutput;
+
+        lua_getfield(L, entry, "outputs");
+        if (lua_istable(L, -1)) {
+            int noutput = (int) lua_rawlen(L, -1);
+            if (noutput > t->res->noutput) {
+                luaL_error(L, "too many outputs for CRTC %d", (int) crtc);
+            }
+            for (int k = 0; k < noutput; ++k) {
+                lua_rawgeti(L, -1, k + 1);
+                RROutput output = (RROutput) lua_tointeger(L, -1);
+                lua_pop(L, 1);
+                if (find_xid(t->res->outputs, t->res->noutput, output, k) < 0) {
+                    luaL_error(L, "unknown output %d", (int) output);
+                }
+                config->outputs[config->noutput++] = output;
+            }
+        }
+        lua_pop(L, 1);
+
+        if (config->mode != None) {
+            int m = screen_resources_find_mode(res, config->mode);
+            if (m < 0) {
+                luaL_error(L, "unknown mode %d", (int) config->mode);
+            }
+            if (config->noutput == 0) {
+                luaL_error(L, "CRTC %d has a mode, but no outputs", (int) crtc);
+            }
+
+            const XRRModeInfo* mode = &t->res->modes[m];
+            Bool sideways = (config->rotation & (RR_Rotate_90 | RR_Rotate_270)) != 0;
+            config->width = sideways ? mode->height : mode->width;
+            config->height = sideways ? mode->width : mode->height;
+        }
+
+        t->listed[j] = True;
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+}
+
+// Formats the result of a request into `t->error`. Returns `True` if it succeeded.
+Bool transaction_check(transaction_t* t, Status status, const char* what) {
+    XErrorEvent error;
+    if (display_take_error(t->owner, t->request, NextRequest(t->display) - 1, &error)) {
+        char text[128];
+        XGetErrorText(t->display, error.error_code, text, sizeof(text));
+        snprintf(t->error, sizeof(t->error), "failed to %s: %s", what, text);
+        return False;
+    }
+
+    switch (status) {
+    case RRSetConfigSuccess:
+        return True;
+    case RRSetConfigInvalidConfigTime:
+    case RRSetConfigInvalidTime:
+        snprintf(t->error,
+                 sizeof(t->error),
+                 t->timestamp == CurrentTime ? "failed to %s: invalid time"
+                                             : "failed to %s: the topology changed since the snapshot was taken",
+                 what);
+        return False;
+    default:
+        snprintf(t->error, sizeof(t->error), "failed to %s", what);
+        return False;
+    }
+}
+
+Bool transaction_set_crtc(transaction_t* t, int j, const crtc_config_t* config) {
+    t->round_trips++;
+    t->request = NextRequest(t->display);
+    Status status = XRRSetCrtcConfig(t->display,
+                                     t->res,
+                                     t->res->crtcs[j],
+                                     t->timestamp,
+                                     config->x,
+                                     config->y,
+                                     config->mode,
+                                     config->rotation,
+                                     config->outputs,
+                                     config->noutput);
+
+    char what[64];
+    snprintf(what, sizeof(what), "configure CRTC %lu", (unsigned long) t->res->crtcs[j]);
+    if (!transaction_check(t, status, what)) {
+        return False;
+    }
+
+    // A rejected request leaves the CRTC as it was, so there is nothing to restore.
+    t->touched[j] = True;
+    t->timestamp = CurrentTime;
+    return True;
+}
+
+Bool transaction_set_screen_size(transaction_t* t, unsigned int width, unsigned int height) {
+    int mm_width = DisplayWidthMM(t->display, t->screen);
+    int mm_height = DisplayHeightMM(t->display, t->screen);
+    // Keep the DPI of the screen.
+    if (DisplayWidth(t->display, t->screen) > 0 && DisplayHeight(t->display, t->screen) > 0) {
+        mm_width = (int) ((double) width * mm_width / DisplayWidth(t->display, t->screen) + 0.5);
+        mm_height = (int) ((double) height * mm_height / DisplayHeight(t->display, t->screen) + 0.5);
+    }
+
+    t->request = NextRequest(t->display);
+    XRRSetScreenSize(t->display, t->window, (int) width, (int) height, mm_width, mm_height);
+    XSync(t->display, False);
+    t->round_trips++;
+    return transaction_check(t, RRSetConfigSuccess, "set the screen size");
+}
+
+Bool transaction_set_primary(transaction_t* t, RROutput output) {
+    t->request = NextRequest(t->display);
+    XRRSetOutputPrimary(t->display, t->window, output);
+    XSync(t->display, False);
+    t->round_trips++;
+    return transaction_check(t, RRSetConfigSuccess, "set the primary output");
+}
+
+Bool transaction_apply(transaction_t* t) {
+    crtc_config_t disabled;
+    crtc_config_disabled(&disabled);
+
+    // Disable conflicting CRTCs before resizing the screen, since the server rejects sizes that don't cover
+    // all active CRTCs.
+    for (int j = 0; j < t->ncrtc; ++j) {
+        const crtc_config_t* current = &t->current[j];
+        if (!t->listed[j] || current->mode == None || crtc_config_equal(current, &t->target[j])) {
+            continue;
+        }
+
+        Bool conflicts = t->target[j].mode == None || current->x + current->width > t->width
+                         || current->y + current->height > t->height || transaction_loses_output(t, j);
+        if (conflicts && !transaction_set_crtc(t, j, &disabled)) {
+            return False;
+        }
+    }
+
+    if (t->width != t->current_width || t->height != t->current_height) {
+        t->resized = True;
+        if (!transaction_set_screen_size(t, t->width, t->height)) {
+            return False;
+        }
+    }
+
+    // Every modeset blanks the monitor, so CRTCs that already have the desired configuration are skipped.
+    // Disabled CRTCs are only touched again if they should be enabled.
+    for (int j = 0; j < t->ncrtc; ++j) {
+        if (!t->listed[j]) {
+            continue;
+        }
+        if (t->touched[j] ? t->target[j].mode == None : crtc_config_equal(&t->current[j], &t->target[j])) {
+            continue;
+        }
+        if (!transaction_set_crtc(t, j, &t->target[j])) {
+            return False;
+        }
+    }
+
+    if (t->primary != None && t->primary != t->current_primary) {
+        t->primary_changed = True;
+        if (!transaction_set_primary(t, t->primary)) {
+            return False;
+        }
+    }
+
+    return True;
+}
+
+// Restores everything that was touched to the state in the snapshot.
+Bool transaction_rollback(transaction_t* t) {
+    crtc_config_t disabled;
+    crtc_config_disabled(&disabled);
+    Bool ok = True;
+
+    // Keep the original error, which is the more useful one.
+    char error[sizeof(t->error)];
+    memcpy(error, t->error, sizeof(error));
+    // The snapshot's timestamp is stale once anything has changed, or was the reason the transaction failed.
+    t->timestamp = CurrentTime;
+
+    for (int j = 0; j < t->ncrtc; ++j) {
+        if (t->touched[j]) {
+            ok = transaction_set_crtc(t, j, &disabled) && ok;
+        }
+    }
+    if (t->resized) {
+        ok = transaction_set_screen_size(t, t->current_width, t->current_height) && ok;
+    }
+    for (int j = 0; j < t->ncrtc; ++j) {
+        if (t->touched[j] && t->current[j].mode != None) {
+            ok = transaction_set_crtc(t, j, &t->current[j]) && ok;
+        }
+    }
+    if (t->primary_changed) {
+        ok = transaction_set_primary(t, t->current_primary) && ok;
+    }
+
+    memcpy(t->error, error, sizeof(error));
+    return ok;
+}
+
+int xrandr_apply_layout(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    snapshot_t* snapshot = luaL_checkudata(L, 3, LUA_XRANDR_SNAPSHOT);
+    luaL_checktype(L, 4, LUA_TTABLE);
+
+    // The resources are kept alive by the snapshot.
+    lua_getuservalue(L, 3);
+    lua_getfield(L, -1, "resources");
+    screen_resources_t* res = lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    if (!screen_resources_index_modes(res)) {
+        return luaL_error(L, "failed to allocate mode index");
+    }
+
+    transaction_t t;
+    memset(&t, 0, sizeof(t));
+    t.owner = display;
+    t.display = display->inner;
+    t.window = window;
+    t.res = res->inner;
+    t.ncrtc = res->inner->ncrtc;
+    t.current_primary = snapshot->primary;
+    t.timestamp = res->inner->timestamp;
+
+    // Scratch space that is collected even if a Lua error is raised below.
+    size_t ncrtc = t.ncrtc > 0 ? (size_t) t.ncrtc : 1;
+    t.current = lua_newuserdata(L, ncrtc * sizeof(crtc_config_t));
+    t.target = lua_newuserdata(L, ncrtc * sizeof(crtc_config_t));
+    t.listed = lua_newuserdata(L, 2 * ncrtc * sizeof(Bool));
+    t.touched = t.listed + ncrtc;
+    RROutput* outputs = lua_newuserdata(L, ncrtc * (t.res->noutput > 0 ? t.res->noutput : 1) * sizeof(RROutput));
+
+    for (int j = 0; j < t.ncrtc; ++j) {
+        crtc_config_from_info(&t.current[j], snapshot->crtcs[j]);
+        t.listed[j] = False;
+        t.touched[j] = False;
+    }
+
+    transaction_check_layout(L, 4, &t, res, outputs);
+    t.primary = (RROutput) crtc_config_field(L, 4, "primary", None);
+
+    for (int j = 0; j < t.ncrtc; ++j) {
+        if (!t.listed[j]) {
+            t.target[j] = t.current[j];
+        }
+    }
+
+    // CRTCs that lose an output to another CRTC are disabled, even if they aren't part of the layout.
+    for (int j = 0; j < t.ncrtc; ++j) {
+        if (!t.listed[j] && t.current[j].mode != None && transaction_loses_output(&t, j)) {
+            crtc_config_disabled(&t.target[j]);
+            t.listed[j] = True;
+        }
+    }
+
+    for (int j = 0; j < t.ncrtc; ++j) {
+        const crtc_config_t* config = &t.target[j];
+        if (config->mode != None) {
+            if (config->x + config->width > t.width) {
+                t.width = config->x + config->width;
+            }
+            if (config->y + config->height > t.height) {
+                t.height = config->y + config->height;
+            }
+        }
+    }
+
+    int min_width = 0;
+    int min_height = 0;
+    int max_width = 0;
+    int max_height = 0;
+    double start = stats_begin(display->stats);
+    t.round_trips = 1;
+    if (XRRGetScreenSizeRange(t.display, window, &min_width, &min_height, &max_width, &max_height)) {
+        if ((int) t.width > max_width || (int) t.height > max_height) {
+            stats_record(L, display->stats, "apply_layout", t.round_trips, start);
+            lua_pushnil(L);
+            lua_pushfstring(L,
+                            "the layout needs a screen of %dx%d, but the maximum is %dx%d",
+                            (int) t.width,
+                            (int) t.height,
+                            max_width,
+                            max_height);
+            return 2;
+        }
+        t.width = (int) t.width < min_width ? (unsigned int) min_width : t.width;
+        t.height = (int) t.height < min_height ? (unsigned int) min_height : t.height;
+    }
+
+    t.screen = DefaultScreen(t.display);
+    for (int s = 0; s < ScreenCount(t.display); ++s) {
+        if (RootWindow(t.display, s) == window) {
+            t.screen = s;
+        }
+    }
+
+    // No Lua errors may be raised from here on, until the server is released.
+    XGrabServer(t.display);
+    // Make sure errors end up in the queue, even if another library replaced the handler.
+    int (*previous_handler)(Display*, XErrorEvent*) = XSetErrorHandler(display_error_handler);
+
+    Window root;
+    int x;
+    int y;
+    unsigned int border;
+    unsigned int depth;
+    Bool ok = XGetGeometry(t.display, window, &root, &x, &y, &t.current_width, &t.current_height, &border, &depth);
+    t.round_trips++;
+    if (!ok) {
+        snprintf(t.error, sizeof(t.error), "failed to query the size of window %lu", (unsigned long) window);
+    }
+
+    ok = ok && transaction_apply(&t);
+    if (!ok && !transaction_rollback(&t)) {
+        size_t len = strlen(t.error);
+        snprintf(t.error + len, sizeof(t.error) - len, ", and the rollback failed");
+    }
+
+    XSetErrorHandler(previous_handler);
+    XUngrabServer(t.display);
+    XFlush(t.display);
+    stats_record(L, display->stats, "apply_layout", t.round_trips, start);
+
+    if (!ok) {
+        lua_pushnil(L);
+        lua_pushstring(L, t.error);
+        return 2;
+    }
+
+    lua_newtable(L);
+    int n = 0;
+    for (int j = 0; j < t.ncrtc; ++j) {
+        if (t.touched[j]) {
+            lua_pushinteger(L, t.res->crtcs[j]);
+            lua_rawseti(L, -2, ++n);
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,68 @@
+/** Applying layouts to multiple CRTCs at once.
+ *
+ * @submodule xrandr
+ */
+#ifndef layout_h_INCLUDED
+#define layout_h_INCLUDED
+
+#include "lua_util.h"
+
+#include <X11/extensions/Xrandr.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+// The configuration of a single CRTC. A CRTC is disabled when `mode` is `None`.
+typedef struct {
+    RRMode mode;
+    int x;
+    int y;
+    Rotation rotation;
+    int noutput;
+    RROutput* outputs;
+    // The size on screen, after rotation.
+    unsigned int width;
+    unsigned int height;
+} crtc_config_t;
+
+/** Applies a layout to all CRTCs in a single transaction.
+ *
+ * The required screen size is computed from the new configuration of all CRTCs, including those that aren't
+ * part of the layout. CRTCs that would otherwise conflict with the new configuration are disabled first:
+ * those that don't fit into the new screen size, and those that drive an output that moves to another CRTC.
+ * The latter stay disabled, unless the layout says otherwise.
+ *
+ * All changes are made while the server is grabbed, so that clients never see a partially applied layout.
+ * If any of them fails, all CRTCs, the screen size and the primary output are restored to the state
+ * in `snapshot`.
+ *
+ * If the topology changed since `snapshot` was taken, the layout is not applied.
+ *
+ * Since every modeset blanks the affected monitors, CRTCs whose configuration in `snapshot` already matches
+ * the layout are left alone. The order of outputs doesn't matter for this comparison.
+ *
+ * @function apply_layout
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number window The root window.
+ * @tparam XRRSnapshot snapshot The current topology.
+ * @tparam XRRLayout layout
+ * @treturn[1] table<number> The XIDs of the CRTCs that were actually changed. May be empty.
+ * @treturn[2] nil
+ * @treturn[2] string An error message.
+ * @usage
+ * local snapshot = xrandr.snapshot(display, root, true)
+ * local name, layout = profiles:match(display, snapshot)
+ * if name then
+ *     local touched = assert(xrandr.apply_layout(display, root, snapshot, layout))
+ *     printf("%d modesets", #touched)
+ * end
+ */
+int xrandr_apply_layout(lua_State*);
+
+
+static const struct luaL_Reg layout_lib[] = {
+    {"apply_layout", xrandr_apply_layout},
+    { NULL,          NULL               }
+};
+
+#endif // layout_h_INCLUDED
@@ -28,3 +28,75 @@ void luaU_setstringfield(lua_State* L, int index, const char* key, const char* v
     lua_pushstring(L, value);
     lua_setfield(L, index, key);
 }
+
+void* luaU_newuserdata(lua_State* L, size_t size, const char* name) {
+    void* data = lua_newuserdata(L, size);
+    luaL_getmetatable(L, name);
+    lua_setmetatable(L, -2);
+#if LUA_VERSION_NUM <= 501
+    // Lua 5.1 defaults the environment to the one of the running function, rather than `nil`,
+    // so we need to replace it with a table that we own.
+    lua_newtable(L);
+    lua_setfenv(L, -2);
+#endif
+    return data;
+}
+
+void luaU_setindex(lua_State* L, lua_CFunction fn, const char* const* fields) {
+    lua_newtable(L);
+    for (int i = 0; fields[i] != NULL; ++i) {
+        lua_pushinteger(L, i + 1);
+        lua_setfield(L, -2, fields[i]);
+    }
+
+    lua_pushcclosure(L, fn, 1);
+    lua_setfield(L, -2, "__index");
+}
+
+int luaU_checkfield(lua_State* L, int index) {
+    lua_pushvalue(L, index);
+    lua_rawget(L, lua_upvalueindex(1));
+    int field = (int) lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return field;
+}
+
+int luaU_pushcached(lua_State* L, int index, int key) {
+    index = index < 0 ? lua_gettop(L) + index + 1 : index;
+    key = key < 0 ? lua_gettop(L) + key + 1 : key;
+
+    lua_getuservalue(L, index);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+
+    lua_pushvalue(L, key);
+    lua_rawget(L, -2);
+    lua_remove(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+void luaU_cache(lua_State* L, int index, int key) {
+    // Since we alter the stack before accessing the userdatum, we need to make sure to store absolute indices.
+    index = index < 0 ? lua_gettop(L) + index + 1 : index;
+    key = key < 0 ? lua_gettop(L) + key + 1 : key;
+
+    lua_getuservalue(L, index);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, index);
+    }
+
+    lua_pushvalue(L, key);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
@@ -8,8 +8,11 @@
 #define LUA_MOD_EXPORT extern
 
 #if LUA_VERSION_NUM <= 501
-#define luaL_newlib(L, l) (luaL_register(L, LUA_PULSEAUDIO, l))
-#define lua_rawlen(L, i)  (lua_objlen(L, i))
+#define luaL_newlib(L, l)      (luaL_register(L, LUA_PULSEAUDIO, l))
+#define lua_rawlen(L, i)       (lua_objlen(L, i))
+// Lua 5.1 doesn't have user values, but the environment table of a userdatum serves the same purpose.
+#define lua_getuservalue(L, i) (lua_getfenv(L, i))
+#define lua_setuservalue(L, i) (lua_setfenv(L, i))
 
 void luaL_setfuncs(lua_State*, const luaL_Reg*, int);
 #endif
@@ -18,5 +21,25 @@ void luaL_setfuncs(lua_State*, const luaL_Reg*, int);
 // Sets a key-value pair on the table at `index`.
 void luaU_setstringfield(lua_State*, int, const char*, const char*);
 
+// Creates a userdatum with the given size and metatable. Its user value can be used with `luaU_pushcached`.
+void* luaU_newuserdata(lua_State*, size_t, const char*);
+
+// Sets `__index` on the metatable at the top of the stack.
+// The function receives a table that maps each of the `NULL`-terminated field names to its position
+// in the list, starting at `1`, as upvalue. See `luaU_checkfield`.
+void luaU_setindex(lua_State*, lua_CFunction, const char* const*);
+
+// Returns the position of the key at `index` in the field list given to `luaU_setindex`, or `0` if the key
+// is not a known field. Must only be called from within such an `__index` function.
+int luaU_checkfield(lua_State*, int);
+
+// Pushes the value cached in the user value of the userdatum at `index`, under the key at `key`.
+// Returns `0` and pushes nothing if there is no such value.
+int luaU_pushcached(lua_State*, int, int);
+
+// Caches the value at the top of the stack in the user value of the userdatum at `index`, under the key at `key`.
+// The value stays on the stack.
+void luaU_cache(lua_State*, int, int);
+
 #endif // lua_util_h_INCLUDED
 
@@ -0,0 +1,373 @@
+#include "profile.h"
+
+#include "edid.h"
+#include "lua_util.h"
+#include "snapshot.h"
+#include "xlib.h"
+#include "xrandr.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Parameters of the 64-bit FNV-1a hash.
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+
+typedef struct {
+    RROutput id;
+    const XRROutputInfo* info;
+} fingerprint_output_t;
+
+// A CRTC in a layout that is being resolved. `mode` is the position in the screen resources, or `-1`.
+typedef struct {
+    RROutput output;
+    int mode;
+    int x;
+    int y;
+    Rotation rotation;
+} layout_crtc_t;
+
+
+uint64_t fnv_update(uint64_t hash, const unsigned char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+int compare_output_names(const void* a, const void* b) {
+    return strcmp(((const fingerprint_output_t*) a)->info->name, ((const fingerprint_output_t*) b)->info->name);
+}
+
+int compare_strings(const void* a, const void* b) {
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+uint64_t snapshot_fingerprint(lua_State* L, int display_index, int snapshot_index) {
+    display_index = display_index < 0 ? lua_gettop(L) + display_index + 1 : display_index;
+    snapshot_t* snapshot = luaL_checkudata(L, snapshot_index, LUA_XRANDR_SNAPSHOT);
+    int noutput = snapshot->resources->noutput;
+
+    // Scratch space that is collected even if a Lua error is raised below.
+    fingerprint_output_t* outputs = lua_newuserdata(L, (noutput > 0 ? noutput : 1) * sizeof(fingerprint_output_t));
+    int nconnected = 0;
+    for (int i = 0; i < noutput; ++i) {
+        const XRROutputInfo* info = snapshot->outputs[i];
+        if (info && info->connection == RR_Connected) {
+            outputs[nconnected].id = snapshot->resources->outputs[i];
+            outputs[nconnected].info = info;
+            ++nconnected;
+        }
+    }
+
+    // Sorting by name makes the result independent of the order in which the server lists outputs.
+    qsort(outputs, nconnected, sizeof(fingerprint_output_t), compare_output_names);
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (int i = 0; i < nconnected; ++i) {
+        const XRROutputInfo* info = outputs[i].info;
+        hash = fnv_update(hash, (const unsigned char*) info->name, (size_t) info->nameLen + 1);
+
+        display_push_edid(L, display_index, outputs[i].id, False);
+        edid_t* edid = lua_touserdata(L, -1);
+        if (edid) {
+            hash = fnv_update(hash, edid->data, edid->length);
+        }
+        lua_pop(L, 1);
+
+        // Separates outputs without EDID from the name of the next one.
+        const unsigned char separator = 0xFF;
+        hash = fnv_update(hash, &separator, 1);
+    }
+
+    lua_pop(L, 1);
+    return hash;
+}
+
+void push_fingerprint(lua_State* L, uint64_t fingerprint) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016" PRIx64, fingerprint);
+    lua_pushstring(L, hex);
+}
+
+// Returns the integer field `name` of the table at `index`, or `def` if it isn't set.
+lua_Integer layout_field(lua_State* L, int index, const char* output, const char* name, lua_Integer def) {
+    lua_getfield(L, index, name);
+    lua_Integer value = def;
+    if (lua_isnumber(L, -1)) {
+        value = lua_tointeger(L, -1);
+    } else if (!lua_isnil(L, -1)) {
+        luaL_error(L, "field '%s' of output '%s' must be a number", name, output);
+    }
+    lua_pop(L, 1);
+    return value;
+}
+
+void push_crtc_config(lua_State* L, RRCrtc crtc, RRMode mode, int x, int y, Rotation rotation, RROutput output) {
+    lua_createtable(L, 0, 6);
+
+    lua_pushinteger(L, crtc);
+    lua_setfield(L, -2, "crtc");
+
+    lua_pushinteger(L, mode);
+    lua_setfield(L, -2, "mode");
+
+    lua_pushinteger(L, x);
+    lua_setfield(L, -2, "x");
+
+    lua_pushinteger(L, y);
+    lua_setfield(L, -2, "y");
+
+    lua_pushinteger(L, rotation);
+    lua_setfield(L, -2, "rotation");
+
+    lua_createtable(L, 1, 0);
+    if (output != None) {
+        lua_pushinteger(L, output);
+        lua_rawseti(L, -2, 1);
+    }
+    lua_setfield(L, -2, "outputs");
+}
+
+void push_layout(lua_State* L, int snapshot_index, int layout_index) {
+    snapshot_index = snapshot_index < 0 ? lua_gettop(L) + snapshot_index + 1 : snapshot_index;
+    layout_index = layout_index < 0 ? lua_gettop(L) + layout_index + 1 : layout_index;
+    snapshot_t* snapshot = luaL_checkudata(L, snapshot_index, LUA_XRANDR_SNAPSHOT);
+    luaL_checktype(L, layout_index, LUA_TTABLE);
+
+    // The resources are kept alive by the snapshot.
+    lua_getuservalue(L, snapshot_index);
+    lua_getfield(L, -1, "resources");
+    screen_resources_t* res = lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    if (!screen_resources_index_modes(res)) {
+        luaL_error(L, "failed to allocate mode index");
+    }
+
+    int ncrtc = res->inner->ncrtc;
+    layout_crtc_t* crtcs = lua_newuserdata(L, (ncrtc > 0 ? ncrtc : 1) * sizeof(layout_crtc_t));
+    int scratch_index = lua_gettop(L);
+    for (int j = 0; j < ncrtc; ++j) {
+        crtcs[j].output = None;
+        crtcs[j].mode = -1;
+    }
+
+    int nnames = 0;
+    lua_pushnil(L);
+    while (lua_next(L, layout_index)) {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1)) {
+            ++nnames;
+        }
+        lua_pop(L, 1);
+    }
+
+    // The names are kept alive by the layout table.
+    const char** names = lua_newuserdata(L, (nnames > 0 ? nnames : 1) * sizeof(const char*));
+    int next = 0;
+    lua_pushnil(L);
+    while (lua_next(L, layout_index)) {
+        if (lua_type(L, -2) == LUA_TSTRING && lua_istable(L, -1)) {
+            names[next++] = lua_tostring(L, -2);
+        }
+        lua_pop(L, 1);
+    }
+    // Outputs compete for free CRTCs, so sorting by name makes the result independent of the table's order.
+    qsort(names, nnames, sizeof(const char*), compare_strings);
+
+    RROutput primary = None;
+    // The first pass only assigns outputs to the CRTC they are currently using, so that they keep it.
+    // The second pass assigns the remaining outputs to any free CRTC they support.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int k = 0; k < nnames; ++k) {
+            const char* name = names[k];
+            lua_pushstring(L, name);
+            lua_rawget(L, layout_index);
+            int value_index = lua_gettop(L);
+
+            int i = 0;
+            while (i < res->inner->noutput
+                   && (!snapshot->outputs[i] || strcmp(snapshot->outputs[i]->name, name) != 0)) {
+                ++i;
+            }
+            if (i == res->inner->noutput || snapshot->outputs[i]->connection != RR_Connected) {
+                luaL_error(L, "output '%s' is not connected", name);
+            }
+            RROutput id = res->inner->outputs[i];
+            const XRROutputInfo* info = snapshot->outputs[i];
+
+            Bool assigned = False;
+            for (int j = 0; j < ncrtc && !assigned; ++j) {
+                assigned = crtcs[j].output == id;
+            }
+            if (assigned) {
+                lua_pop(L, 1);
+                continue;
+            }
+
+            int crtc = -1;
+            if (info->crtc != None) {
+                int j = find_xid(res->inner->crtcs, ncrtc, info->crtc, 0);
+                if (j >= 0 && crtcs[j].output == None) {
+                    crtc = j;
+                }
+            }
+            for (int c = 0; pass == 1 && crtc < 0 && c < info->ncrtc; ++c) {
+                int j = find_xid(res->inner->crtcs, ncrtc, info->crtcs[c], c);
+                if (j >= 0 && crtcs[j].output == None) {
+                    crtc = j;
+                }
+            }
+            if (crtc < 0) {
+                if (pass == 1) {
+                    luaL_error(L, "no free CRTC for output '%s'", name);
+                }
+                lua_pop(L, 1);
+                continue;
+            }
+
+            unsigned int width = (unsigned int) layout_field(L, value_index, name, "width", 0);
+            unsigned int height = (unsigned int) layout_field(L, value_index, name, "height", 0);
+            lua_getfield(L, value_index, "refresh");
+            double refresh = lua_tonumber(L, -1);
+            lua_pop(L, 1);
+
+            int mode = screen_resources_best_mode(res, width, height, refresh, info);
+            if (mode < 0) {
+                luaL_error(L, "output '%s' doesn't support %dx%d", name, (int) width, (int) height);
+            }
+
+            crtcs[crtc].output = id;
+            crtcs[crtc].mode = mode;
+            crtcs[crtc].x = (int) layout_field(L, value_index, name, "x", 0);
+            crtcs[crtc].y = (int) layout_field(L, value_index, name, "y", 0);
+            crtcs[crtc].rotation = (Rotation) layout_field(L, value_index, name, "rotation", RR_Rotate_0);
+
+            lua_getfield(L, value_index, "primary");
+            if (lua_toboolean(L, -1)) {
+                primary = id;
+            }
+            lua_pop(L, 2);
+        }
+    }
+
+    lua_createtable(L, 0, 2);
+    lua_createtable(L, ncrtc, 0);
+    int n = 0;
+
+    // Disable unused CRTCs first, to free up screen space and bandwidth for the others.
+    for (int j = 0; j < ncrtc; ++j) {
+        if (crtcs[j].output == None && snapshot->crtcs[j] && snapshot->crtcs[j]->mode != None) {
+            push_crtc_config(L, res->inner->crtcs[j], None, 0, 0, RR_Rotate_0, None);
+            lua_rawseti(L, -2, ++n);
+        }
+    }
+    for (int j = 0; j < ncrtc; ++j) {
+        if (crtcs[j].output != None) {
+            RRMode mode = res->inner->modes[crtcs[j].mode].id;
+            push_crtc_config(
+                L, res->inner->crtcs[j], mode, crtcs[j].x, crtcs[j].y, crtcs[j].rotation, crtcs[j].output);
+            lua_rawseti(L, -2, ++n);
+        }
+    }
+    lua_setfield(L, -2, "crtcs");
+
+    if (primary != None) {
+        lua_pushinteger(L, primary);
+        lua_setfield(L, -2, "primary");
+    }
+
+    lua_remove(L, scratch_index + 1);
+    lua_remove(L, scratch_index);
+}
+
+int xrandr_fingerprint(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    luaL_checkudata(L, 2, LUA_XRANDR_SNAPSHOT);
+
+    push_fingerprint(L, snapshot_fingerprint(L, 1, 2));
+    return 1;
+}
+
+int profile_set_add(lua_State* L) {
+    profile_set_t* set = luaL_checkudata(L, 1, LUA_XRANDR_PROFILE_SET);
+    luaL_checkstring(L, 2);
+    luaL_checkstring(L, 3);
+    luaL_checktype(L, 4, LUA_TTABLE);
+
+    lua_getuservalue(L, 1);
+    lua_pushvalue(L, 3);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        set->count++;
+    }
+    lua_pop(L, 1);
+
+    lua_pushvalue(L, 3);
+    lua_createtable(L, 2, 0);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, 1);
+    lua_pushvalue(L, 4);
+    lua_rawseti(L, -2, 2);
+    lua_rawset(L, -3);
+
+    return 0;
+}
+
+int profile_set_match(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XRANDR_PROFILE_SET);
+    luaL_checkudata(L, 2, LUA_XLIB_DISPLAY);
+    luaL_checkudata(L, 3, LUA_XRANDR_SNAPSHOT);
+
+    push_fingerprint(L, snapshot_fingerprint(L, 2, 3));
+    lua_getuservalue(L, 1);
+    lua_pushvalue(L, -2);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pushnil(L);
+        lua_pushvalue(L, -4);
+        return 2;
+    }
+
+    int profile = lua_gettop(L);
+    lua_rawgeti(L, profile, 1);
+    lua_rawgeti(L, profile, 2);
+    push_layout(L, 3, -1);
+    lua_remove(L, -2);
+
+    return 2;
+}
+
+int profile_set__index(lua_State* L) {
+    profile_set_t* set = luaL_checkudata(L, 1, LUA_XRANDR_PROFILE_SET);
+
+    switch (luaU_checkfield(L, 2)) {
+    case PROFILE_SET_ADD:
+        lua_pushcfunction(L, profile_set_add);
+        break;
+    case PROFILE_SET_MATCH:
+        lua_pushcfunction(L, profile_set_match);
+        break;
+    case PROFILE_SET_COUNT:
+        lua_pushinteger(L, set->count);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+int xrandr_profile_set(lua_State* L) {
+    profile_set_t* set = luaU_newuserdata(L, sizeof(profile_set_t), LUA_XRANDR_PROFILE_SET);
+    set->count = 0;
+
+    // Profiles are stored as `fingerprint -> { name, outputs }`.
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+
+    return 1;
+}
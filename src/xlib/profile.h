@@ -0,0 +1,117 @@
+/** Matching of monitor setups against stored layouts.
+ *
+ * A setup is identified by a fingerprint over the names and EDIDs of the connected outputs.
+ * Profiles map such a fingerprint to a layout, which is resolved to concrete CRTC configurations
+ * for the current topology.
+ *
+ * @submodule xrandr
+ */
+#ifndef profile_h_INCLUDED
+#define profile_h_INCLUDED
+
+#include "lua_util.h"
+
+#include <X11/extensions/Xrandr.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdint.h>
+
+#define LUA_XRANDR_PROFILE_SET "xlib.xrandr.profile_set"
+
+
+// Computes the fingerprint of the snapshot at `snapshot_index`, using the EDID cache of the display at
+// `display_index`.
+uint64_t snapshot_fingerprint(lua_State*, int, int);
+
+// Resolves the layout table at `layout_index` against the snapshot at `snapshot_index`,
+// and pushes the list of CRTC configurations. See @{XRRLayout}.
+void push_layout(lua_State*, int, int);
+
+/** Computes the fingerprint of the connected monitors.
+ *
+ * The fingerprint covers the name and EDID of every connected output. It doesn't depend on the order of
+ * outputs, nor on their XIDs, so it is stable across server restarts.
+ *
+ * @function fingerprint
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam XRRSnapshot snapshot
+ * @treturn string 16 hexadecimal digits.
+ */
+int xrandr_fingerprint(lua_State*);
+
+/**
+ * The desired configuration of a single output in a profile.
+ *
+ * @table XRROutputLayout
+ * @field[type=number] width
+ * @field[type=number] height
+ * @field[type=number] refresh The desired refresh rate. If not set, the highest available rate is used.
+ * @field[type=number] x Defaults to `0`.
+ * @field[type=number] y Defaults to `0`.
+ * @field[type=number] rotation Defaults to `1` (`RR_Rotate_0`).
+ * @field[type=boolean] primary
+ */
+
+/**
+ * A layout resolved against a topology, ready to be applied with @{apply_layout}.
+ *
+ * CRTCs that have to be disabled come first, with `mode == 0` and no outputs.
+ *
+ * @table XRRLayout
+ * @field[type=table] crtcs A list of tables with the fields `crtc`, `mode`, `x`, `y`, `rotation` and `outputs`,
+ *   as expected by @{XRRSetCrtcConfig}.
+ * @field[type=number] primary The XID of the primary output, if any.
+ */
+
+/**
+ * A set of layouts, keyed by fingerprint.
+ *
+ * @table XRRProfileSet
+ * @field[type=function] add `set:add(name, fingerprint, outputs)` stores a profile. `outputs` maps output names
+ *   to an @{XRROutputLayout}, or `false` to disable them. Outputs that aren't listed are disabled as well.
+ * @field[type=function] match `set:match(display, snapshot)` returns the name and resolved @{XRRLayout} of the
+ *   profile for the current setup. If there is none, it returns `nil` and the fingerprint.
+ * @field[type=number] count The number of profiles.
+ */
+typedef struct {
+    int count;
+} profile_set_t;
+
+enum {
+    PROFILE_SET_ADD = 1,
+    PROFILE_SET_MATCH,
+    PROFILE_SET_COUNT,
+};
+
+static const char* const profile_set_fields[] = {
+    "add", "match", "count", NULL,
+};
+
+int profile_set__index(lua_State*);
+
+/** Creates an empty set of profiles.
+ *
+ * Matching computes the fingerprint in C and looks it up directly, so its cost doesn't depend on the number
+ * of profiles.
+ *
+ * @function profile_set
+ * @treturn XRRProfileSet
+ * @usage
+ * local profiles = xrandr.profile_set()
+ * profiles:add("docked", saved_fingerprint, {
+ *     ["DP-1"] = { width = 2560, height = 1440, refresh = 60, primary = true },
+ *     ["eDP-1"] = false,
+ * })
+ *
+ * local name, layout = profiles:match(display, xrandr.snapshot(display, root, true))
+ */
+int xrandr_profile_set(lua_State*);
+
+
+static const struct luaL_Reg profile_lib[] = {
+    {"fingerprint",  xrandr_fingerprint},
+    { "profile_set", xrandr_profile_set},
+    { NULL,          NULL              }
+};
+
+#endif // profile_h_INCLUDED
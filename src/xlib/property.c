@@ -0,0 +1,390 @@
+#include "property.h"
+
+#include "lua_util.h"
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+property_t* push_property(lua_State* L,
+                          unsigned char* data,
+                          unsigned long nitems,
+                          int format,
+                          Atom type,
+                          unsigned long bytes_after) {
+    property_t* prop = lua_newuserdata(L, sizeof(property_t));
+    prop->data = data;
+    prop->capacity = 0;
+    prop->nitems = data ? nitems : 0;
+    prop->format = format;
+    prop->type = type;
+    prop->bytes_after = bytes_after;
+    luaL_getmetatable(L, LUA_XLIB_PROPERTY);
+    lua_setmetatable(L, -2);
+    return prop;
+}
+
+property_t* push_property_packed(lua_State* L,
+                                 const void* value,
+                                 unsigned long nitems,
+                                 int format,
+                                 Atom type,
+                                 unsigned long bytes_after) {
+    // Xlib stores format 32 as `long` and NUL-terminates the data.
+    size_t size = 1;
+    switch (format) {
+    case 8:
+        size = nitems + 1;
+        break;
+    case 16:
+        size = (nitems + 1) * sizeof(short);
+        break;
+    case 32:
+        size = (nitems + 1) * sizeof(long);
+        break;
+    }
+
+    unsigned char* data = calloc(1, size);
+    if (!data) {
+        luaL_error(L, "failed to allocate property buffer");
+    }
+
+    if (format == 32) {
+        for (unsigned long i = 0; i < nitems; ++i) {
+            ((long*) data)[i] = (long) ((const uint32_t*) value)[i];
+        }
+    } else if (format == 16) {
+        memcpy(data, value, nitems * sizeof(short));
+    } else if (format == 8) {
+        memcpy(data, value, nitems);
+    }
+
+    property_t* prop = push_property(L, data, nitems, format, type, bytes_after);
+    prop->capacity = size;
+    return prop;
+}
+
+void property_push_item(lua_State* L, const property_t* prop, unsigned long i) {
+    Bool is_signed = prop->type == XA_INTEGER;
+
+    switch (prop->format) {
+    case 8:
+        if (is_signed) {
+            lua_pushinteger(L, ((signed char*) prop->data)[i]);
+        } else {
+            lua_pushinteger(L, prop->data[i]);
+        }
+        break;
+    case 16:
+        if (is_signed) {
+            lua_pushinteger(L, ((short*) prop->data)[i]);
+        } else {
+            lua_pushinteger(L, ((unsigned short*) prop->data)[i]);
+        }
+        break;
+    case 32:
+        // Only the lower 32 bits of each `long` are part of the value.
+        if (is_signed) {
+            lua_pushinteger(L, (int32_t) ((long*) prop->data)[i]);
+        } else {
+            lua_pushinteger(L, (uint32_t) ((unsigned long*) prop->data)[i]);
+        }
+        break;
+    default:
+        lua_pushnil(L);
+    }
+}
+
+int property_string(lua_State* L) {
+    property_t* prop = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY);
+
+    if (prop->format == 8) {
+        lua_pushlstring(L, (const char*) prop->data, prop->nitems);
+        return 1;
+    }
+
+    luaL_Buffer buf;
+    luaL_buffinit(L, &buf);
+    for (unsigned long i = 0; i < prop->nitems; ++i) {
+        if (prop->format == 16) {
+            unsigned short value = ((unsigned short*) prop->data)[i];
+            luaL_addlstring(&buf, (const char*) &value, sizeof(value));
+        } else {
+            uint32_t value = (uint32_t) ((unsigned long*) prop->data)[i];
+            luaL_addlstring(&buf, (const char*) &value, sizeof(value));
+        }
+    }
+    luaL_pushresult(&buf);
+
+    return 1;
+}
+
+int property_totable(lua_State* L) {
+    property_t* prop = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY);
+
+    lua_createtable(L, (int) prop->nitems, 0);
+    for (unsigned long i = 0; i < prop->nitems; ++i) {
+        property_push_item(L, prop, i);
+        lua_rawseti(L, -2, (int) i + 1);
+    }
+
+    return 1;
+}
+
+int property__gc(lua_State* L) {
+    property_t* prop = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY);
+    if (prop->capacity > 0) {
+        free(prop->data);
+    } else if (prop->data) {
+        XFree(prop->data);
+    }
+    prop->data = NULL;
+    return 0;
+}
+
+int property__len(lua_State* L) {
+    property_t* prop = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY);
+    lua_pushinteger(L, (lua_Integer) prop->nitems);
+    return 1;
+}
+
+int property__index(lua_State* L) {
+    property_t* prop = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY);
+
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        lua_Integer i = lua_tointeger(L, 2);
+        if (i >= 1 && (unsigned long) i <= prop->nitems) {
+            property_push_item(L, prop, (unsigned long) i - 1);
+        } else {
+            lua_pushnil(L);
+        }
+        return 1;
+    }
+
+    switch (luaU_checkfield(L, 2)) {
+    case PROPERTY_TYPE:
+        lua_pushinteger(L, prop->type);
+        break;
+    case PROPERTY_FORMAT:
+        lua_pushinteger(L, prop->format);
+        break;
+    case PROPERTY_BYTES_AFTER:
+        lua_pushinteger(L, prop->bytes_after);
+        break;
+    case PROPERTY_STRING:
+        lua_pushcfunction(L, property_string);
+        break;
+    case PROPERTY_TOTABLE:
+        lua_pushcfunction(L, property_totable);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+const unsigned char* property_check_data(lua_State* L, int index, int* format, int* nelements) {
+    index = index < 0 ? lua_gettop(L) + index + 1 : index;
+
+    switch (lua_type(L, index)) {
+    case LUA_TSTRING: {
+        if (*format != 8) {
+            luaL_argerror(L, index, "strings can only be used with format 8");
+        }
+
+        size_t len = 0;
+        const char* data = lua_tolstring(L, index, &len);
+        *nelements = (int) len;
+        return (const unsigned char*) data;
+    }
+    case LUA_TTABLE: {
+        int n = (int) lua_rawlen(L, index);
+        size_t size = *format == 32 ? sizeof(long) : *format == 16 ? sizeof(short) : sizeof(char);
+        unsigned char* data = lua_newuserdata(L, n > 0 ? n * size : 1);
+
+        for (int i = 0; i < n; ++i) {
+            lua_rawgeti(L, index, i + 1);
+            if (!lua_isnumber(L, -1)) {
+                luaL_error(L, "property data must only contain integers, got %s at %d", luaL_typename(L, -1), i + 1);
+            }
+            lua_Integer value = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+
+            if (*format == 32) {
+                ((long*) data)[i] = (long) value;
+            } else if (*format == 16) {
+                ((short*) data)[i] = (short) value;
+            } else {
+                data[i] = (unsigned char) value;
+            }
+        }
+
+        *nelements = n;
+        return data;
+    }
+    default: {
+        property_t* prop = luaL_checkudata(L, index, LUA_XLIB_PROPERTY);
+        *format = prop->format;
+        *nelements = (int) prop->nitems;
+        return prop->data;
+    }
+    }
+}
+
+Atom property_default_type(lua_State* L, int index) {
+    switch (lua_type(L, index)) {
+    case LUA_TTABLE:
+        return XA_CARDINAL;
+    case LUA_TUSERDATA:
+        return ((property_t*) luaL_checkudata(L, index, LUA_XLIB_PROPERTY))->type;
+    default:
+        return XA_STRING;
+    }
+}
+
+
+// Positions in the user value of a stream.
+enum {
+    PROPERTY_STREAM_DISPLAY = 1,
+    PROPERTY_STREAM_BUFFER,
+};
+
+property_stream_t* push_property_stream(lua_State* L,
+                                        int display_index,
+                                        XID owner,
+                                        Atom property,
+                                        long length,
+                                        Atom req_type,
+                                        property_getter_t get) {
+    display_index = display_index < 0 ? lua_gettop(L) + display_index + 1 : display_index;
+    luaL_argcheck(L, length > 0, 4, "chunk length must be positive");
+
+    property_stream_t* stream = lua_newuserdata(L, sizeof(property_stream_t));
+    stream->display = lua_touserdata(L, display_index);
+    stream->owner = owner;
+    stream->property = property;
+    stream->req_type = req_type;
+    stream->offset = 0;
+    stream->length = length;
+    stream->done = False;
+    stream->get = get;
+    luaL_getmetatable(L, LUA_XLIB_PROPERTY_STREAM);
+    lua_setmetatable(L, -2);
+
+    lua_createtable(L, 2, 0);
+    lua_pushvalue(L, display_index);
+    lua_rawseti(L, -2, PROPERTY_STREAM_DISPLAY);
+
+    // A chunk never holds more than `length` 32-bit units, but Xlib stores format `32` elements as `long`.
+    size_t capacity = (size_t) length * sizeof(long);
+    property_t* buffer = push_property(L, NULL, 0, 0, None, 0);
+    buffer->data = malloc(capacity);
+    if (!buffer->data) {
+        luaL_error(L, "failed to allocate property buffer");
+    }
+    buffer->capacity = capacity;
+    lua_rawseti(L, -2, PROPERTY_STREAM_BUFFER);
+
+    lua_setuservalue(L, -2);
+
+    return stream;
+}
+
+int property_stream_read(lua_State* L) {
+    property_stream_t* stream = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY_STREAM);
+    if (stream->done) {
+        return 0;
+    }
+    if (stream->display->closed) {
+        return luaL_error(L, "display connection is closed");
+    }
+
+    Atom type = None;
+    int format = 0;
+    unsigned long nitems = 0;
+    unsigned long bytes_after = 0;
+    unsigned char* data = NULL;
+
+    double start = stats_begin(stream->display->stats);
+    int status = stream->get(stream->display->inner,
+                             stream->owner,
+                             stream->property,
+                             stream->offset,
+                             stream->length,
+                             False,
+                             stream->req_type,
+                             &type,
+                             &format,
+                             &nitems,
+                             &bytes_after,
+                             &data);
+    stats_record(L, stream->display->stats, "property_stream", 1, start);
+
+    // A type mismatch returns no data, but still reports the remaining size. Reading on would never make progress.
+    if (status != Success || type == None || !data || nitems == 0) {
+        if (data) {
+            XFree(data);
+        }
+        stream->done = True;
+        return 0;
+    }
+
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, -1, PROPERTY_STREAM_BUFFER);
+    property_t* buffer = lua_touserdata(L, -1);
+
+    size_t size = nitems * (format == 32 ? sizeof(long) : format == 16 ? sizeof(short) : sizeof(char));
+    if (size > buffer->capacity) {
+        size = buffer->capacity;
+    }
+    memcpy(buffer->data, data, size);
+    XFree(data);
+
+    buffer->nitems = nitems;
+    buffer->format = format;
+    buffer->type = type;
+    buffer->bytes_after = bytes_after;
+
+    stream->offset += (long) (nitems * format / 32);
+    stream->done = bytes_after == 0;
+
+    return 1;
+}
+
+int property_stream__call(lua_State* L) {
+    // Called by generic `for` with the control variable as additional arguments.
+    lua_settop(L, 1);
+    return property_stream_read(L);
+}
+
+int property_stream__index(lua_State* L) {
+    property_stream_t* stream = luaL_checkudata(L, 1, LUA_XLIB_PROPERTY_STREAM);
+
+    switch (luaU_checkfield(L, 2)) {
+    case PROPERTY_STREAM_READ:
+        lua_pushcfunction(L, property_stream_read);
+        break;
+    case PROPERTY_STREAM_OFFSET:
+        lua_pushinteger(L, stream->offset);
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+int xlib_property_stream(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    Atom property = (Atom) luaL_checkinteger(L, 3);
+    long length = (long) luaL_optinteger(L, 4, 1024);
+    Atom req_type = (Atom) luaL_optinteger(L, 5, AnyPropertyType);
+
+    push_property_stream(L, 1, window, property, length, req_type, XGetWindowProperty);
+    return 1;
+}
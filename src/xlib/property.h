@@ -0,0 +1,179 @@
+/** Property values.
+ *
+ * Property data is returned as a buffer that wraps the memory allocated by Xlib, rather than being copied
+ * into a string or table. Elements are converted individually when they are accessed.
+ *
+ * @submodule xlib
+ */
+#ifndef property_h_INCLUDED
+#define property_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+#define LUA_XLIB_PROPERTY        "xlib.property"
+#define LUA_XLIB_PROPERTY_STREAM "xlib.property_stream"
+
+
+/**
+ * The value of a window or output property.
+ *
+ * Elements are accessed with integer indices, starting at `1`, and `#buffer` returns the number of elements.
+ * Their Lua value depends on the property's type:
+ *
+ * - `INTEGER`: signed integers of the property's format
+ * - `CARDINAL`, `ATOM` and any other type: unsigned integers of the property's format
+ *
+ * @table XProperty
+ * @field[type=number] type The actual type of the property, as X11 `Atom`. `0` (`None`) if the property
+ *   doesn't exist.
+ * @field[type=number] format The size of the elements in bits. One of `8`, `16` or `32`.
+ * @field[type=number] bytes_after The number of bytes left in the value after the requested range.
+ * @field[type=function] string `buffer:string()` returns the data as a string of packed elements.
+ *   For format `32`, elements are packed as 4 bytes, not `sizeof(long)`.
+ * @field[type=function] totable `buffer:totable()` returns all elements as a list.
+ * @usage
+ * local backlight = xrandr.XRRGetOutputProperty(display, output, atom, 0, 1, false, false, XA_INTEGER)
+ * print(backlight[1])
+ */
+typedef struct {
+    // For format `32`, Xlib stores elements as `long`, for format `16` as `short`.
+    // Owned, released with `XFree`, unless `capacity` is set.
+    unsigned char* data;
+    // The size of `data` in bytes, if it was allocated with `malloc` to be reused by a stream. `0` otherwise.
+    size_t capacity;
+    unsigned long nitems;
+    int format;
+    Atom type;
+    unsigned long bytes_after;
+} property_t;
+
+enum {
+    PROPERTY_TYPE = 1,
+    PROPERTY_FORMAT,
+    PROPERTY_BYTES_AFTER,
+    PROPERTY_STRING,
+    PROPERTY_TOTABLE,
+};
+
+static const char* const property_fields[] = {
+    "type", "format", "bytes_after", "string", "totable", NULL,
+};
+
+int property__gc(lua_State*);
+int property__index(lua_State*);
+int property__len(lua_State*);
+
+// Wraps the result of `XGetWindowProperty` or `XRRGetOutputProperty` in a new userdatum,
+// taking ownership of `data`.
+property_t* push_property(lua_State*, unsigned char*, unsigned long, int, Atom, unsigned long);
+
+// Copies data in the format sent over the wire, where elements of format 32 take 4 bytes, into a new userdatum.
+property_t* push_property_packed(lua_State*, const void*, unsigned long, int, Atom, unsigned long);
+
+// Pushes the element at the 0-based position `i`, which must be within bounds.
+void property_push_item(lua_State*, const property_t*, unsigned long);
+
+// Returns the value at `index` in the memory layout that Xlib expects for a property of the given format.
+// Strings and property buffers are used directly, tables are converted into a temporary userdatum
+// that is left on the stack. `format` is updated with the format of property buffers.
+const unsigned char* property_check_data(lua_State*, int, int*, int*);
+
+// Returns the type to write the value at `index` with, when none was given: `CARDINAL` for tables, the buffer's
+// own type for property buffers and `STRING` for everything else.
+Atom property_default_type(lua_State*, int);
+
+
+// The signature of `XGetWindowProperty`. Other property sources, such as RandR outputs, are adapted to it.
+typedef int (*property_getter_t)(Display*,
+                                 XID,
+                                 Atom,
+                                 long,
+                                 long,
+                                 Bool,
+                                 Atom,
+                                 Atom*,
+                                 int*,
+                                 unsigned long*,
+                                 unsigned long*,
+                                 unsigned char**);
+
+/**
+ * Reads a property in chunks of fixed size.
+ *
+ * Every chunk is copied into the same @{XProperty} buffer, so memory use is bounded by the chunk size,
+ * no matter the size of the property. The buffer is only valid until the next chunk is read.
+ *
+ * Streams can be used as iterators in `for` loops.
+ *
+ * @table XPropertyStream
+ * @field[type=function] read `stream:read()` returns the next chunk as @{XProperty},
+ *   or `nil` once the property has been read completely.
+ * @field[type=number] offset The offset of the next chunk, in 32-bit units.
+ */
+typedef struct {
+    display_t* display;
+    XID owner;
+    Atom property;
+    Atom req_type;
+    long offset;
+    long length;
+    Bool done;
+    property_getter_t get;
+} property_stream_t;
+
+enum {
+    PROPERTY_STREAM_READ = 1,
+    PROPERTY_STREAM_OFFSET,
+};
+
+static const char* const property_stream_fields[] = {
+    "read", "offset", NULL,
+};
+
+int property_stream__call(lua_State*);
+int property_stream__index(lua_State*);
+
+// Creates a stream for the property of `owner`, which will be read with `get`. The stream keeps a reference
+// to the display at `display_index`.
+property_stream_t* push_property_stream(lua_State*, int, XID, Atom, long, Atom, property_getter_t);
+
+/** Returns a stream that reads a window property in chunks.
+ *
+ * @function property_stream
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number property An X11 `Atom`.
+ * @tparam[opt=1024] number length The size of each chunk, in 32-bit units.
+ * @tparam[opt] number req_type An X11 `Atom`. Defaults to `AnyPropertyType` (`0`).
+ * @treturn XPropertyStream
+ * @usage
+ * local data = {}
+ * for chunk in xlib.property_stream(display, window, atom, 4096) do
+ *     table.insert(data, chunk:string())
+ * end
+ */
+int xlib_property_stream(lua_State*);
+
+
+static const struct luaL_Reg property_mt[] = {
+    {"__gc",   property__gc },
+    { "__len", property__len},
+    { NULL,    NULL         }
+};
+
+static const struct luaL_Reg property_stream_mt[] = {
+    {"__call", property_stream__call},
+    { NULL,    NULL                 }
+};
+
+static const struct luaL_Reg property_lib[] = {
+    {"property_stream", xlib_property_stream},
+    { NULL,             NULL                }
+};
+
+#endif // property_h_INCLUDED
@@ -0,0 +1,675 @@
+#include "snapshot.h"
+
+#include "async.h"
+#include "lua_util.h"
+#include "property.h"
+#include "xlib.h"
+#include "xrandr.h"
+
+#include <X11/Xlib-xcb.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+XRRScreenResources* screen_resources_from_xcb(xcb_timestamp_t timestamp,
+                                              xcb_timestamp_t config_timestamp,
+                                              const xcb_randr_crtc_t* crtcs,
+                                              int ncrtc,
+                                              const xcb_randr_output_t* outputs,
+                                              int noutput,
+                                              const xcb_randr_mode_info_t* modes,
+                                              int nmode,
+                                              const uint8_t* names) {
+    size_t nbytesname = 0;
+    for (int i = 0; i < nmode; ++i) {
+        nbytesname += modes[i].name_len;
+    }
+
+    // Every mode name gets an additional NUL terminator.
+    size_t size = sizeof(XRRScreenResources) + nmode * sizeof(XRRModeInfo) + ncrtc * sizeof(RRCrtc)
+                  + noutput * sizeof(RROutput) + nbytesname + nmode;
+    XRRScreenResources* res = malloc(size);
+    if (!res) {
+        return NULL;
+    }
+
+    res->timestamp = timestamp;
+    res->configTimestamp = config_timestamp;
+    res->ncrtc = ncrtc;
+    res->noutput = noutput;
+    res->nmode = nmode;
+    res->modes = (XRRModeInfo*) (res + 1);
+    res->crtcs = (RRCrtc*) (res->modes + nmode);
+    res->outputs = (RROutput*) (res->crtcs + ncrtc);
+    char* name = (char*) (res->outputs + noutput);
+
+    for (int i = 0; i < ncrtc; ++i) {
+        res->crtcs[i] = crtcs[i];
+    }
+
+    for (int i = 0; i < noutput; ++i) {
+        res->outputs[i] = outputs[i];
+    }
+
+    for (int i = 0; i < nmode; ++i) {
+        XRRModeInfo* mode = &res->modes[i];
+        mode->id = modes[i].id;
+        mode->width = modes[i].width;
+        mode->height = modes[i].height;
+        mode->dotClock = modes[i].dot_clock;
+        mode->hSyncStart = modes[i].hsync_start;
+        mode->hSyncEnd = modes[i].hsync_end;
+        mode->hTotal = modes[i].htotal;
+        mode->hSkew = modes[i].hskew;
+        mode->vSyncStart = modes[i].vsync_start;
+        mode->vSyncEnd = modes[i].vsync_end;
+        mode->vTotal = modes[i].vtotal;
+        mode->modeFlags = modes[i].mode_flags;
+        mode->nameLength = modes[i].name_len;
+        mode->name = name;
+
+        memcpy(name, names, mode->nameLength);
+        name[mode->nameLength] = '\0';
+        name += mode->nameLength + 1;
+        names += mode->nameLength;
+    }
+
+    return res;
+}
+
+XRROutputInfo* output_info_from_xcb(const xcb_randr_get_output_info_reply_t* reply) {
+    int ncrtc = xcb_randr_get_output_info_crtcs_length(reply);
+    int nmode = xcb_randr_get_output_info_modes_length(reply);
+    int nclone = xcb_randr_get_output_info_clones_length(reply);
+    int nname = xcb_randr_get_output_info_name_length(reply);
+
+    size_t size = sizeof(XRROutputInfo) + ncrtc * sizeof(RRCrtc) + nmode * sizeof(RRMode) + nclone * sizeof(RROutput)
+                  + nname + 1;
+    XRROutputInfo* info = malloc(size);
+    if (!info) {
+        return NULL;
+    }
+
+    info->timestamp = reply->timestamp;
+    info->crtc = reply->crtc;
+    info->mm_width = reply->mm_width;
+    info->mm_height = reply->mm_height;
+    info->connection = reply->connection;
+    info->subpixel_order = reply->subpixel_order;
+    info->ncrtc = ncrtc;
+    info->nmode = nmode;
+    info->npreferred = reply->num_preferred;
+    info->nclone = nclone;
+    info->nameLen = nname;
+    info->crtcs = (RRCrtc*) (info + 1);
+    info->modes = (RRMode*) (info->crtcs + ncrtc);
+    info->clones = (RROutput*) (info->modes + nmode);
+    info->name = (char*) (info->clones + nclone);
+
+    const xcb_randr_crtc_t* crtcs = xcb_randr_get_output_info_crtcs(reply);
+    for (int i = 0; i < ncrtc; ++i) {
+        info->crtcs[i] = crtcs[i];
+    }
+
+    const xcb_randr_mode_t* modes = xcb_randr_get_output_info_modes(reply);
+    for (int i = 0; i < nmode; ++i) {
+        info->modes[i] = modes[i];
+    }
+
+    const xcb_randr_output_t* clones = xcb_randr_get_output_info_clones(reply);
+    for (int i = 0; i < nclone; ++i) {
+        info->clones[i] = clones[i];
+    }
+
+    memcpy(info->name, xcb_randr_get_output_info_name(reply), nname);
+    info->name[nname] = '\0';
+
+    return info;
+}
+
+XRRCrtcInfo* crtc_info_from_xcb(const xcb_randr_get_crtc_info_reply_t* reply) {
+    int noutput = xcb_randr_get_crtc_info_outputs_length(reply);
+    int npossible = xcb_randr_get_crtc_info_possible_length(reply);
+
+    XRRCrtcInfo* info = malloc(sizeof(XRRCrtcInfo) + (noutput + npossible) * sizeof(RROutput));
+    if (!info) {
+        return NULL;
+    }
+
+    info->timestamp = reply->timestamp;
+    info->x = reply->x;
+    info->y = reply->y;
+    info->width = reply->width;
+    info->height = reply->height;
+    info->mode = reply->mode;
+    info->rotation = reply->rotation;
+    info->rotations = reply->rotations;
+    info->noutput = noutput;
+    info->npossible = npossible;
+    info->outputs = (RROutput*) (info + 1);
+    info->possible = info->outputs + noutput;
+
+    const xcb_randr_output_t* outputs = xcb_randr_get_crtc_info_outputs(reply);
+    for (int i = 0; i < noutput; ++i) {
+        info->outputs[i] = outputs[i];
+    }
+
+    const xcb_randr_output_t* possible = xcb_randr_get_crtc_info_possible(reply);
+    for (int i = 0; i < npossible; ++i) {
+        info->possible[i] = possible[i];
+    }
+
+    return info;
+}
+
+
+int snapshot__gc(lua_State* L) {
+    snapshot_t* snapshot = luaL_checkudata(L, 1, LUA_XRANDR_SNAPSHOT);
+    free(snapshot->outputs);
+    free(snapshot->crtcs);
+    return 0;
+}
+
+int snapshot__index(lua_State* L) {
+    snapshot_t* snapshot = luaL_checkudata(L, 1, LUA_XRANDR_SNAPSHOT);
+
+    switch (luaU_checkfield(L, 2)) {
+    case SNAPSHOT_TIMESTAMP:
+        lua_pushinteger(L, snapshot->resources->timestamp);
+        break;
+    case SNAPSHOT_CONFIG_TIMESTAMP:
+        lua_pushinteger(L, snapshot->resources->configTimestamp);
+        break;
+    case SNAPSHOT_PRIMARY:
+        lua_pushinteger(L, snapshot->primary);
+        break;
+    case SNAPSHOT_RESOURCES:
+    case SNAPSHOT_OUTPUTS:
+    case SNAPSHOT_CRTCS:
+        luaU_pushcached(L, 1, 2);
+        break;
+    case SNAPSHOT_MODES:
+        lua_getuservalue(L, 1);
+        lua_getfield(L, -1, "resources");
+        lua_getfield(L, -1, "modes");
+        break;
+    default:
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+XRRScreenResources* screen_resources_from_reply(const xcb_randr_get_screen_resources_reply_t* reply) {
+    return screen_resources_from_xcb(reply->timestamp,
+                                     reply->config_timestamp,
+                                     xcb_randr_get_screen_resources_crtcs(reply),
+                                     xcb_randr_get_screen_resources_crtcs_length(reply),
+                                     xcb_randr_get_screen_resources_outputs(reply),
+                                     xcb_randr_get_screen_resources_outputs_length(reply),
+                                     xcb_randr_get_screen_resources_modes(reply),
+                                     xcb_randr_get_screen_resources_modes_length(reply),
+                                     xcb_randr_get_screen_resources_names(reply));
+}
+
+XRRScreenResources* screen_resources_from_current_reply(const xcb_randr_get_screen_resources_current_reply_t* reply) {
+    return screen_resources_from_xcb(reply->timestamp,
+                                     reply->config_timestamp,
+                                     xcb_randr_get_screen_resources_current_crtcs(reply),
+                                     xcb_randr_get_screen_resources_current_crtcs_length(reply),
+                                     xcb_randr_get_screen_resources_current_outputs(reply),
+                                     xcb_randr_get_screen_resources_current_outputs_length(reply),
+                                     xcb_randr_get_screen_resources_current_modes(reply),
+                                     xcb_randr_get_screen_resources_current_modes_length(reply),
+                                     xcb_randr_get_screen_resources_current_names(reply));
+}
+
+XRRScreenResources* screen_resources_reply(xcb_connection_t* conn, xcb_randr_get_screen_resources_cookie_t cookie) {
+    xcb_generic_error_t* error = NULL;
+    xcb_randr_get_screen_resources_reply_t* reply = xcb_randr_get_screen_resources_reply(conn, cookie, &error);
+    if (!reply) {
+        free(error);
+        return NULL;
+    }
+
+    XRRScreenResources* res = screen_resources_from_reply(reply);
+    free(reply);
+    return res;
+}
+
+XRRScreenResources* screen_resources_current_reply(xcb_connection_t* conn,
+                                                   xcb_randr_get_screen_resources_current_cookie_t cookie) {
+    xcb_generic_error_t* error = NULL;
+    xcb_randr_get_screen_resources_current_reply_t* reply =
+        xcb_randr_get_screen_resources_current_reply(conn, cookie, &error);
+    if (!reply) {
+        free(error);
+        return NULL;
+    }
+
+    XRRScreenResources* res = screen_resources_from_current_reply(reply);
+    free(reply);
+    return res;
+}
+
+int xrandr_snapshot(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    xcb_window_t window = (xcb_window_t) luaL_checkinteger(L, 2);
+    Bool current = lua_toboolean(L, 3);
+    xcb_connection_t* conn = XGetXCBConnection(display->inner);
+    xcb_generic_error_t* error = NULL;
+
+    // The userdata that take ownership of the converted replies are created before they exist, so that a Lua
+    // error can't leak them.
+    snapshot_t* snapshot = luaU_newuserdata(L, sizeof(snapshot_t), LUA_XRANDR_SNAPSHOT);
+    snapshot->resources = NULL;
+    snapshot->outputs = NULL;
+    snapshot->crtcs = NULL;
+    snapshot->primary = None;
+    int snapshot_index = lua_gettop(L);
+
+    lua_createtable(L, 0, 3);
+    lua_pushvalue(L, -1);
+    lua_setuservalue(L, snapshot_index);
+    int uservalue = lua_gettop(L);
+
+    screen_resources_t* res = push_screen_resources(L, NULL);
+    lua_setfield(L, uservalue, "resources");
+
+    double start = stats_begin(display->stats);
+
+    // The primary output doesn't depend on the resources, so both requests can share a round trip.
+    xcb_randr_get_screen_resources_cookie_t res_cookie = { 0 };
+    xcb_randr_get_screen_resources_current_cookie_t current_cookie = { 0 };
+    if (current) {
+        current_cookie = xcb_randr_get_screen_resources_current(conn, window);
+    } else {
+        res_cookie = xcb_randr_get_screen_resources(conn, window);
+    }
+    xcb_randr_get_output_primary_cookie_t primary_cookie = xcb_randr_get_output_primary(conn, window);
+
+    xcb_randr_get_output_primary_reply_t* primary_reply =
+        xcb_randr_get_output_primary_reply(conn, primary_cookie, &error);
+    free(error);
+    snapshot->primary = primary_reply ? primary_reply->output : None;
+    free(primary_reply);
+
+    res->inner =
+        current ? screen_resources_current_reply(conn, current_cookie) : screen_resources_reply(conn, res_cookie);
+    if (!res->inner) {
+        stats_record(L, display->stats, "snapshot", 1, start);
+        return luaL_error(L, "failed to get screen resources");
+    }
+    snapshot->resources = res->inner;
+
+    int noutput = res->inner->noutput;
+    int ncrtc = res->inner->ncrtc;
+    lua_createtable(L, 0, noutput);
+    for (int i = 0; i < noutput; ++i) {
+        output_info_t* out = luaU_newuserdata(L, sizeof(output_info_t), LUA_XRANDR_OUTPUT_INFO);
+        out->inner = NULL;
+        lua_rawseti(L, -2, (lua_Integer) res->inner->outputs[i]);
+    }
+    lua_setfield(L, uservalue, "outputs");
+    lua_createtable(L, 0, ncrtc);
+    for (int i = 0; i < ncrtc; ++i) {
+        crtc_info_t* crtc = luaU_newuserdata(L, sizeof(crtc_info_t), LUA_XRANDR_CRTC_INFO);
+        crtc->inner = NULL;
+        lua_rawseti(L, -2, (lua_Integer) res->inner->crtcs[i]);
+    }
+    lua_setfield(L, uservalue, "crtcs");
+
+    snapshot->outputs = calloc(noutput, sizeof(XRROutputInfo*));
+    snapshot->crtcs = calloc(ncrtc, sizeof(XRRCrtcInfo*));
+    xcb_randr_get_output_info_cookie_t* output_cookies = calloc(noutput, sizeof(xcb_randr_get_output_info_cookie_t));
+    xcb_randr_get_crtc_info_cookie_t* crtc_cookies = calloc(ncrtc, sizeof(xcb_randr_get_crtc_info_cookie_t));
+    if ((noutput > 0 && (!snapshot->outputs || !output_cookies))
+        || (ncrtc > 0 && (!snapshot->crtcs || !crtc_cookies))) {
+        free(output_cookies);
+        free(crtc_cookies);
+        return luaL_error(L, "failed to allocate snapshot");
+    }
+
+    // Send all requests before waiting for the first reply.
+    xcb_timestamp_t config_timestamp = (xcb_timestamp_t) res->inner->configTimestamp;
+    for (int i = 0; i < noutput; ++i) {
+        xcb_randr_output_t output = (xcb_randr_output_t) res->inner->outputs[i];
+        output_cookies[i] = xcb_randr_get_output_info(conn, output, config_timestamp);
+    }
+    for (int i = 0; i < ncrtc; ++i) {
+        xcb_randr_crtc_t crtc = (xcb_randr_crtc_t) res->inner->crtcs[i];
+        crtc_cookies[i] = xcb_randr_get_crtc_info(conn, crtc, config_timestamp);
+    }
+
+    // Collect every reply before touching Lua again. Any error raised while requests are still in flight
+    // would leave their replies queued in XCB.
+    for (int i = 0; i < noutput; ++i) {
+        xcb_randr_get_output_info_reply_t* reply = xcb_randr_get_output_info_reply(conn, output_cookies[i], &error);
+        if (reply) {
+            snapshot->outputs[i] = output_info_from_xcb(reply);
+            free(reply);
+        } else {
+            free(error);
+        }
+    }
+    for (int i = 0; i < ncrtc; ++i) {
+        xcb_randr_get_crtc_info_reply_t* reply = xcb_randr_get_crtc_info_reply(conn, crtc_cookies[i], &error);
+        if (reply) {
+            snapshot->crtcs[i] = crtc_info_from_xcb(reply);
+            free(reply);
+        } else {
+            free(error);
+        }
+    }
+
+    // Hand the infos to their userdata, and drop those that the server didn't return any info for.
+    lua_getfield(L, uservalue, "outputs");
+    for (int i = 0; i < noutput; ++i) {
+        lua_Integer output = (lua_Integer) res->inner->outputs[i];
+        if (snapshot->outputs[i]) {
+            lua_rawgeti(L, -1, output);
+            ((output_info_t*) lua_touserdata(L, -1))->inner = snapshot->outputs[i];
+            lua_pop(L, 1);
+        } else {
+            lua_pushnil(L);
+            lua_rawseti(L, -2, output);
+        }
+    }
+    lua_getfield(L, uservalue, "crtcs");
+    for (int i = 0; i < ncrtc; ++i) {
+        lua_Integer crtc = (lua_Integer) res->inner->crtcs[i];
+        if (snapshot->crtcs[i]) {
+            lua_rawgeti(L, -1, crtc);
+            ((crtc_info_t*) lua_touserdata(L, -1))->inner = snapshot->crtcs[i];
+            lua_pop(L, 1);
+        } else {
+            lua_pushnil(L);
+            lua_rawseti(L, -2, crtc);
+        }
+    }
+    lua_settop(L, snapshot_index);
+
+    if (ncrtc > 0) {
+        stats_sequence(display->stats, crtc_cookies[ncrtc - 1].sequence);
+    } else if (noutput > 0) {
+        stats_sequence(display->stats, output_cookies[noutput - 1].sequence);
+    } else {
+        stats_sequence(display->stats, primary_cookie.sequence);
+    }
+    free(output_cookies);
+    free(crtc_cookies);
+    stats_record(L, display->stats, "snapshot", noutput + ncrtc > 0 ? 2 : 1, start);
+
+    return 1;
+}
+
+// Since the server usually lists resources in the same order every time, the hint is right most of the time.
+int find_xid(const XID* list, int n, XID xid, int hint) {
+    if (hint < n && list[hint] == xid) {
+        return hint;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (list[i] == xid) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Appends the XID to the list `field` of the table at `index`, creating the list if necessary.
+void diff_append(lua_State* L, int index, const char* field, XID xid) {
+    lua_getfield(L, index, field);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, index, field);
+    }
+
+    lua_pushinteger(L, xid);
+    lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+    lua_pop(L, 1);
+}
+
+Bool output_info_equal(const XRROutputInfo* a, const XRROutputInfo* b) {
+    return a->crtc == b->crtc && a->npreferred == b->npreferred && a->nmode == b->nmode
+           && memcmp(a->modes, b->modes, a->nmode * sizeof(RRMode)) == 0;
+}
+
+Bool crtc_info_equal(const XRRCrtcInfo* a, const XRRCrtcInfo* b) {
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height && a->mode == b->mode
+           && a->rotation == b->rotation && a->noutput == b->noutput
+           && memcmp(a->outputs, b->outputs, a->noutput * sizeof(RROutput)) == 0;
+}
+
+Bool modes_equal(const XRRScreenResources* a, const XRRScreenResources* b) {
+    if (a->nmode != b->nmode) {
+        return False;
+    }
+
+    for (int i = 0; i < a->nmode; ++i) {
+        if (a->modes[i].id != b->modes[i].id) {
+            return False;
+        }
+    }
+
+    return True;
+}
+
+int xrandr_diff(lua_State* L) {
+    snapshot_t* prev = luaL_checkudata(L, 1, LUA_XRANDR_SNAPSHOT);
+    snapshot_t* curr = luaL_checkudata(L, 2, LUA_XRANDR_SNAPSHOT);
+    XRRScreenResources* prev_res = prev->resources;
+    XRRScreenResources* curr_res = curr->resources;
+
+    // The server bumps the timestamps with every change to the configuration,
+    // so a stable topology can be detected without looking at any of the infos.
+    if (prev_res->timestamp == curr_res->timestamp && prev_res->configTimestamp == curr_res->configTimestamp
+        && prev->primary == curr->primary) {
+        return 0;
+    }
+
+    lua_newtable(L);
+    int result = lua_gettop(L);
+    int changes = 0;
+
+    for (int i = 0; i < curr_res->noutput; ++i) {
+        RROutput id = curr_res->outputs[i];
+        int j = find_xid(prev_res->outputs, prev_res->noutput, id, i);
+        XRROutputInfo* before = j >= 0 ? prev->outputs[j] : NULL;
+        XRROutputInfo* after = curr->outputs[i];
+
+        Bool was_connected = before && before->connection == RR_Connected;
+        Bool is_connected = after && after->connection == RR_Connected;
+        if (is_connected && !was_connected) {
+            diff_append(L, result, "connected", id);
+            ++changes;
+        } else if (was_connected && !is_connected) {
+            diff_append(L, result, "disconnected", id);
+            ++changes;
+        } else if (before && after && !output_info_equal(before, after)) {
+            diff_append(L, result, "outputs", id);
+            ++changes;
+        }
+    }
+
+    for (int i = 0; i < prev_res->noutput; ++i) {
+        RROutput id = prev_res->outputs[i];
+        XRROutputInfo* before = prev->outputs[i];
+        if (before && before->connection == RR_Connected && find_xid(curr_res->outputs, curr_res->noutput, id, i) < 0) {
+            diff_append(L, result, "disconnected", id);
+            ++changes;
+        }
+    }
+
+    for (int i = 0; i < curr_res->ncrtc; ++i) {
+        RRCrtc id = curr_res->crtcs[i];
+        int j = find_xid(prev_res->crtcs, prev_res->ncrtc, id, i);
+        XRRCrtcInfo* before = j >= 0 ? prev->crtcs[j] : NULL;
+        XRRCrtcInfo* after = curr->crtcs[i];
+
+        if ((before == NULL) != (after == NULL) || (before && !crtc_info_equal(before, after))) {
+            diff_append(L, result, "crtcs", id);
+            ++changes;
+        }
+    }
+
+    for (int i = 0; i < prev_res->ncrtc; ++i) {
+        RRCrtc id = prev_res->crtcs[i];
+        if (prev->crtcs[i] && find_xid(curr_res->crtcs, curr_res->ncrtc, id, i) < 0) {
+            diff_append(L, result, "crtcs", id);
+            ++changes;
+        }
+    }
+
+    if (!modes_equal(prev_res, curr_res)) {
+        lua_pushboolean(L, True);
+        lua_setfield(L, result, "modes");
+        ++changes;
+    }
+
+    if (prev->primary != curr->primary) {
+        lua_pushinteger(L, curr->primary);
+        lua_setfield(L, result, "primary");
+        ++changes;
+    }
+
+    if (changes == 0) {
+        return 0;
+    }
+
+    return 1;
+}
+
+int convert_screen_resources(lua_State* L,
+                             int display_index,
+                             int context,
+                             const future_request_t* requests,
+                             int count) {
+    (void) display_index;
+    (void) count;
+    // Created first, so that the converted resources can't leak.
+    screen_resources_t* res = push_screen_resources(L, NULL);
+    res->inner = lua_toboolean(L, context) ? screen_resources_from_current_reply(requests[0].reply)
+                                           : screen_resources_from_reply(requests[0].reply);
+    if (!res->inner) {
+        return luaL_error(L, "failed to allocate screen resources");
+    }
+    return 1;
+}
+
+int xrandr_get_screen_resources_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    xcb_window_t window = (xcb_window_t) luaL_checkinteger(L, 2);
+    lua_settop(L, 3);
+    lua_pushboolean(L, lua_toboolean(L, 3));
+    xcb_connection_t* conn = XGetXCBConnection(display->inner);
+
+    unsigned int sequence = lua_toboolean(L, 4) ? xcb_randr_get_screen_resources_current(conn, window).sequence
+                                                : xcb_randr_get_screen_resources(conn, window).sequence;
+    push_future(L, 1, sequence, convert_screen_resources, 4);
+    return 1;
+}
+
+int convert_output_info(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) display_index;
+    (void) context;
+    (void) count;
+    // Created first, so that the converted info can't leak.
+    output_info_t* out = luaU_newuserdata(L, sizeof(output_info_t), LUA_XRANDR_OUTPUT_INFO);
+    out->inner = output_info_from_xcb(requests[0].reply);
+    if (!out->inner) {
+        return luaL_error(L, "failed to allocate output info");
+    }
+    return 1;
+}
+
+int xrandr_get_output_info_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    screen_resources_t* res = luaL_checkudata(L, 2, LUA_XRANDR_SCREEN_RESOURCES);
+    xcb_randr_output_t output = (xcb_randr_output_t) luaL_checkinteger(L, 3);
+
+    xcb_randr_get_output_info_cookie_t cookie = xcb_randr_get_output_info(
+        XGetXCBConnection(display->inner), output, (xcb_timestamp_t) res->inner->configTimestamp);
+    push_future(L, 1, cookie.sequence, convert_output_info, 0);
+    return 1;
+}
+
+int convert_crtc_info(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) display_index;
+    (void) context;
+    (void) count;
+    // Created first, so that the converted info can't leak.
+    crtc_info_t* crtc = luaU_newuserdata(L, sizeof(crtc_info_t), LUA_XRANDR_CRTC_INFO);
+    crtc->inner = crtc_info_from_xcb(requests[0].reply);
+    if (!crtc->inner) {
+        return luaL_error(L, "failed to allocate CRTC info");
+    }
+    return 1;
+}
+
+int xrandr_get_crtc_info_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    screen_resources_t* res = luaL_checkudata(L, 2, LUA_XRANDR_SCREEN_RESOURCES);
+    xcb_randr_crtc_t crtc = (xcb_randr_crtc_t) luaL_checkinteger(L, 3);
+
+    xcb_randr_get_crtc_info_cookie_t cookie = xcb_randr_get_crtc_info(
+        XGetXCBConnection(display->inner), crtc, (xcb_timestamp_t) res->inner->configTimestamp);
+    push_future(L, 1, cookie.sequence, convert_crtc_info, 0);
+    return 1;
+}
+
+int convert_output_primary(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) display_index;
+    (void) context;
+    (void) count;
+    lua_pushinteger(L, ((xcb_randr_get_output_primary_reply_t*) requests[0].reply)->output);
+    return 1;
+}
+
+int xrandr_get_output_primary_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    xcb_window_t window = (xcb_window_t) luaL_checkinteger(L, 2);
+
+    xcb_randr_get_output_primary_cookie_t cookie =
+        xcb_randr_get_output_primary(XGetXCBConnection(display->inner), window);
+    push_future(L, 1, cookie.sequence, convert_output_primary, 0);
+    return 1;
+}
+
+int convert_output_property(lua_State* L, int display_index, int context, const future_request_t* requests, int count) {
+    (void) display_index;
+    (void) context;
+    (void) count;
+    xcb_randr_get_output_property_reply_t* reply = requests[0].reply;
+
+    if (reply->type == XCB_ATOM_NONE) {
+        return 0;
+    }
+
+    push_property_packed(L,
+                         xcb_randr_get_output_property_data(reply),
+                         reply->num_items,
+                         reply->format,
+                         reply->type,
+                         reply->bytes_after);
+    return 1;
+}
+
+int xrandr_get_output_property_async(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    xcb_randr_output_t output = (xcb_randr_output_t) luaL_checkinteger(L, 2);
+    xcb_atom_t property = (xcb_atom_t) luaL_checkinteger(L, 3);
+    uint32_t offset = (uint32_t) luaL_optinteger(L, 4, 0);
+    uint32_t length = (uint32_t) luaL_optinteger(L, 5, 1024);
+    uint8_t delete = (uint8_t) lua_toboolean(L, 6);
+    uint8_t pending = (uint8_t) lua_toboolean(L, 7);
+    xcb_atom_t req_type = (xcb_atom_t) luaL_optinteger(L, 8, XCB_GET_PROPERTY_TYPE_ANY);
+
+    xcb_randr_get_output_property_cookie_t cookie = xcb_randr_get_output_property(
+        XGetXCBConnection(display->inner), output, property, req_type, offset, length, delete, pending);
+    push_future(L, 1, cookie.sequence, convert_output_property, 0);
+    return 1;
+}
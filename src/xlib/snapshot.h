@@ -0,0 +1,226 @@
+/** Pipelined snapshots of the RandR topology.
+ *
+ * Querying the full topology through the regular bindings takes one round trip for @{XRRGetScreenResources},
+ * plus one for every call to @{XRRGetOutputInfo} and @{XRRGetCrtcInfo}.
+ * A snapshot sends all of the per-output and per-CRTC requests at once, through the XCB connection that backs
+ * the `Display`, and then collects the replies. This brings the cost down to two round trips, regardless of
+ * the number of outputs and CRTCs.
+ *
+ * @submodule xrandr
+ */
+#ifndef snapshot_h_INCLUDED
+#define snapshot_h_INCLUDED
+
+#include "lua_util.h"
+
+#include <X11/extensions/Xrandr.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <xcb/randr.h>
+
+#define LUA_XRANDR_SNAPSHOT "xlib.xrandr.snapshot"
+
+
+// Conversions from XCB replies to the structures that libxrandr would return.
+// The results are allocated as single blocks, just like libxrandr does,
+// so they can be released with the regular `XRRFree*` functions.
+
+XRRScreenResources* screen_resources_from_xcb(xcb_timestamp_t timestamp,
+                                              xcb_timestamp_t config_timestamp,
+                                              const xcb_randr_crtc_t* crtcs,
+                                              int ncrtc,
+                                              const xcb_randr_output_t* outputs,
+                                              int noutput,
+                                              const xcb_randr_mode_info_t* modes,
+                                              int nmode,
+                                              const uint8_t* names);
+XRROutputInfo* output_info_from_xcb(const xcb_randr_get_output_info_reply_t*);
+XRRCrtcInfo* crtc_info_from_xcb(const xcb_randr_get_crtc_info_reply_t*);
+
+// Returns the position of `xid` in `list`, or `-1`. The position `hint` is checked first.
+int find_xid(const XID*, int, XID, int);
+
+// Convert a reply. Returns `NULL` if allocation fails.
+XRRScreenResources* screen_resources_from_reply(const xcb_randr_get_screen_resources_reply_t*);
+XRRScreenResources* screen_resources_from_current_reply(const xcb_randr_get_screen_resources_current_reply_t*);
+
+// Wait for the reply to the given cookie and convert it. Returns `NULL` on error.
+XRRScreenResources* screen_resources_reply(xcb_connection_t*, xcb_randr_get_screen_resources_cookie_t);
+XRRScreenResources* screen_resources_current_reply(xcb_connection_t*, xcb_randr_get_screen_resources_current_cookie_t);
+
+
+/**
+ * An immutable view of the RandR topology at a single point in time.
+ *
+ * The output and CRTC infos are the same userdata types as returned by @{XRRGetOutputInfo}
+ * and @{XRRGetCrtcInfo}.
+ *
+ * @table XRRSnapshot
+ * @field[type=number] timestamp
+ * @field[type=number] configTimestamp
+ * @field[type=number] primary The XID of the primary output, or `0` if there is none.
+ * @field[type=XRRScreenResources] resources
+ * @field[type=table<number,XRROutputInfo>] outputs Output infos, keyed by the output's XID.
+ * @field[type=table<number,XRRCrtcInfo>] crtcs CRTC infos, keyed by the CRTC's XID.
+ * @field[type=table<XRRMode>] modes Same as `resources.modes`.
+ */
+typedef struct {
+    XRRScreenResources* resources;
+    // Both lists follow the order of `resources`. Entries are `NULL` where the server didn't return any info.
+    // The infos themselves are owned by the userdata stored in the snapshot's user value.
+    XRROutputInfo** outputs;
+    XRRCrtcInfo** crtcs;
+    RROutput primary;
+} snapshot_t;
+
+enum {
+    SNAPSHOT_TIMESTAMP = 1,
+    SNAPSHOT_CONFIG_TIMESTAMP,
+    SNAPSHOT_PRIMARY,
+    SNAPSHOT_RESOURCES,
+    SNAPSHOT_OUTPUTS,
+    SNAPSHOT_CRTCS,
+    SNAPSHOT_MODES,
+};
+
+static const char* const snapshot_fields[] = {
+    "timestamp", "configTimestamp", "primary", "resources", "outputs", "crtcs", "modes", NULL,
+};
+
+int snapshot__gc(lua_State*);
+int snapshot__index(lua_State*);
+
+/** Queries the full RandR topology with pipelined requests.
+ *
+ * @function snapshot
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number window The XID of the window to query.
+ * @tparam[opt=false] boolean current If `true`, don't make the server probe for hardware changes.
+ *   See @{XRRGetScreenResourcesCurrent}.
+ * @treturn XRRSnapshot
+ * @usage
+ * local snapshot = xrandr.snapshot(display, root)
+ * for id, info in pairs(snapshot.outputs) do
+ *     printf("%d: %s %s", id, info.name, info.connection)
+ * end
+ */
+int xrandr_snapshot(lua_State*);
+
+/**
+ * The changes between two snapshots. Fields are only present when there was a change of that kind.
+ *
+ * @table XRRSnapshotDiff
+ * @field[type=table<number>] connected XIDs of outputs that are connected now, but weren't before.
+ * @field[type=table<number>] disconnected XIDs of outputs that were connected before, but aren't anymore.
+ *   This includes outputs that don't exist anymore.
+ * @field[type=table<number>] outputs XIDs of outputs whose connection didn't change,
+ *   but whose CRTC or list of modes did.
+ * @field[type=table<number>] crtcs XIDs of CRTCs that changed position, size, mode, rotation or outputs,
+ *   or that were added or removed.
+ * @field[type=boolean] modes `true` if the list of modes changed.
+ * @field[type=number] primary The XID of the new primary output, if it changed.
+ */
+
+/** Compares two snapshots.
+ *
+ * If both snapshots have the same timestamps and primary output, the topology is considered unchanged
+ * and none of the infos are compared. This makes calling it for every batch of events cheap.
+ *
+ * @function diff
+ * @tparam XRRSnapshot old
+ * @tparam XRRSnapshot new
+ * @treturn[opt] XRRSnapshotDiff `nil` if nothing changed.
+ * @usage
+ * local current = xrandr.snapshot(display, root, true)
+ * local changes = xrandr.diff(previous, current)
+ * if changes and changes.connected then
+ *     apply_profile(current)
+ * end
+ * previous = current
+ */
+int xrandr_diff(lua_State*);
+
+/** Sends a `GetScreenResources` request. See @{xlib.XFuture}.
+ *
+ * @function get_screen_resources_async
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number window
+ * @tparam[opt=false] boolean current Use `GetScreenResourcesCurrent`, which doesn't probe for hardware changes.
+ * @treturn xlib.XFuture Resolves to @{XRRScreenResources}.
+ */
+int xrandr_get_screen_resources_async(lua_State*);
+
+/** Sends a `GetOutputInfo` request. See @{xlib.XFuture}.
+ *
+ * @function get_output_info_async
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam XRRScreenResources resources
+ * @tparam number output The XID of the output.
+ * @treturn xlib.XFuture Resolves to @{XRROutputInfo}.
+ * @usage
+ * local futures = {}
+ * for _, output in ipairs(res.outputs) do
+ *     futures[output] = xrandr.get_output_info_async(display, res, output)
+ * end
+ * for output, future in pairs(futures) do
+ *     infos[output] = future:wait()
+ * end
+ */
+int xrandr_get_output_info_async(lua_State*);
+
+/** Sends a `GetCrtcInfo` request. See @{xlib.XFuture}.
+ *
+ * @function get_crtc_info_async
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam XRRScreenResources resources
+ * @tparam number crtc The XID of the CRTC.
+ * @treturn xlib.XFuture Resolves to @{XRRCrtcInfo}.
+ */
+int xrandr_get_crtc_info_async(lua_State*);
+
+/** Sends a `GetOutputPrimary` request. See @{xlib.XFuture}.
+ *
+ * @function get_output_primary_async
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number window
+ * @treturn xlib.XFuture Resolves to the XID of the primary output, or `0`.
+ */
+int xrandr_get_output_primary_async(lua_State*);
+
+/** Sends a `GetOutputProperty` request. See @{xlib.XFuture} and @{XRRGetOutputProperty}.
+ *
+ * @function get_output_property_async
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number output The XID of the output.
+ * @tparam number property An X11 `Atom`.
+ * @tparam[opt=0] number offset In 32-bit units.
+ * @tparam[opt=1024] number length In 32-bit units.
+ * @tparam[opt=false] boolean delete
+ * @tparam[opt=false] boolean pending
+ * @tparam[opt] number req_type An X11 `Atom`. Defaults to `AnyPropertyType` (`0`).
+ * @treturn xlib.XFuture Resolves to an @{xlib.XProperty}, or to nothing if the property doesn't exist.
+ */
+int xrandr_get_output_property_async(lua_State*);
+
+
+static const struct luaL_Reg snapshot_mt[] = {
+    {"__gc", snapshot__gc},
+    { NULL,  NULL        }
+};
+
+static const struct luaL_Reg snapshot_lib[] = {
+    {"snapshot", xrandr_snapshot},
+    { "diff",    xrandr_diff    },
+    { NULL,      NULL           }
+};
+
+static const struct luaL_Reg snapshot_async_lib[] = {
+    {"get_screen_resources_async", xrandr_get_screen_resources_async},
+    { "get_output_info_async",     xrandr_get_output_info_async     },
+    { "get_crtc_info_async",       xrandr_get_crtc_info_async       },
+    { "get_output_primary_async",  xrandr_get_output_primary_async  },
+    { "get_output_property_async", xrandr_get_output_property_async },
+    { NULL,                        NULL                             }
+};
+
+#endif // snapshot_h_INCLUDED
@@ -0,0 +1,222 @@
+#include "stats.h"
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib-xcb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+double stats_begin(const stats_t* stats) {
+    if (stats == NULL) {
+        return 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+stats_binding_t* stats_find_binding(stats_t* stats, const char* name) {
+    // Most calls come from the same call site, so comparing the pointers first is usually enough.
+    for (int i = 0; i < stats->nbindings; ++i) {
+        if (stats->bindings[i].name == name || strcmp(stats->bindings[i].name, name) == 0) {
+            return &stats->bindings[i];
+        }
+    }
+
+    if (stats->nbindings == STATS_MAX_BINDINGS) {
+        return NULL;
+    }
+
+    stats_binding_t* binding = &stats->bindings[stats->nbindings++];
+    memset(binding, 0, sizeof(stats_binding_t));
+    binding->name = name;
+    return binding;
+}
+
+// The sequence number of the last request that was sent, truncated to 32 bits like XCB's.
+unsigned int stats_current_sequence(const stats_t* stats) {
+    unsigned int sequence = (unsigned int) (XNextRequest(stats->display) - 1);
+    if ((int) (stats->last_sequence - sequence) > 0) {
+        sequence = stats->last_sequence;
+    }
+    return sequence;
+}
+
+void stats_record(lua_State* L, stats_t* stats, const char* name, int round_trips, double start) {
+    if (stats == NULL) {
+        return;
+    }
+
+    double end = stats_begin(stats);
+    if (stats->trace != NULL) {
+        trace_record(L, stats->trace, name, start, end, stats_current_sequence(stats), round_trips);
+    }
+    if (!stats->counting) {
+        return;
+    }
+
+    double elapsed = end - start;
+    stats->round_trips += (unsigned long) round_trips;
+
+    stats_binding_t* binding = stats_find_binding(stats, name);
+    if (binding == NULL) {
+        return;
+    }
+
+    binding->calls++;
+    binding->round_trips += (unsigned long) round_trips;
+    binding->total += elapsed;
+    if (elapsed > binding->max) {
+        binding->max = elapsed;
+    }
+
+    double us = elapsed * 1e6;
+    int bucket = 0;
+    for (double bound = 1; us >= bound && bucket < STATS_BUCKETS - 1; bound *= 2) {
+        ++bucket;
+    }
+    binding->histogram[bucket]++;
+}
+
+void stats_sequence(stats_t* stats, unsigned int sequence) {
+    // Sequence numbers wrap around, so only their difference is meaningful.
+    if (stats != NULL && (int) (sequence - stats->last_sequence) > 0) {
+        stats->last_sequence = sequence;
+    }
+}
+
+void stats_reset(stats_t* stats) {
+    xcb_connection_t* conn = XGetXCBConnection(stats->display);
+    stats->base_sequence = stats_current_sequence(stats);
+    stats->base_read = xcb_total_read(conn);
+    stats->base_written = xcb_total_written(conn);
+    stats->round_trips = 0;
+    stats->nbindings = 0;
+}
+
+stats_t* stats_ensure(lua_State* L, stats_t** stats, Display* display) {
+    if (*stats == NULL) {
+        stats_t* new_stats = malloc(sizeof(stats_t));
+        if (new_stats == NULL) {
+            luaL_error(L, "failed to allocate memory for stats");
+            return NULL;
+        }
+
+        new_stats->display = display;
+        new_stats->counting = False;
+        new_stats->trace = NULL;
+        new_stats->last_sequence = (unsigned int) (XNextRequest(display) - 1);
+        *stats = new_stats;
+    }
+    return *stats;
+}
+
+void stats_release(stats_t** stats) {
+    if (*stats != NULL && !(*stats)->counting && (*stats)->trace == NULL) {
+        free(*stats);
+        *stats = NULL;
+    }
+}
+
+void stats_free(stats_t** stats) {
+    if (*stats != NULL) {
+        free((*stats)->trace);
+        free(*stats);
+        *stats = NULL;
+    }
+}
+
+display_t* stats_check_display(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    if (display->closed) {
+        luaL_error(L, "display connection is closed");
+    }
+    return display;
+}
+
+int xlib_enable_stats(lua_State* L) {
+    display_t* display = stats_check_display(L);
+    Bool enable = lua_isnone(L, 2) || lua_toboolean(L, 2);
+
+    if (!enable) {
+        if (display->stats != NULL) {
+            display->stats->counting = False;
+            stats_release(&display->stats);
+        }
+        return 0;
+    }
+
+    stats_t* stats = stats_ensure(L, &display->stats, display->inner);
+    stats->counting = True;
+    stats_reset(stats);
+
+    return 0;
+}
+
+int xlib_stats(lua_State* L) {
+    display_t* display = stats_check_display(L);
+    const stats_t* stats = display->stats;
+    if (stats == NULL || !stats->counting) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    xcb_connection_t* conn = XGetXCBConnection(display->inner);
+
+    lua_createtable(L, 0, 5);
+
+    lua_pushinteger(L, (lua_Integer) (stats_current_sequence(stats) - stats->base_sequence));
+    lua_setfield(L, -2, "requests");
+
+    lua_pushinteger(L, (lua_Integer) stats->round_trips);
+    lua_setfield(L, -2, "round_trips");
+
+    lua_pushnumber(L, (lua_Number) (xcb_total_read(conn) - stats->base_read));
+    lua_setfield(L, -2, "bytes_read");
+
+    lua_pushnumber(L, (lua_Number) (xcb_total_written(conn) - stats->base_written));
+    lua_setfield(L, -2, "bytes_written");
+
+    lua_createtable(L, 0, stats->nbindings);
+    for (int i = 0; i < stats->nbindings; ++i) {
+        const stats_binding_t* binding = &stats->bindings[i];
+
+        lua_createtable(L, 0, 5);
+
+        lua_pushinteger(L, (lua_Integer) binding->calls);
+        lua_setfield(L, -2, "calls");
+
+        lua_pushinteger(L, (lua_Integer) binding->round_trips);
+        lua_setfield(L, -2, "round_trips");
+
+        lua_pushnumber(L, binding->total * 1e6);
+        lua_setfield(L, -2, "total_us");
+
+        lua_pushnumber(L, binding->max * 1e6);
+        lua_setfield(L, -2, "max_us");
+
+        lua_createtable(L, STATS_BUCKETS, 0);
+        for (int j = 0; j < STATS_BUCKETS; ++j) {
+            lua_pushinteger(L, (lua_Integer) binding->histogram[j]);
+            lua_rawseti(L, -2, j + 1);
+        }
+        lua_setfield(L, -2, "histogram");
+
+        lua_setfield(L, -2, binding->name);
+    }
+    lua_setfield(L, -2, "bindings");
+
+    return 1;
+}
+
+int xlib_reset_stats(lua_State* L) {
+    display_t* display = stats_check_display(L);
+    if (display->stats != NULL && display->stats->counting) {
+        stats_reset(display->stats);
+    }
+    return 0;
+}
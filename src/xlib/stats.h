@@ -0,0 +1,127 @@
+/** Round trip and latency counters.
+ *
+ * Most bindings block until the server has answered. When a program is slow, the cause is usually a burst
+ * of such round trips. Once enabled with @{enable_stats}, a display connection counts them, along with the time
+ * that each binding spent blocked inside Xlib or XCB.
+ *
+ * @submodule xlib
+ */
+#ifndef stats_h_INCLUDED
+#define stats_h_INCLUDED
+
+#include "lua_util.h"
+#include "trace.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdint.h>
+
+// The number of bindings that can be tracked per connection. Calls to any further bindings are only counted
+// in the totals.
+#define STATS_MAX_BINDINGS 64
+// Bucket `i` counts calls that took less than `2^i` microseconds, but not less than `2^(i - 1)`.
+// The last bucket counts everything that took longer.
+#define STATS_BUCKETS 24
+
+
+typedef struct {
+    // Names are expected to be string literals. They are never copied.
+    const char* name;
+    unsigned long calls;
+    unsigned long round_trips;
+    // In seconds.
+    double total;
+    double max;
+    unsigned long histogram[STATS_BUCKETS];
+} stats_binding_t;
+
+// Allocated while either the counters or tracing are enabled.
+typedef struct {
+    Display* display;
+    Bool counting;
+    // `NULL` while tracing is disabled.
+    trace_t* trace;
+    // Sequence number of the last request that was sent when the counters were reset.
+    unsigned int base_sequence;
+    // The highest sequence number seen on a reply to a request that was sent through XCB directly.
+    // Xlib only learns about those once it sends its next request.
+    unsigned int last_sequence;
+    uint64_t base_read;
+    uint64_t base_written;
+    unsigned long round_trips;
+    int nbindings;
+    stats_binding_t bindings[STATS_MAX_BINDINGS];
+} stats_t;
+
+// Returns the stats stored at `stats`, the field of a display, allocating them for the given connection if
+// neither the counters nor tracing were enabled yet.
+stats_t* stats_ensure(lua_State*, stats_t**, Display*);
+
+// Releases the stats stored at `stats` once neither the counters nor tracing need them anymore.
+void stats_release(stats_t**);
+
+// Releases the stats stored at `stats`, including the trace.
+void stats_free(stats_t**);
+
+// Returns the start time of a blocking call, to be passed to `stats_record`.
+// `stats` may be `NULL`, when neither counters nor tracing are enabled for the connection.
+double stats_begin(const stats_t*);
+
+// Records a call to the binding `name` that started at `start` and waited for `round_trips` replies.
+// The Lua state is used to find the caller for the trace.
+void stats_record(lua_State*, stats_t*, const char*, int, double);
+
+// Records that the reply to the request with the given sequence number has been received.
+void stats_sequence(stats_t*, unsigned int);
+
+
+/** Enables or disables the counters for a display connection.
+ *
+ * Enabling them resets all counters. Collecting them costs two reads of the monotonic clock per blocking call.
+ *
+ * @function enable_stats
+ * @tparam Display display
+ * @tparam[opt=true] boolean enable
+ */
+int xlib_enable_stats(lua_State*);
+
+/** Returns the counters for a display connection.
+ *
+ * `requests` includes those sent by the `*_async` variants once their replies have been received.
+ *
+ * @function stats
+ * @tparam Display display
+ * @treturn[1] table A table with the fields `requests`, `round_trips`, `bytes_read`, `bytes_written` and
+ *   `bindings`. The latter maps the name of each binding that waited for the server to a table with the fields
+ *   `calls`, `round_trips`, `total_us`, `max_us` and `histogram`. `histogram[i]` counts the calls that took
+ *   less than `2^(i - 1)` microseconds, but not less than `2^(i - 2)`.
+ * @treturn[2] nil If the counters are disabled.
+ * @usage
+ * xlib.enable_stats(display)
+ * handle_events()
+ * local stats = xlib.stats(display)
+ * for name, binding in pairs(stats.bindings) do
+ *     print(name, binding.round_trips, binding.total_us)
+ * end
+ */
+int xlib_stats(lua_State*);
+
+/** Resets all counters for a display connection.
+ *
+ * Has no effect if the counters are disabled.
+ *
+ * @function reset_stats
+ * @tparam Display display
+ */
+int xlib_reset_stats(lua_State*);
+
+
+static const struct luaL_Reg stats_lib[] = {
+    {"enable_stats", xlib_enable_stats},
+    { "stats",       xlib_stats       },
+    { "reset_stats", xlib_reset_stats },
+    { NULL,          NULL             }
+};
+
+#endif // stats_h_INCLUDED
@@ -0,0 +1,163 @@
+#include "trace.h"
+
+#include "lua_util.h"
+#include "stats.h"
+#include "xlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+trace_t* trace_new(size_t capacity) {
+    if (capacity > TRACE_MAX_CAPACITY) {
+        return NULL;
+    }
+
+    trace_t* trace = malloc(sizeof(trace_t) + capacity * sizeof(trace_event_t));
+    if (trace == NULL) {
+        return NULL;
+    }
+
+    trace->capacity = capacity;
+    trace->next = 0;
+    trace->count = 0;
+    return trace;
+}
+
+void trace_record(lua_State* L,
+                  trace_t* trace,
+                  const char* name,
+                  double start,
+                  double end,
+                  unsigned int sequence,
+                  int round_trips) {
+    trace_event_t* event = &trace->events[trace->next];
+    trace->next = (trace->next + 1) % trace->capacity;
+    trace->count++;
+
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    event->sequence = sequence;
+    event->round_trips = round_trips;
+    event->where[0] = '\0';
+
+    // Level `0` is the running C function, so level `1` is whatever called the binding.
+    lua_Debug ar;
+    if (lua_getstack(L, 1, &ar) && lua_getinfo(L, "Sl", &ar)) {
+        if (ar.currentline > 0) {
+            snprintf(event->where, TRACE_WHERE_LENGTH, "%s:%d", ar.short_src, ar.currentline);
+        } else {
+            snprintf(event->where, TRACE_WHERE_LENGTH, "%s", ar.short_src);
+        }
+    }
+}
+
+void trace_add_json_string(luaL_Buffer* b, const char* s) {
+    luaL_addchar(b, '"');
+    for (; *s != '\0'; ++s) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            luaL_addchar(b, '\\');
+            luaL_addchar(b, (char) c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            luaL_addstring(b, escaped);
+        } else {
+            luaL_addchar(b, (char) c);
+        }
+    }
+    luaL_addchar(b, '"');
+}
+
+int xlib_enable_trace(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    if (display->closed) {
+        return luaL_error(L, "display connection is closed");
+    }
+    Bool enable = lua_isnone(L, 2) || lua_toboolean(L, 2);
+    lua_Integer capacity = luaL_optinteger(L, 3, TRACE_DEFAULT_CAPACITY);
+    luaL_argcheck(L, capacity > 0, 3, "capacity must be positive");
+    luaL_argcheck(L, (uintmax_t) capacity <= TRACE_MAX_CAPACITY, 3, "capacity is too large");
+
+    if (!enable) {
+        if (display->stats != NULL) {
+            free(display->stats->trace);
+            display->stats->trace = NULL;
+            stats_release(&display->stats);
+        }
+        return 0;
+    }
+
+    stats_t* stats = stats_ensure(L, &display->stats, display->inner);
+    trace_t* trace = trace_new((size_t) capacity);
+    if (trace == NULL) {
+        stats_release(&display->stats);
+        return luaL_error(L, "failed to allocate memory for trace");
+    }
+
+    free(stats->trace);
+    stats->trace = trace;
+
+    return 0;
+}
+
+int xlib_dump_trace(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Bool clear = lua_toboolean(L, 2);
+    if (display->stats == NULL || display->stats->trace == NULL) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    trace_t* trace = display->stats->trace;
+    size_t n = trace->count < trace->capacity ? (size_t) trace->count : trace->capacity;
+    size_t first = trace->count < trace->capacity ? 0 : trace->next;
+    char number[128];
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    luaL_addstring(&b, "{\"traceEvents\":[");
+
+    // Name the connection, so that traces of several displays can be told apart.
+    luaL_addstring(&b, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":");
+    trace_add_json_string(&b, display->closed ? "X11" : DisplayString(display->inner));
+    luaL_addstring(&b, "}}");
+
+    for (size_t i = 0; i < n; ++i) {
+        const trace_event_t* event = &trace->events[(first + i) % trace->capacity];
+
+        luaL_addstring(&b, ",\n{\"name\":");
+        trace_add_json_string(&b, event->name);
+        snprintf(number,
+                 sizeof(number),
+                 ",\"cat\":\"xlib\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f",
+                 event->start * 1e6,
+                 (event->end - event->start) * 1e6);
+        luaL_addstring(&b, number);
+        snprintf(number,
+                 sizeof(number),
+                 ",\"args\":{\"sequence\":%u,\"round_trips\":%d,\"where\":",
+                 event->sequence,
+                 event->round_trips);
+        luaL_addstring(&b, number);
+        trace_add_json_string(&b, event->where);
+        luaL_addstring(&b, "}}");
+    }
+
+    // Events that were overwritten because the buffer was full.
+    snprintf(number,
+             sizeof(number),
+             "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%lu}}\n",
+             trace->count - (unsigned long) n);
+    luaL_addstring(&b, number);
+    luaL_pushresult(&b);
+
+    if (clear) {
+        trace->next = 0;
+        trace->count = 0;
+    }
+
+    return 1;
+}
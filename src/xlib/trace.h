@@ -0,0 +1,100 @@
+/** Call tracing.
+ *
+ * While the counters from @{stats} show how many round trips happened, a trace shows when they happened,
+ * and which Lua code triggered them. Once enabled with @{enable_trace}, every call to a binding that waits for
+ * the server is recorded in a ring buffer, along with the sequence number of the last request that was sent,
+ * and the Lua function and line it was called from.
+ *
+ * The trace can be exported in the
+ * [Trace Event Format](https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU),
+ * which is understood by `chrome://tracing` and [Perfetto](https://ui.perfetto.dev).
+ *
+ * @submodule xlib
+ */
+#ifndef trace_h_INCLUDED
+#define trace_h_INCLUDED
+
+#include "lua_util.h"
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_DEFAULT_CAPACITY 4096
+// The largest capacity whose size still fits into a `size_t`.
+#define TRACE_MAX_CAPACITY ((SIZE_MAX - sizeof(trace_t)) / sizeof(trace_event_t))
+// Long enough for most `file.lua:line` locations. Longer ones are truncated.
+#define TRACE_WHERE_LENGTH 64
+
+
+typedef struct {
+    // A string literal, like in `stats_binding_t`.
+    const char* name;
+    // In seconds, from the monotonic clock.
+    double start;
+    double end;
+    unsigned int sequence;
+    int round_trips;
+    char where[TRACE_WHERE_LENGTH];
+} trace_event_t;
+
+typedef struct {
+    size_t capacity;
+    // The position of the next event. Once the buffer is full, this is the oldest event.
+    size_t next;
+    // The number of events recorded since the trace was enabled or cleared, including those that were
+    // overwritten.
+    unsigned long count;
+    trace_event_t events[];
+} trace_t;
+
+// Allocates an empty trace. Returns `NULL` if out of memory, or if `capacity` exceeds `TRACE_MAX_CAPACITY`.
+trace_t* trace_new(size_t);
+
+// Records a call to the binding `name`, made from the Lua function that called the running C function.
+void trace_record(lua_State*, trace_t*, const char*, double, double, unsigned int, int);
+
+
+/** Enables or disables tracing for a display connection.
+ *
+ * Enabling it discards any events recorded so far. Only calls that block until the server has answered are
+ * recorded. Requests that don't wait for a reply, like @{XChangeProperty} or the `*_async` variants, show up as
+ * part of the sequence numbers of later calls instead, e.g. of `XFuture:wait`.
+ *
+ * @function enable_trace
+ * @tparam Display display
+ * @tparam[opt=true] boolean enable
+ * @tparam[opt=4096] number capacity The number of calls to keep. Once the buffer is full, the oldest calls
+ *   are overwritten.
+ */
+int xlib_enable_trace(lua_State*);
+
+/** Returns the recorded calls in the Trace Event Format, as a JSON string.
+ *
+ * Every call is a complete event (`"ph": "X"`), with the sequence number, the number of round trips, and the
+ * Lua location in `args`. Timestamps are in microseconds from an arbitrary point, so traces of different
+ * connections in the same process line up.
+ *
+ * @function dump_trace
+ * @tparam Display display
+ * @tparam[opt=false] boolean clear Discard the recorded calls afterwards.
+ * @treturn[1] string
+ * @treturn[2] nil If tracing is disabled.
+ * @usage
+ * xlib.enable_trace(display)
+ * handle_hotplug()
+ * local file = assert(io.open("hotplug.json", "w"))
+ * file:write(xlib.dump_trace(display))
+ * file:close()
+ */
+int xlib_dump_trace(lua_State*);
+
+
+static const struct luaL_Reg trace_lib[] = {
+    {"enable_trace", xlib_enable_trace},
+    { "dump_trace",  xlib_dump_trace  },
+    { NULL,          NULL             }
+};
+
+#endif // trace_h_INCLUDED
@@ -0,0 +1,49 @@
+#include "window.h"
+
+#include "lua_util.h"
+#include "xlib.h"
+
+
+int xlib_create_simple_window(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window parent = (Window) luaL_checkinteger(L, 2);
+    int x = (int) luaL_checkinteger(L, 3);
+    int y = (int) luaL_checkinteger(L, 4);
+    unsigned int width = (unsigned int) luaL_checkinteger(L, 5);
+    unsigned int height = (unsigned int) luaL_checkinteger(L, 6);
+    unsigned int border_width = (unsigned int) luaL_optinteger(L, 7, 0);
+    luaL_argcheck(L, width > 0, 5, "width must be positive");
+    luaL_argcheck(L, height > 0, 6, "height must be positive");
+
+    Window window = XCreateSimpleWindow(display->inner, parent, x, y, width, height, border_width, 0, 0);
+    lua_pushinteger(L, (lua_Integer) window);
+    return 1;
+}
+
+int xlib_map_window(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    XMapWindow(display->inner, window);
+    return 0;
+}
+
+int xlib_move_resize_window(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    int x = (int) luaL_checkinteger(L, 3);
+    int y = (int) luaL_checkinteger(L, 4);
+    unsigned int width = (unsigned int) luaL_checkinteger(L, 5);
+    unsigned int height = (unsigned int) luaL_checkinteger(L, 6);
+    luaL_argcheck(L, width > 0, 5, "width must be positive");
+    luaL_argcheck(L, height > 0, 6, "height must be positive");
+
+    XMoveResizeWindow(display->inner, window, x, y, width, height);
+    return 0;
+}
+
+int xlib_destroy_window(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    XDestroyWindow(display->inner, window);
+    return 0;
+}
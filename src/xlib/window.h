@@ -0,0 +1,71 @@
+/** Window management.
+ *
+ * Just enough to create and rearrange windows of this client, e.g. to test code that watches the window tree.
+ *
+ * @submodule xlib
+ */
+#ifndef window_h_INCLUDED
+#define window_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+/** Creates an unmapped child window with a black border and background.
+ *
+ * Like all requests without a reply, this is only sent with the next flush. See @{XFlush}.
+ *
+ * @function XCreateSimpleWindow
+ * @tparam Display display
+ * @tparam number parent
+ * @tparam number x Relative to the parent.
+ * @tparam number y Relative to the parent.
+ * @tparam number width
+ * @tparam number height
+ * @tparam[opt=0] number border_width
+ * @treturn number The XID of the new window.
+ */
+int xlib_create_simple_window(lua_State*);
+
+/** Maps a window.
+ *
+ * @function XMapWindow
+ * @tparam Display display
+ * @tparam number window
+ */
+int xlib_map_window(lua_State*);
+
+/** Moves and resizes a window.
+ *
+ * @function XMoveResizeWindow
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number x Relative to the parent.
+ * @tparam number y Relative to the parent.
+ * @tparam number width
+ * @tparam number height
+ */
+int xlib_move_resize_window(lua_State*);
+
+/** Destroys a window and all of its children.
+ *
+ * @function XDestroyWindow
+ * @tparam Display display
+ * @tparam number window
+ */
+int xlib_destroy_window(lua_State*);
+
+
+static const struct luaL_Reg window_lib[] = {
+    {"XCreateSimpleWindow", xlib_create_simple_window},
+    { "XMapWindow",         xlib_map_window          },
+    { "XMoveResizeWindow",  xlib_move_resize_window  },
+    { "XDestroyWindow",     xlib_destroy_window      },
+    { NULL,                 NULL                     }
+};
+
+#endif // window_h_INCLUDED
@@ -0,0 +1,331 @@
+#include "window_property.h"
+
+#include "error.h"
+#include "lua_util.h"
+#include "property.h"
+#include "stats.h"
+#include "xlib.h"
+
+#include <X11/Xatom.h>
+
+
+// Enough for window titles and client lists of most sessions. Longer values take a second round trip.
+#define WINDOW_PROPERTY_INITIAL_LENGTH 1024
+
+// Positions in a cache entry.
+enum {
+    WINDOW_PROPERTY_VALUE = 1,
+    WINDOW_PROPERTY_TYPE,
+};
+
+
+// Pushes the property cache table of the window, or nothing if the window isn't cached. Returns `True` if
+// something was pushed.
+Bool window_property_push_window(lua_State* L, int display_index, Window window) {
+    lua_getuservalue(L, display_index);
+    lua_getfield(L, -1, "properties");
+    lua_remove(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return False;
+    }
+
+    lua_rawgeti(L, -1, (lua_Integer) window);
+    lua_remove(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return False;
+    }
+    return True;
+}
+
+void display_window_event(lua_State* L, int display_index, const XEvent* event) {
+    if (event->type == DestroyNotify) {
+        lua_getuservalue(L, display_index);
+        lua_getfield(L, -1, "properties");
+        if (lua_istable(L, -1)) {
+            lua_pushnil(L);
+            lua_rawseti(L, -2, (lua_Integer) event->xdestroywindow.window);
+        }
+        lua_pop(L, 2);
+        return;
+    }
+
+    if (event->type != PropertyNotify
+        || !window_property_push_window(L, display_index, event->xproperty.window)) {
+        return;
+    }
+
+    // Deleted properties are known to be absent, new values have to be read again.
+    if (event->xproperty.state == PropertyDelete) {
+        lua_pushboolean(L, False);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_rawseti(L, -2, (lua_Integer) event->xproperty.atom);
+    lua_pop(L, 1);
+}
+
+void window_property_invalidate(lua_State* L, int display_index, Window window, Atom property) {
+    if (window_property_push_window(L, display_index, window)) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, (lua_Integer) property);
+        lua_pop(L, 1);
+    }
+}
+
+// Pushes the decoded value of a property, taking ownership of `data`.
+void window_property_push_value(lua_State* L,
+                                int display_index,
+                                unsigned char* data,
+                                unsigned long nitems,
+                                int format,
+                                Atom type) {
+    // Creating the atom, rather than only looking it up, means there is never a `None` result that can't be
+    // cached. It's resolved once per display, and only for 8-bit properties that aren't `STRING`.
+    Bool string = format == 8
+                  && (type == XA_STRING || type == display_intern_atom(L, display_index, "UTF8_STRING", False));
+
+    if (string) {
+        lua_pushlstring(L, (const char*) data, nitems);
+        XFree(data);
+    } else if (type == XA_CARDINAL || type == XA_INTEGER || type == XA_ATOM || type == XA_WINDOW) {
+        property_t prop = { data, 0, nitems, format, type, 0 };
+        lua_createtable(L, (int) nitems, 0);
+        for (unsigned long i = 0; i < nitems; ++i) {
+            property_push_item(L, &prop, i);
+            lua_rawseti(L, -2, (lua_Integer) i + 1);
+        }
+        XFree(data);
+    } else {
+        push_property(L, data, nitems, format, type, 0);
+    }
+}
+
+// Reads the whole property and pushes its decoded value and type. Returns `0` and pushes nothing if there is
+// no such property.
+int window_property_fetch(lua_State* L, int display_index, Window window, Atom property) {
+    display_t* display = lua_touserdata(L, display_index);
+    Atom type = None;
+    int format = 0;
+    unsigned long nitems = 0;
+    unsigned long bytes_after = 0;
+    unsigned char* data = NULL;
+    long length = WINDOW_PROPERTY_INITIAL_LENGTH;
+    int round_trips = 1;
+
+    double start = stats_begin(display->stats);
+    int status = XGetWindowProperty(display->inner,
+                                    window,
+                                    property,
+                                    0,
+                                    length,
+                                    False,
+                                    AnyPropertyType,
+                                    &type,
+                                    &format,
+                                    &nitems,
+                                    &bytes_after,
+                                    &data);
+    if (status == Success && type != None && bytes_after > 0) {
+        // Read it again, all at once. Reading just the remainder could mix two different values.
+        XFree(data);
+        data = NULL;
+        length += (long) ((bytes_after + 3) / 4);
+        status = XGetWindowProperty(display->inner,
+                                    window,
+                                    property,
+                                    0,
+                                    length,
+                                    False,
+                                    AnyPropertyType,
+                                    &type,
+                                    &format,
+                                    &nitems,
+                                    &bytes_after,
+                                    &data);
+        round_trips++;
+    }
+    stats_record(L, display->stats, "get_property", round_trips, start);
+
+    if (status != Success || type == None) {
+        if (data) {
+            XFree(data);
+        }
+        return 0;
+    }
+
+    window_property_push_value(L, display_index, data, nitems, format, type);
+    lua_pushinteger(L, (lua_Integer) type);
+    return 2;
+}
+
+// Pushes the property cache table of the window, and makes sure this client receives `PropertyNotify` and
+// `DestroyNotify` events for it. Returns `False` and pushes nothing if the window doesn't exist.
+Bool window_property_watch(lua_State* L, int display_index, Window window) {
+    if (window_property_push_window(L, display_index, window)) {
+        return True;
+    }
+
+    display_t* display = lua_touserdata(L, display_index);
+    XWindowAttributes attributes;
+    unsigned long first = NextRequest(display->inner);
+    double start = stats_begin(display->stats);
+    Status status = XGetWindowAttributes(display->inner, window, &attributes);
+    stats_record(L, display->stats, "XGetWindowAttributes", 1, start);
+    if (!status) {
+        // The `BadWindow` is expected here, and is handled by falling back to an uncached read.
+        XErrorEvent error;
+        while (display_take_error(display, first, NextRequest(display->inner) - 1, &error)) {
+        }
+        return False;
+    }
+
+    // Sent before any property is read, so that no change can be missed. `DestroyNotify` drops the entry, before
+    // the server can reuse the XID for a new window.
+    XSelectInput(display->inner,
+                 window,
+                 attributes.your_event_mask | PropertyChangeMask | StructureNotifyMask);
+
+    display_push_cache(L, display_index, "properties");
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, (lua_Integer) window);
+    lua_remove(L, -2);
+    return True;
+}
+
+int xlib_get_window_property(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    Atom property = (Atom) luaL_checkinteger(L, 3);
+    long offset = (long) luaL_checkinteger(L, 4);
+    long length = (long) luaL_checkinteger(L, 5);
+    Bool delete = (Bool) lua_toboolean(L, 6);
+    Atom req_type = (Atom) luaL_optinteger(L, 7, AnyPropertyType);
+
+    Atom actual_type = None;
+    int actual_format = 0;
+    unsigned long nitems = 0;
+    unsigned long bytes_after = 0;
+    unsigned char* prop = NULL;
+
+    double start = stats_begin(display->stats);
+    int status = XGetWindowProperty(display->inner,
+                                    window,
+                                    property,
+                                    offset,
+                                    length,
+                                    delete,
+                                    req_type,
+                                    &actual_type,
+                                    &actual_format,
+                                    &nitems,
+                                    &bytes_after,
+                                    &prop);
+    stats_record(L, display->stats, "XGetWindowProperty", 1, start);
+
+    if (delete) {
+        window_property_invalidate(L, 1, window, property);
+    }
+
+    // `type == None` is returned when the property doesn't exist.
+    if (status != Success || actual_type == None) {
+        if (prop) {
+            XFree(prop);
+        }
+        return 0;
+    }
+
+    push_property(L, prop, nitems, actual_format, actual_type, bytes_after);
+    return 1;
+}
+
+int xlib_change_property(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    Atom property = (Atom) luaL_checkinteger(L, 3);
+    int mode = (int) luaL_optinteger(L, 4, PropModeReplace);
+    Atom type = (Atom) luaL_optinteger(L, 5, property_default_type(L, 6));
+    int format = (int) luaL_optinteger(L, 7, lua_type(L, 6) == LUA_TTABLE ? 32 : 8);
+    luaL_argcheck(L, format == 8 || format == 16 || format == 32, 7, "format must be one of 8, 16 or 32");
+
+    int nelements = 0;
+    const unsigned char* data = property_check_data(L, 6, &format, &nelements);
+
+    XChangeProperty(display->inner, window, property, type, format, mode, data, nelements);
+    // The `PropertyNotify` event would do the same, but only once it has been taken off the queue.
+    window_property_invalidate(L, 1, window, property);
+    return 0;
+}
+
+int xlib_delete_property(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    Atom property = (Atom) luaL_checkinteger(L, 3);
+
+    XDeleteProperty(display->inner, window, property);
+    window_property_invalidate(L, 1, window, property);
+    return 0;
+}
+
+int xlib_get_property(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+    Atom property = (Atom) luaL_checkinteger(L, 3);
+    Bool cached = lua_toboolean(L, 4);
+    lua_settop(L, 3);
+
+    if (!cached) {
+        return window_property_fetch(L, 1, window, property);
+    }
+    // Reading a window that doesn't exist would only fail again, with another error.
+    if (!window_property_watch(L, 1, window)) {
+        return 0;
+    }
+    int entries = lua_gettop(L);
+
+    lua_rawgeti(L, entries, (lua_Integer) property);
+    if (lua_istable(L, -1)) {
+        lua_rawgeti(L, -1, WINDOW_PROPERTY_VALUE);
+        lua_rawgeti(L, -2, WINDOW_PROPERTY_TYPE);
+        return 2;
+    } else if (lua_isboolean(L, -1)) {
+        return 0;
+    }
+    lua_pop(L, 1);
+
+    int n = window_property_fetch(L, 1, window, property);
+    if (n == 0) {
+        lua_pushboolean(L, False);
+        lua_rawseti(L, entries, (lua_Integer) property);
+        return 0;
+    }
+
+    lua_createtable(L, 2, 0);
+    lua_pushvalue(L, -3);
+    lua_rawseti(L, -2, WINDOW_PROPERTY_VALUE);
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, WINDOW_PROPERTY_TYPE);
+    lua_rawseti(L, entries, (lua_Integer) property);
+    return 2;
+}
+
+int xlib_clear_property_cache(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+
+    lua_getuservalue(L, 1);
+    if (lua_isnoneornil(L, 2)) {
+        lua_pushnil(L);
+        lua_setfield(L, -2, "properties");
+        return 0;
+    }
+
+    Window window = (Window) luaL_checkinteger(L, 2);
+    lua_getfield(L, -1, "properties");
+    if (lua_istable(L, -1)) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, (lua_Integer) window);
+    }
+    return 0;
+}
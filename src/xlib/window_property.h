@@ -0,0 +1,124 @@
+/** Window properties.
+ *
+ * Besides the raw @{XGetWindowProperty}, @{get_property} reads a whole property and decodes the common types
+ * into plain Lua values. With `cached` set, values are kept in a per-connection cache, which is kept current from
+ * `PropertyNotify` events as they are taken off the queue. Repeated reads of a property then cost no round trip,
+ * until it changes.
+ *
+ * @submodule xlib
+ */
+#ifndef window_property_h_INCLUDED
+#define window_property_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+// Updates the property cache of the display at `display_index` for a `PropertyNotify` or `DestroyNotify` event.
+void display_window_event(lua_State*, int, const XEvent*);
+
+
+/** Returns the value of a window property.
+ *
+ * If there is no such property, the function will return nothing.
+ *
+ * `offset` and `length` are given in 32-bit units, regardless of the property's format.
+ * If `req_type` doesn't match the property's actual type, the result is empty, but still reports
+ * the actual type and format.
+ *
+ * @function XGetWindowProperty
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number property An X11 `Atom`.
+ * @tparam number offset The offset at which to start reading the return value, in 32-bit units.
+ * @tparam number length The amount of data to read, in 32-bit units.
+ * @tparam boolean delete If `true`, delete the property after reading.
+ * @tparam[opt] number req_type An X11 `Atom`. Defaults to `AnyPropertyType` (`0`).
+ * @treturn[opt] XProperty
+ */
+int xlib_get_window_property(lua_State*);
+
+/** Changes the value of a window property.
+ *
+ * The data may be a string of bytes for format `8`, a list of integers for any format,
+ * or an @{XProperty} buffer. Buffers bring their own format.
+ *
+ * @function XChangeProperty
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number property An X11 `Atom`.
+ * @tparam number|nil mode If `1`, prepend data. If `2`, append data. Otherwise replace data.
+ * @tparam[opt] number type An X11 `Atom`, e.g. `CARDINAL`, `ATOM` or `WINDOW`. Defaults to `CARDINAL` for
+ *   tables, the buffer's own type for @{XProperty} and `STRING` otherwise.
+ * @tparam string|table|XProperty data
+ * @tparam[opt] number format One of `8`, `16` or `32`. Defaults to `32` for tables and `8` otherwise.
+ * @usage
+ * local utf8 = xlib.XInternAtom(display, "UTF8_STRING")
+ * xlib.XChangeProperty(display, window, xlib.XInternAtom(display, "_NET_WM_NAME"), 0, utf8, "Terminal")
+ */
+int xlib_change_property(lua_State*);
+
+/** Deletes a window property.
+ *
+ * @function XDeleteProperty
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number property An X11 `Atom`.
+ */
+int xlib_delete_property(lua_State*);
+
+/** Reads a whole window property and decodes its value.
+ *
+ * - `STRING` and `UTF8_STRING` of format `8` are returned as strings. Lists of strings, e.g. `WM_CLASS`, keep
+ *   their NUL separators.
+ * - `CARDINAL`, `INTEGER`, `ATOM` and `WINDOW` are returned as lists of integers, even if they only hold a single
+ *   value, like `_NET_ACTIVE_WINDOW`.
+ * - Everything else is returned as @{XProperty}.
+ *
+ * When `cached` is set, the first read of any property of a window adds `PropertyChangeMask` and
+ * `StructureNotifyMask` to this client's event mask for that window, so `PropertyNotify` and `DestroyNotify`
+ * events for it will show up in the queue. The cached value is dropped when such an event is taken off the queue
+ * with @{XNextEvent} or @{drain_events}, and read again on the next call. Properties that don't exist are cached
+ * as well. Values returned from the cache are shared, and must not be modified.
+ *
+ * @function get_property
+ * @tparam Display display
+ * @tparam number window
+ * @tparam number property An X11 `Atom`.
+ * @tparam[opt=false] boolean cached
+ * @treturn[1] string|table|XProperty The value.
+ * @treturn[1] number The type of the property, as X11 `Atom`.
+ * @treturn[2] nil If the property or the window doesn't exist.
+ * @usage
+ * local clients = xlib.get_property(display, root, xlib.XInternAtom(display, "_NET_CLIENT_LIST"), true) or {}
+ * for _, client in ipairs(clients) do
+ *     print(xlib.get_property(display, client, net_wm_name, true))
+ * end
+ */
+int xlib_get_property(lua_State*);
+
+/** Drops cached property values.
+ *
+ * Destroyed windows are dropped on their own, once their `DestroyNotify` event has been taken off the queue.
+ *
+ * @function clear_property_cache
+ * @tparam Display display
+ * @tparam[opt] number window Only drop the values of this window. Defaults to all windows.
+ */
+int xlib_clear_property_cache(lua_State*);
+
+
+static const struct luaL_Reg window_property_lib[] = {
+    {"XGetWindowProperty",    xlib_get_window_property },
+    { "XChangeProperty",      xlib_change_property     },
+    { "XDeleteProperty",      xlib_delete_property     },
+    { "get_property",         xlib_get_property        },
+    { "clear_property_cache", xlib_clear_property_cache},
+    { NULL,                   NULL                     }
+};
+
+#endif // window_property_h_INCLUDED
@@ -0,0 +1,321 @@
+#include "window_tree.h"
+
+#include "lua_util.h"
+#include "stats.h"
+#include "xlib.h"
+
+#include <X11/Xlib-xcb.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Indexed by `map_state`, which is one of `IsUnmapped`, `IsUnviewable` or `IsViewable`.
+static const char* const map_states[] = { "unmapped", "unviewable", "viewable" };
+
+// A window found during the walk, along with the requests that are in flight for it.
+typedef struct {
+    xcb_window_t window;
+    xcb_window_t parent;
+    xcb_query_tree_cookie_t tree;
+    xcb_get_window_attributes_cookie_t attributes;
+    xcb_get_geometry_cookie_t geometry;
+    // `False` once a request failed, usually because the window was destroyed in the meantime.
+    Bool valid;
+    int x;
+    int y;
+    int width;
+    int height;
+    int border_width;
+    unsigned char map_state;
+    unsigned char override_redirect;
+} window_tree_node_t;
+
+
+window_tree_t* window_tree_new(lua_State* L, Window root, int count) {
+    size_t size = sizeof(window_tree_t) + 2 * count * sizeof(Window) + 5 * count * sizeof(int) + 2 * count;
+    window_tree_t* tree = luaU_newuserdata(L, size, LUA_XLIB_WINDOW_TREE);
+    tree->root = root;
+    tree->count = count;
+    tree->ids = (Window*) (tree + 1);
+    tree->parents = tree->ids + count;
+    tree->x = (int*) (tree->parents + count);
+    tree->y = tree->x + count;
+    tree->width = tree->y + count;
+    tree->height = tree->width + count;
+    tree->border_width = tree->height + count;
+    tree->map_state = (unsigned char*) (tree->border_width + count);
+    tree->override_redirect = tree->map_state + count;
+    return tree;
+}
+
+void window_tree_push_ints(lua_State* L, const int* list, int n) {
+    lua_createtable(L, n, 0);
+    for (int i = 0; i < n; ++i) {
+        lua_pushinteger(L, list[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+void window_tree_push_windows(lua_State* L, const Window* list, int n) {
+    lua_createtable(L, n, 0);
+    for (int i = 0; i < n; ++i) {
+        lua_pushinteger(L, (lua_Integer) list[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+int window_tree__index(lua_State* L) {
+    window_tree_t* tree = luaL_checkudata(L, 1, LUA_XLIB_WINDOW_TREE);
+    int field = luaU_checkfield(L, 2);
+
+    switch (field) {
+    case WINDOW_TREE_ROOT:
+        lua_pushinteger(L, (lua_Integer) tree->root);
+        return 1;
+    case WINDOW_TREE_COUNT:
+        lua_pushinteger(L, tree->count);
+        return 1;
+    case 0:
+        lua_pushnil(L);
+        return 1;
+    }
+
+    if (luaU_pushcached(L, 1, 2)) {
+        return 1;
+    }
+
+    switch (field) {
+    case WINDOW_TREE_IDS:
+        window_tree_push_windows(L, tree->ids, tree->count);
+        break;
+    case WINDOW_TREE_PARENTS:
+        window_tree_push_windows(L, tree->parents, tree->count);
+        break;
+    case WINDOW_TREE_X:
+        window_tree_push_ints(L, tree->x, tree->count);
+        break;
+    case WINDOW_TREE_Y:
+        window_tree_push_ints(L, tree->y, tree->count);
+        break;
+    case WINDOW_TREE_WIDTH:
+        window_tree_push_ints(L, tree->width, tree->count);
+        break;
+    case WINDOW_TREE_HEIGHT:
+        window_tree_push_ints(L, tree->height, tree->count);
+        break;
+    case WINDOW_TREE_BORDER_WIDTH:
+        window_tree_push_ints(L, tree->border_width, tree->count);
+        break;
+    case WINDOW_TREE_MAP_STATE:
+        lua_createtable(L, tree->count, 0);
+        for (int i = 0; i < tree->count; ++i) {
+            lua_pushstring(L, map_states[tree->map_state[i]]);
+            lua_rawseti(L, -2, i + 1);
+        }
+        break;
+    case WINDOW_TREE_OVERRIDE_REDIRECT:
+        lua_createtable(L, tree->count, 0);
+        for (int i = 0; i < tree->count; ++i) {
+            lua_pushboolean(L, tree->override_redirect[i]);
+            lua_rawseti(L, -2, i + 1);
+        }
+        break;
+    }
+
+    luaU_cache(L, 1, 2);
+    return 1;
+}
+
+// Collects the replies for one node and appends its children to the list. Returns `False` if the list
+// couldn't grow. The replies are still taken off the connection in that case.
+Bool window_tree_collect(xcb_connection_t* conn, window_tree_node_t** nodes, int* count, int* capacity, int i) {
+    window_tree_node_t* node = &(*nodes)[i];
+    xcb_generic_error_t* error = NULL;
+    Bool ok = True;
+
+    xcb_get_window_attributes_reply_t* attributes =
+        xcb_get_window_attributes_reply(conn, node->attributes, &error);
+    free(error);
+    xcb_get_geometry_reply_t* geometry = xcb_get_geometry_reply(conn, node->geometry, &error);
+    free(error);
+    xcb_query_tree_reply_t* tree = xcb_query_tree_reply(conn, node->tree, &error);
+    free(error);
+
+    node->valid = attributes != NULL && geometry != NULL && tree != NULL;
+    if (node->valid) {
+        node->x = geometry->x;
+        node->y = geometry->y;
+        node->width = geometry->width;
+        node->height = geometry->height;
+        node->border_width = geometry->border_width;
+        node->map_state = attributes->map_state <= XCB_MAP_STATE_VIEWABLE ? attributes->map_state : 0;
+        node->override_redirect = attributes->override_redirect;
+
+        xcb_window_t window = node->window;
+        int nchildren = xcb_query_tree_children_length(tree);
+        xcb_window_t* children = xcb_query_tree_children(tree);
+        if (*count + nchildren > *capacity) {
+            int grown = *capacity * 2 > *count + nchildren ? *capacity * 2 : *count + nchildren;
+            window_tree_node_t* resized = realloc(*nodes, grown * sizeof(window_tree_node_t));
+            if (resized) {
+                *nodes = resized;
+                *capacity = grown;
+            } else {
+                ok = False;
+                nchildren = 0;
+            }
+        }
+
+        for (int j = 0; j < nchildren; ++j) {
+            window_tree_node_t* child = &(*nodes)[(*count)++];
+            child->window = children[j];
+            child->parent = window;
+        }
+    }
+
+    free(attributes);
+    free(geometry);
+    free(tree);
+    return ok;
+}
+
+int xlib_window_tree(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    xcb_window_t root = (xcb_window_t) luaL_checkinteger(L, 2);
+    xcb_connection_t* conn = XGetXCBConnection(display->inner);
+    double start = stats_begin(display->stats);
+
+    int capacity = 64;
+    window_tree_node_t* nodes = malloc(capacity * sizeof(window_tree_node_t));
+    if (!nodes) {
+        return luaL_error(L, "failed to allocate window tree");
+    }
+    nodes[0].window = root;
+    nodes[0].parent = XCB_WINDOW_NONE;
+
+    int count = 1;
+    int levels = 0;
+    int nvalid = 0;
+    Bool ok = True;
+    unsigned int sequence = 0;
+
+    // The children of a level are only known once its `QueryTree` replies are in, so every level takes one round
+    // trip. All requests for a level are sent before waiting for the first reply.
+    for (int begin = 0, end = 1; begin < end && ok; begin = end, end = count) {
+        for (int i = begin; i < end; ++i) {
+            nodes[i].tree = xcb_query_tree(conn, nodes[i].window);
+            nodes[i].attributes = xcb_get_window_attributes(conn, nodes[i].window);
+            nodes[i].geometry = xcb_get_geometry(conn, nodes[i].window);
+        }
+        sequence = nodes[end - 1].geometry.sequence;
+
+        // Keep collecting after a failed allocation, so that no reply is left queued in XCB.
+        for (int i = begin; i < end; ++i) {
+            ok = window_tree_collect(conn, &nodes, &count, &capacity, i) && ok;
+            nvalid += nodes[i].valid;
+        }
+        ++levels;
+    }
+
+    stats_sequence(display->stats, sequence);
+    stats_record(L, display->stats, "window_tree", levels, start);
+
+    if (!ok) {
+        free(nodes);
+        return luaL_error(L, "failed to allocate window tree");
+    }
+
+    window_tree_t* tree = window_tree_new(L, root, nvalid);
+    for (int i = 0, j = 0; i < count; ++i) {
+        const window_tree_node_t* node = &nodes[i];
+        if (!node->valid) {
+            continue;
+        }
+
+        tree->ids[j] = node->window;
+        tree->parents[j] = node->parent;
+        tree->x[j] = node->x;
+        tree->y[j] = node->y;
+        tree->width[j] = node->width;
+        tree->height[j] = node->height;
+        tree->border_width[j] = node->border_width;
+        tree->map_state[j] = node->map_state;
+        tree->override_redirect[j] = node->override_redirect;
+        ++j;
+    }
+    free(nodes);
+
+    return 1;
+}
+
+Bool window_tree_equal(const window_tree_t* a, int i, const window_tree_t* b, int j) {
+    return a->parents[i] == b->parents[j] && a->x[i] == b->x[j] && a->y[i] == b->y[j] && a->width[i] == b->width[j]
+           && a->height[i] == b->height[j] && a->border_width[i] == b->border_width[j]
+           && a->map_state[i] == b->map_state[j] && a->override_redirect[i] == b->override_redirect[j];
+}
+
+// Appends `xid` to the list in field `name` of the table at `index`, creating the list if necessary.
+void window_tree_diff_append(lua_State* L, int index, const char* name, Window xid) {
+    lua_getfield(L, index, name);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, index, name);
+    }
+
+    lua_pushinteger(L, (lua_Integer) xid);
+    lua_rawseti(L, -2, (lua_Integer) lua_rawlen(L, -2) + 1);
+    lua_pop(L, 1);
+}
+
+int xlib_window_tree_diff(lua_State* L) {
+    window_tree_t* prev = luaL_checkudata(L, 1, LUA_XLIB_WINDOW_TREE);
+    window_tree_t* curr = luaL_checkudata(L, 2, LUA_XLIB_WINDOW_TREE);
+
+    // Maps the XIDs of the old tree to their positions.
+    lua_createtable(L, 0, prev->count);
+    int positions = lua_gettop(L);
+    for (int i = 0; i < prev->count; ++i) {
+        lua_pushinteger(L, i);
+        lua_rawseti(L, positions, (lua_Integer) prev->ids[i]);
+    }
+
+    // Whether each window of the old tree is still in the new one.
+    unsigned char* seen = lua_newuserdata(L, prev->count > 0 ? prev->count : 1);
+    memset(seen, 0, prev->count);
+
+    lua_newtable(L);
+    int result = lua_gettop(L);
+    int changes = 0;
+
+    for (int j = 0; j < curr->count; ++j) {
+        lua_rawgeti(L, positions, (lua_Integer) curr->ids[j]);
+        int i = lua_isnil(L, -1) ? -1 : (int) lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        if (i < 0) {
+            window_tree_diff_append(L, result, "added", curr->ids[j]);
+            ++changes;
+            continue;
+        }
+
+        seen[i] = 1;
+        if (!window_tree_equal(prev, i, curr, j)) {
+            window_tree_diff_append(L, result, "changed", curr->ids[j]);
+            ++changes;
+        }
+    }
+
+    for (int i = 0; i < prev->count; ++i) {
+        if (!seen[i]) {
+            window_tree_diff_append(L, result, "removed", prev->ids[i]);
+            ++changes;
+        }
+    }
+
+    if (changes == 0) {
+        return 0;
+    }
+    return 1;
+}
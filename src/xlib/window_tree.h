@@ -0,0 +1,129 @@
+/** Window tree snapshots.
+ *
+ * @{window_tree} walks the tree below a window one level at a time. For every window in a level, the
+ * `QueryTree`, `GetWindowAttributes` and `GetGeometry` requests are sent together, so the whole walk takes one
+ * round trip per level of the tree instead of three per window.
+ *
+ * @submodule xlib
+ */
+#ifndef window_tree_h_INCLUDED
+#define window_tree_h_INCLUDED
+
+#include "lua_util.h"
+#include "xlib.h"
+
+#include <X11/Xlib.h>
+#include <lauxlib.h>
+#include <lua.h>
+
+
+#define LUA_XLIB_WINDOW_TREE "xlib.window_tree"
+
+
+/**
+ * The windows below a root at a single point in time, in breadth-first order, starting with the root itself.
+ *
+ * Every field but `root` and `count` is a list with one entry per window, so `ids[i]`, `parents[i]` and `x[i]`
+ * all describe the same window. Windows that were destroyed during the walk are left out.
+ *
+ * @table XWindowTree
+ * @field[type=number] root The XID of the window the walk started at.
+ * @field[type=number] count The number of windows.
+ * @field[type=table<number>] ids
+ * @field[type=table<number>] parents The parent of each window. `0` for the root.
+ * @field[type=table<number>] x Relative to the parent.
+ * @field[type=table<number>] y Relative to the parent.
+ * @field[type=table<number>] width
+ * @field[type=table<number>] height
+ * @field[type=table<number>] border_width
+ * @field[type=table<string>] map_state One of `unmapped`, `unviewable` or `viewable`.
+ * @field[type=table<boolean>] override_redirect
+ */
+typedef struct {
+    Window root;
+    int count;
+    // All lists point into the same block of memory as the struct.
+    Window* ids;
+    Window* parents;
+    int* x;
+    int* y;
+    int* width;
+    int* height;
+    int* border_width;
+    unsigned char* map_state;
+    unsigned char* override_redirect;
+} window_tree_t;
+
+enum {
+    WINDOW_TREE_ROOT = 1,
+    WINDOW_TREE_COUNT,
+    WINDOW_TREE_IDS,
+    WINDOW_TREE_PARENTS,
+    WINDOW_TREE_X,
+    WINDOW_TREE_Y,
+    WINDOW_TREE_WIDTH,
+    WINDOW_TREE_HEIGHT,
+    WINDOW_TREE_BORDER_WIDTH,
+    WINDOW_TREE_MAP_STATE,
+    WINDOW_TREE_OVERRIDE_REDIRECT,
+};
+
+static const char* const window_tree_fields[] = {
+    "root",   "count",        "ids",       "parents",           "x", "y", "width",
+    "height", "border_width", "map_state", "override_redirect", NULL,
+};
+
+int window_tree__index(lua_State*);
+
+/** Takes a snapshot of the window tree.
+ *
+ * @function window_tree
+ * @tparam Display display
+ * @tparam number root The XID of the window to start at, usually the root window.
+ * @treturn XWindowTree
+ * @usage
+ * local tree = xlib.window_tree(display, root)
+ * for i = 1, tree.count do
+ *     if tree.map_state[i] == "viewable" and not tree.override_redirect[i] then
+ *         print(tree.ids[i], tree.width[i], tree.height[i])
+ *     end
+ * end
+ */
+int xlib_window_tree(lua_State*);
+
+/**
+ * The changes between two window trees. Fields are only present when there was a change of that kind.
+ *
+ * @table XWindowTreeDiff
+ * @field[type=table<number>] added XIDs of windows that are only in the new tree.
+ * @field[type=table<number>] removed XIDs of windows that are only in the old tree.
+ * @field[type=table<number>] changed XIDs of windows whose parent, geometry, map state or override-redirect flag
+ *   changed.
+ */
+
+/** Compares two window trees.
+ *
+ * Changes to the stacking order of siblings are not reported.
+ *
+ * @function window_tree_diff
+ * @tparam XWindowTree old
+ * @tparam XWindowTree new
+ * @treturn[opt] XWindowTreeDiff `nil` if nothing changed.
+ * @usage
+ * local current = xlib.window_tree(display, root)
+ * local changes = xlib.window_tree_diff(previous, current)
+ * if changes and changes.added then
+ *     refresh_switcher(current)
+ * end
+ * previous = current
+ */
+int xlib_window_tree_diff(lua_State*);
+
+
+static const struct luaL_Reg window_tree_lib[] = {
+    {"window_tree",       xlib_window_tree     },
+    { "window_tree_diff", xlib_window_tree_diff},
+    { NULL,               NULL                 }
+};
+
+#endif // window_tree_h_INCLUDED
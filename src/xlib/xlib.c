@@ -1,9 +1,158 @@
 #include "xlib.h"
 
+#include "async.h"
+#include "capture.h"
+#include "error.h"
+#include "event.h"
 #include "lua_util.h"
-
+#include "property.h"
+#include "stats.h"
+#include "trace.h"
+#include "window.h"
+#include "window_property.h"
+#include "window_tree.h"
+
+#include <X11/Xatom.h>
 #include <stdlib.h>
+#include <string.h>
+
+
+// Names of the predefined atoms, as listed in `X11/Xatom.h`. Index `i` holds the name of atom `i + 1`.
+static const char* const predefined_atoms[XA_LAST_PREDEFINED] = {
+    "PRIMARY",
+    "SECONDARY",
+    "ARC",
+    "ATOM",
+    "BITMAP",
+    "CARDINAL",
+    "COLORMAP",
+    "CURSOR",
+    "CUT_BUFFER0",
+    "CUT_BUFFER1",
+    "CUT_BUFFER2",
+    "CUT_BUFFER3",
+    "CUT_BUFFER4",
+    "CUT_BUFFER5",
+    "CUT_BUFFER6",
+    "CUT_BUFFER7",
+    "DRAWABLE",
+    "FONT",
+    "INTEGER",
+    "PIXMAP",
+    "POINT",
+    "RECTANGLE",
+    "RESOURCE_MANAGER",
+    "RGB_COLOR_MAP",
+    "RGB_BEST_MAP",
+    "RGB_BLUE_MAP",
+    "RGB_DEFAULT_MAP",
+    "RGB_GRAY_MAP",
+    "RGB_GREEN_MAP",
+    "RGB_RED_MAP",
+    "STRING",
+    "VISUALID",
+    "WINDOW",
+    "WM_COMMAND",
+    "WM_HINTS",
+    "WM_CLIENT_MACHINE",
+    "WM_ICON_NAME",
+    "WM_ICON_SIZE",
+    "WM_NAME",
+    "WM_NORMAL_HINTS",
+    "WM_SIZE_HINTS",
+    "WM_ZOOM_HINTS",
+    "MIN_SPACE",
+    "NORM_SPACE",
+    "MAX_SPACE",
+    "END_SPACE",
+    "SUPERSCRIPT_X",
+    "SUPERSCRIPT_Y",
+    "SUBSCRIPT_X",
+    "SUBSCRIPT_Y",
+    "UNDERLINE_POSITION",
+    "UNDERLINE_THICKNESS",
+    "STRIKEOUT_ASCENT",
+    "STRIKEOUT_DESCENT",
+    "ITALIC_ANGLE",
+    "X_HEIGHT",
+    "QUAD_WIDTH",
+    "WEIGHT",
+    "POINT_SIZE",
+    "RESOLUTION",
+    "COPYRIGHT",
+    "NOTICE",
+    "FONT_NAME",
+    "FAMILY_NAME",
+    "FULL_NAME",
+    "CAP_HEIGHT",
+    "WM_CLASS",
+    "WM_TRANSIENT_FOR",
+};
+
+
+void display_push_cache(lua_State* L, int index, const char* name) {
+    lua_getuservalue(L, index);
+    lua_getfield(L, -1, name);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, name);
+    }
+    lua_remove(L, -2);
+}
+
+// Atoms are numbers and names are strings, so both directions can share a single table.
+void atom_cache_insert(lua_State* L, Atom atom, const char* name) {
+    lua_pushstring(L, name);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, (lua_Integer) atom);
+    lua_pushinteger(L, (lua_Integer) atom);
+    lua_rawset(L, -3);
+}
+
+Atom display_intern_atom(lua_State* L, int index, const char* name, Bool only_if_exists) {
+    display_t* display = luaL_checkudata(L, index, LUA_XLIB_DISPLAY);
+
+    display_push_cache(L, index, "atoms");
+    lua_getfield(L, -1, name);
+    if (lua_type(L, -1) == LUA_TNUMBER) {
+        Atom atom = (Atom) lua_tointeger(L, -1);
+        lua_pop(L, 2);
+        display->atom_hits++;
+        return atom;
+    }
+    lua_pop(L, 1);
+
+    display->atom_misses++;
+    double start = stats_begin(display->stats);
+    Atom atom = XInternAtom(display->inner, name, only_if_exists);
+    stats_record(L, display->stats, "XInternAtom", 1, start);
+    // With `only_if_exists`, the atom may still be created later, so a `None` result must not be cached.
+    if (atom != None) {
+        atom_cache_insert(L, atom, name);
+    }
+    lua_pop(L, 1);
 
+    return atom;
+}
+
+void display_add_event_extension(display_t* display, int base, int count, const event_extension_t* ext) {
+    for (int i = 0; i < display->nevent_extensions; ++i) {
+        if (display->event_extensions[i].ext == ext) {
+            return;
+        }
+    }
+
+    if (display->nevent_extensions == DISPLAY_MAX_EVENT_EXTENSIONS) {
+        return;
+    }
+
+    int i = display->nevent_extensions++;
+    display->event_extensions[i].base = base;
+    display->event_extensions[i].count = count;
+    display->event_extensions[i].ext = ext;
+}
 
 int display__gc(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
@@ -11,7 +160,11 @@ int display__gc(lua_State* L) {
     // So rather than failing, like `xlib_close_display`, we just silently ignore closed connections.
     if (!display->closed) {
         XCloseDisplay(display->inner);
+        // Captures that are collected in the same cycle must not touch the connection anymore.
+        display->closed = True;
     }
+    display_unregister_errors(display);
+    stats_free(&display->stats);
     return 0;
 }
 
@@ -28,6 +181,24 @@ int xlib_open_display(lua_State* L) {
 
     d->inner = display;
     d->closed = False;
+    d->atom_hits = 0;
+    d->atom_misses = 0;
+    d->stats = NULL;
+    d->nevent_extensions = 0;
+
+    error_handler_install();
+    display_register_errors(d);
+
+    // The user value holds the per-connection caches.
+    lua_createtable(L, 0, 1);
+
+    lua_createtable(L, (int) XA_LAST_PREDEFINED, (int) XA_LAST_PREDEFINED);
+    for (Atom atom = 1; atom <= XA_LAST_PREDEFINED; ++atom) {
+        atom_cache_insert(L, atom, predefined_atoms[atom - 1]);
+    }
+    lua_setfield(L, -2, "atoms");
+
+    lua_setuservalue(L, -2);
 
     return 1;
 }
@@ -38,6 +209,8 @@ int xlib_close_display(lua_State* L) {
         return luaL_error(L, "this display connection has already been closed");
     }
     XCloseDisplay(display->inner);
+    display_unregister_errors(display);
+    display->closed = True;
     return 0;
 }
 
@@ -80,6 +253,18 @@ int xlib_display_width(lua_State* L) {
     return 1;
 }
 
+int xlib_connection_number(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    lua_pushinteger(L, ConnectionNumber(display->inner));
+    return 1;
+}
+
+int xlib_flush(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    XFlush(display->inner);
+    return 0;
+}
+
 int xlib_lock_display(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     XLockDisplay(display->inner);
@@ -93,42 +278,74 @@ int xlib_unlock_display(lua_State* L) {
 }
 
 int xlib_intern_atom(lua_State* L) {
-    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     const char* name = luaL_checkstring(L, 2);
     Bool only_if_exists = lua_toboolean(L, 3);
 
-    lua_pushinteger(L, XInternAtom(display->inner, name, only_if_exists));
+    lua_pushinteger(L, display_intern_atom(L, 1, name, only_if_exists));
     return 1;
 }
 
 int xlib_intern_atoms(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
-    Bool only_if_exists = lua_toboolean(L, 3);
     luaL_checktype(L, 2, LUA_TTABLE);
+    Bool only_if_exists = lua_toboolean(L, 3);
+    int count = (int) lua_rawlen(L, 2);
+    lua_settop(L, 3);
+
+    // Scratch space for the names that aren't cached yet, in a single block. As a userdatum, it is collected
+    // even if a Lua error is raised below. The names themselves stay alive in the argument table.
+    char** names = lua_newuserdata(L, (size_t) count * (sizeof(char*) + sizeof(Atom) + sizeof(int)));
+    Atom* atoms = (Atom*) (names + count);
+    int* positions = (int*) (atoms + count);
+
+    display_push_cache(L, 1, "atoms");
+    int cache = lua_gettop(L);
+    lua_createtable(L, count, 0);
+    int result = lua_gettop(L);
+
+    int nmissing = 0;
+    for (int i = 1; i <= count; ++i) {
+        lua_rawgeti(L, 2, i);
+        if (lua_type(L, -1) != LUA_TSTRING) {
+            return luaL_error(L, "at index %d: expected string, got %s", i, luaL_typename(L, -1));
+        }
 
-    int count = lua_rawlen(L, 2);
-    char** names = calloc(count, sizeof(char*));
-
-    for (int i = 0; i < count; ++i) {
-        lua_pushinteger(L, i + 1);
-        lua_gettable(L, 2);
-        names[i] = (char*) lua_tostring(L, -1);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, cache);
+        if (lua_type(L, -1) == LUA_TNUMBER) {
+            display->atom_hits++;
+            lua_rawseti(L, result, i);
+        } else {
+            display->atom_misses++;
+            names[nmissing] = (char*) lua_tostring(L, -2);
+            positions[nmissing] = i;
+            nmissing++;
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
     }
 
-    Atom* atoms = calloc(count, sizeof(Atom));
-    Status status = XInternAtoms(display->inner, names, count, only_if_exists, atoms);
-    lua_pushinteger(L, status);
-
-    lua_createtable(L, 0, count);
-
-    for (int i = 0; i < count; ++i) {
-        lua_pushinteger(L, atoms[i]);
-        lua_rawseti(L, -2, i + 1);
+    // Like Xlib, report success if every name has an atom.
+    Status status = 1;
+    if (nmissing > 0) {
+        double start = stats_begin(display->stats);
+        status = XInternAtoms(display->inner, names, nmissing, only_if_exists, atoms);
+        stats_record(L, display->stats, "XInternAtoms", 1, start);
+
+        lua_pushvalue(L, cache);
+        for (int j = 0; j < nmissing; ++j) {
+            // With `only_if_exists`, the atom may still be created later, so a `None` result must not be cached.
+            if (atoms[j] != None) {
+                atom_cache_insert(L, atoms[j], names[j]);
+            }
+            lua_pushinteger(L, (lua_Integer) atoms[j]);
+            lua_rawseti(L, result, positions[j]);
+        }
+        lua_pop(L, 1);
     }
 
-    free(names);
-    free(atoms);
-
+    lua_pushinteger(L, status);
+    lua_pushvalue(L, result);
     return 2;
 }
 
@@ -136,22 +353,48 @@ int xlib_get_atom_name(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     Atom atom = (Atom) luaL_checkinteger(L, 2);
 
+    display_push_cache(L, 1, "atoms");
+    lua_rawgeti(L, -1, (lua_Integer) atom);
+    if (lua_type(L, -1) == LUA_TSTRING) {
+        display->atom_hits++;
+        return 1;
+    }
+    lua_pop(L, 1);
+
+    display->atom_misses++;
+    double start = stats_begin(display->stats);
     char* name = XGetAtomName(display->inner, atom);
-    lua_pushstring(L, name);
+    stats_record(L, display->stats, "XGetAtomName", 1, start);
+    if (!name) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    atom_cache_insert(L, atom, name);
     XFree(name);
+    lua_rawgeti(L, -1, (lua_Integer) atom);
     return 1;
 }
 
 int xlib_get_atom_names(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     luaL_checktype(L, 2, LUA_TTABLE);
+    int count = (int) lua_rawlen(L, 2);
+    lua_settop(L, 2);
+
+    // Scratch space for the atoms that aren't cached yet. See `xlib_intern_atoms`.
+    Atom* atoms = lua_newuserdata(L, (size_t) count * (sizeof(Atom) + sizeof(char*) + sizeof(int)));
+    char** names = (char**) (atoms + count);
+    int* positions = (int*) (names + count);
 
-    int count = lua_rawlen(L, 2);
-    Atom* atoms = calloc(count, sizeof(Atom));
+    display_push_cache(L, 1, "atoms");
+    int cache = lua_gettop(L);
+    lua_createtable(L, count, 0);
+    int result = lua_gettop(L);
 
-    for (int i = 0; i < count; ++i) {
-        lua_pushinteger(L, i + 1);
-        lua_gettable(L, 2);
+    int nmissing = 0;
+    for (int i = 1; i <= count; ++i) {
+        lua_rawgeti(L, 2, i);
 
         int type = lua_type(L, -1);
 #if LUA_VERSION_NUM >= 503
@@ -159,28 +402,57 @@ int xlib_get_atom_names(lua_State* L) {
 #else
         if (type != LUA_TNUMBER || !lua_isnumber(L, -1) || lua_tonumber(L, -1) < 0) {
 #endif
-            free(atoms);
-            return luaL_error(L, "at index %i: expected integer, got %s", i + 1, lua_typename(L, type));
+            return luaL_error(L, "at index %i: expected integer, got %s", i, lua_typename(L, type));
         }
 
-        atoms[i] = lua_tointeger(L, -1);
+        Atom atom = (Atom) lua_tointeger(L, -1);
         lua_pop(L, 1);
-    }
-
-    char** names = calloc(count, sizeof(char*));
-    Status status = XGetAtomNames(display->inner, atoms, count, names);
-    lua_pushinteger(L, status);
 
-    lua_createtable(L, 0, count);
+        lua_rawgeti(L, cache, (lua_Integer) atom);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            display->atom_hits++;
+            lua_rawseti(L, result, i);
+        } else {
+            display->atom_misses++;
+            atoms[nmissing] = atom;
+            positions[nmissing] = i;
+            nmissing++;
+            lua_pop(L, 1);
+        }
+    }
 
-    for (int i = 0; i < count; ++i) {
-        lua_pushstring(L, names[i]);
-        lua_rawseti(L, -2, i + 1);
+    Status status = 1;
+    if (nmissing > 0) {
+        // Invalid atoms have no name, and stay `nil` in the result.
+        memset(names, 0, (size_t) nmissing * sizeof(char*));
+
+        double start = stats_begin(display->stats);
+        status = XGetAtomNames(display->inner, atoms, nmissing, names);
+        stats_record(L, display->stats, "XGetAtomNames", 1, start);
+
+        lua_pushvalue(L, cache);
+        for (int j = 0; j < nmissing; ++j) {
+            if (names[j] == NULL) {
+                continue;
+            }
+
+            atom_cache_insert(L, atoms[j], names[j]);
+            XFree(names[j]);
+            lua_rawgeti(L, -1, (lua_Integer) atoms[j]);
+            lua_rawseti(L, result, positions[j]);
+        }
+        lua_pop(L, 1);
     }
 
-    free(atoms);
-    free(names);
+    lua_pushinteger(L, status);
+    lua_pushvalue(L, result);
+    return 2;
+}
 
+int xlib_atom_cache_stats(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    lua_pushinteger(L, (lua_Integer) display->atom_hits);
+    lua_pushinteger(L, (lua_Integer) display->atom_misses);
     return 2;
 }
 
@@ -189,6 +461,28 @@ LUA_MOD_EXPORT int luaopen_xlib(lua_State* L) {
     luaL_newmetatable(L, LUA_XLIB_DISPLAY);
     luaL_setfuncs(L, display_mt, 0);
 
+    luaL_newmetatable(L, LUA_XLIB_EVENT);
+    luaU_setindex(L, event__index, event_fields);
+
+    luaL_newmetatable(L, LUA_XLIB_PROPERTY);
+    luaL_setfuncs(L, property_mt, 0);
+    luaU_setindex(L, property__index, property_fields);
+
+    luaL_newmetatable(L, LUA_XLIB_PROPERTY_STREAM);
+    luaL_setfuncs(L, property_stream_mt, 0);
+    luaU_setindex(L, property_stream__index, property_stream_fields);
+
+    luaL_newmetatable(L, LUA_XLIB_FUTURE);
+    luaL_setfuncs(L, future_mt, 0);
+    luaU_setindex(L, future__index, future_fields);
+
+    luaL_newmetatable(L, LUA_XLIB_CAPTURE);
+    luaL_setfuncs(L, capture_mt, 0);
+    luaU_setindex(L, capture__index, capture_fields);
+
+    luaL_newmetatable(L, LUA_XLIB_WINDOW_TREE);
+    luaU_setindex(L, window_tree__index, window_tree_fields);
+
     luaL_newmetatable(L, LUA_XLIB);
 
 #if LUA_VERSION_NUM <= 501
@@ -196,5 +490,15 @@ LUA_MOD_EXPORT int luaopen_xlib(lua_State* L) {
 #else
     luaL_newlib(L, xlib_lib);
 #endif
+    luaL_setfuncs(L, event_lib, 0);
+    luaL_setfuncs(L, property_lib, 0);
+    luaL_setfuncs(L, window_property_lib, 0);
+    luaL_setfuncs(L, async_lib, 0);
+    luaL_setfuncs(L, stats_lib, 0);
+    luaL_setfuncs(L, trace_lib, 0);
+    luaL_setfuncs(L, error_lib, 0);
+    luaL_setfuncs(L, window_tree_lib, 0);
+    luaL_setfuncs(L, window_lib, 0);
+    luaL_setfuncs(L, capture_lib, 0);
     return 1;
 }
@@ -5,6 +5,7 @@
 #define xlib_h_INCLUDED
 
 #include "lua_util.h"
+#include "stats.h"
 
 #include <X11/Xlib.h>
 #include <lua.h>
@@ -14,16 +15,61 @@
 #define LUA_XLIB_DISPLAY "xlib.display"
 
 
+// Decodes the events of a protocol extension. Functions receive the event code relative to the extension's
+// event base. See `display_add_event_extension`.
+typedef struct {
+    // Returns the name of the event, e.g. `RRScreenChangeNotify`, or `NULL` if unknown.
+    const char* (*name)(const XEvent*, int);
+    // Pushes the value of a field and returns `1`, or returns `0` if the event has no such field. Fields are given
+    // as their position in `event_fields`, see `event.h`.
+    int (*index)(lua_State*, const XEvent*, int, int);
+    // Called once for every event as it is taken off the queue, with the display at the given stack index.
+    // May be `NULL`.
+    void (*dispatch)(lua_State*, int, XEvent*, int);
+} event_extension_t;
+
+#define DISPLAY_MAX_EVENT_EXTENSIONS 8
+#define DISPLAY_MAX_ERRORS           64
+
 /**
  * @table Display
  */
 typedef struct {
     Display* inner;
     Bool closed;
+    // Counters for the client-side atom cache. See @{atom_cache_stats}.
+    unsigned long atom_hits;
+    unsigned long atom_misses;
+    // Round trip and latency counters, or `NULL` while disabled. See @{enable_stats}.
+    stats_t* stats;
+    // Extensions whose events should be decoded.
+    struct {
+        int base;
+        int count;
+        const event_extension_t* ext;
+    } event_extensions[DISPLAY_MAX_EVENT_EXTENSIONS];
+    int nevent_extensions;
+    // Protocol errors that haven't been taken off the queue yet, oldest first. See @{get_errors}.
+    XErrorEvent errors[DISPLAY_MAX_ERRORS];
+    int nerrors;
 } display_t;
 
 int display__gc(lua_State*);
 
+// Pushes the per-connection cache table `name` from the user value of the display at `index`,
+// creating it on first use.
+void display_push_cache(lua_State*, int, const char*);
+
+// Registers an extension's events for decoding. Registering the same extension more than once has no effect.
+void display_add_event_extension(display_t*, int, int, const event_extension_t*);
+
+// Stores the mapping in both directions in the atom cache table at the top of the stack.
+void atom_cache_insert(lua_State*, Atom, const char*);
+
+// Resolves an atom through the client-side cache of the display at `index`,
+// only asking the server on a cache miss.
+Atom display_intern_atom(lua_State*, int, const char*, Bool);
+
 
 /** Returns the default screen for the given display.
  *
@@ -69,6 +115,8 @@ int xlib_display_width(lua_State*);
  * The connection is closed automatically when the returned handler is garbage collected
  * (i.e. when it goes out of scope).
  *
+ * Protocol errors on the connection are queued, rather than terminating the process. See @{get_errors}.
+ *
  * @function XOpenDisplay
  * @tparam[opt] string display_name The connection string. When `nil`, XLib will fall back to the value of
  *  the `DISPLAY` environment variable.
@@ -99,6 +147,27 @@ int xlib_root_window(lua_State*);
  */
 int xlib_screen_count(lua_State*);
 
+/** Returns the file descriptor of the connection to the X server.
+ *
+ * This allows integrating the connection into an external event loop, e.g. with `poll(2)`.
+ * When the descriptor becomes readable, process the new events with @{drain_events}.
+ *
+ * @function ConnectionNumber
+ * @tparam Display display
+ * @treturn number
+ */
+int xlib_connection_number(lua_State*);
+
+/** Flushes the output buffer.
+ *
+ * Xlib buffers requests until they are sent with the next call that has to wait for a reply.
+ * When a request doesn't return anything, it may be necessary to flush manually.
+ *
+ * @function XFlush
+ * @tparam Display display
+ */
+int xlib_flush(lua_State*);
+
 /** Locks the given display connection for use with the current thread only.
  *
  * Other threads attempting to use the same connection will block until it is unlocked with @{XUnlockDisplay}.
@@ -117,6 +186,9 @@ int xlib_lock_display(lua_State*);
 int xlib_unlock_display(lua_State*);
 
 /** Returns an atom identifier for the given name.
+ *
+ * Atoms are cached per display connection, so only the first lookup of a name requires a round trip
+ * to the server. The predefined atoms (`XA_*` in `X11/Xatom.h`) are always answered from the cache.
  *
  * @function XInternAtom
  * @tparam Display display
@@ -127,17 +199,23 @@ int xlib_unlock_display(lua_State*);
 int xlib_intern_atom(lua_State*);
 
 /** Returns the atom identifier for a list of names.
+ *
+ * Names are looked up in the same client-side cache as @{XInternAtom} first. Only the remaining ones are sent
+ * to the server, all in a single round trip. Lists of any length are supported.
  *
  * @function XInternAtoms
  * @tparam Display display
  * @tparam table names A list of strings.
  * @tparam boolean only_if_exists
- * @treturn number An Xlib `Status`.
- * @treturn table
+ * @treturn number An Xlib `Status`. Nonzero if every name has an atom.
+ * @treturn table The atoms, in the same order as `names`. `None` (`0`) for names that don't exist,
+ *   when `only_if_exists` is set.
  */
 int xlib_intern_atoms(lua_State*);
 
 /** Returns the name associated with the given atom.
+ *
+ * Uses the same client-side cache as @{XInternAtom}.
  *
  * @function XGetAtomName
  * @tparam Display display
@@ -147,14 +225,30 @@ int xlib_intern_atoms(lua_State*);
 int xlib_get_atom_name(lua_State*);
 
 /** Returns the names associated with the list of atoms.
+ *
+ * Like @{XInternAtoms}, this only asks the server for atoms that aren't in the cache.
  *
  * @function XGetAtomNames
  * @tparam Display display
  * @tparam table atoms A list of numbers.
- * @treturn table
+ * @treturn number An Xlib `Status`. Nonzero if every atom is valid.
+ * @treturn table The names, in the same order as `atoms`. Invalid atoms are left out.
  */
 int xlib_get_atom_names(lua_State*);
 
+/** Returns the counters of the client-side atom cache.
+ *
+ * All of @{XInternAtom}, @{XInternAtoms}, @{XGetAtomName} and @{XGetAtomNames} count towards these numbers,
+ * once for every name or atom.
+ * A miss means the server had to be asked.
+ *
+ * @function atom_cache_stats
+ * @tparam Display display
+ * @treturn number The number of cache hits.
+ * @treturn number The number of cache misses.
+ */
+int xlib_atom_cache_stats(lua_State*);
+
 
 static const struct luaL_Reg display_mt[] = {
     {"__gc", display__gc},
@@ -162,21 +256,24 @@ static const struct luaL_Reg display_mt[] = {
 };
 
 static const struct luaL_Reg xlib_lib[] = {
-    {"DefaultScreen",   xlib_default_screen},
-    { "DisplayHeight",  xlib_display_height},
-    { "DisplayWidth",   xlib_display_width },
-    { "RootWindow",     xlib_root_window   },
-    { "ScreenCount",    xlib_screen_count  },
-    { "XDisplayName",   xlib_display_name  },
-    { "XOpenDisplay",   xlib_open_display  },
-    { "XLockDisplay",   xlib_lock_display  },
-    { "XCloseDisplay",  xlib_close_display },
-    { "XUnlockDisplay", xlib_unlock_display},
-    { "XInternAtom",    xlib_intern_atom   },
-    { "XInternAtoms",   xlib_intern_atoms  },
-    { "XGetAtomName",   xlib_get_atom_name },
-    { "XGetAtomNames",  xlib_get_atom_names},
-    { NULL,             NULL               }
+    {"DefaultScreen",     xlib_default_screen   },
+    { "DisplayHeight",    xlib_display_height   },
+    { "DisplayWidth",     xlib_display_width    },
+    { "RootWindow",       xlib_root_window      },
+    { "ScreenCount",      xlib_screen_count     },
+    { "ConnectionNumber", xlib_connection_number},
+    { "XFlush",           xlib_flush            },
+    { "XDisplayName",     xlib_display_name     },
+    { "XOpenDisplay",     xlib_open_display     },
+    { "XLockDisplay",     xlib_lock_display     },
+    { "XCloseDisplay",    xlib_close_display    },
+    { "XUnlockDisplay",   xlib_unlock_display   },
+    { "XInternAtom",      xlib_intern_atom      },
+    { "XInternAtoms",     xlib_intern_atoms     },
+    { "XGetAtomName",     xlib_get_atom_name    },
+    { "XGetAtomNames",    xlib_get_atom_names   },
+    { "atom_cache_stats", xlib_atom_cache_stats },
+    { NULL,               NULL                  }
 };
 
 #endif // xlib_h_INCLUDED
@@ -1,6 +1,13 @@
 #include "xrandr.h"
 
+#include "async.h"
+#include "edid.h"
+#include "event.h"
+#include "layout.h"
 #include "lua_util.h"
+#include "profile.h"
+#include "property.h"
+#include "snapshot.h"
 #include "xlib.h"
 
 #include <X11/Xatom.h>
@@ -19,8 +26,26 @@ void modeflags_to_lua(lua_State* L, int flags) {
     }
 }
 
-void mode_to_lua(lua_State* L, XRRModeInfo* info) {
-    lua_createtable(L, 0, 0);
+// Pushes the name of an enum value, or the value itself, if it is newer than the names that are known here.
+void enum_to_lua(lua_State* L, const char* const* names, unsigned int count, unsigned int value) {
+    if (value < count) {
+        lua_pushstring(L, names[value]);
+    } else {
+        lua_pushinteger(L, value);
+    }
+}
+
+void xids_to_lua(lua_State* L, const XID* xids, int n) {
+    lua_createtable(L, n, 0);
+
+    for (int i = 0; i < n; ++i) {
+        lua_pushinteger(L, xids[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+void mode_to_lua(lua_State* L, XRRModeInfo* info, double refresh) {
+    lua_createtable(L, 0, 14);
 
     lua_pushinteger(L, info->id);
     lua_setfield(L, -2, "id");
@@ -60,6 +85,9 @@ void mode_to_lua(lua_State* L, XRRModeInfo* info) {
 
     modeflags_to_lua(L, info->modeFlags);
     lua_setfield(L, -2, "modeFlags");
+
+    lua_pushnumber(L, refresh);
+    lua_setfield(L, -2, "refresh");
 }
 
 int xrandr_get_output_info(lua_State* L) {
@@ -67,24 +95,25 @@ int xrandr_get_output_info(lua_State* L) {
     screen_resources_t* res = luaL_checkudata(L, 2, LUA_XRANDR_SCREEN_RESOURCES);
     lua_Integer output = luaL_checkinteger(L, 3);
 
-    XRROutputInfo* info = XRRGetOutputInfo(display->inner, res->inner, (RROutput) output);
-    if (!info) {
+    // Created first, so that the info can't leak if a Lua error is raised.
+    output_info_t* out = luaU_newuserdata(L, sizeof(output_info_t), LUA_XRANDR_OUTPUT_INFO);
+    double start = stats_begin(display->stats);
+    out->inner = XRRGetOutputInfo(display->inner, res->inner, (RROutput) output);
+    stats_record(L, display->stats, "XRRGetOutputInfo", 1, start);
+    if (!out->inner) {
         return luaL_error(L, "Failed to get info for output %d", output);
     }
 
-    output_info_t* out = lua_newuserdata(L, sizeof(output_info_t));
-    luaL_getmetatable(L, LUA_XRANDR_OUTPUT_INFO);
-    lua_setmetatable(L, -2);
-
-    out->inner = info;
-
     return 1;
 }
 
 int xrandr_get_output_primary(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     lua_Integer window = luaL_checkinteger(L, 2);
-    lua_pushboolean(L, XRRGetOutputPrimary(display->inner, (Window) window));
+    double start = stats_begin(display->stats);
+    RROutput primary = XRRGetOutputPrimary(display->inner, (Window) window);
+    stats_record(L, display->stats, "XRRGetOutputPrimary", 1, start);
+    lua_pushinteger(L, (lua_Integer) primary);
     return 1;
 }
 
@@ -98,49 +127,59 @@ int xrandr_set_output_primary(lua_State* L) {
 
 int output_info__gc(lua_State* L) {
     output_info_t* out = luaL_checkudata(L, 1, LUA_XRANDR_OUTPUT_INFO);
-    XRRFreeOutputInfo(out->inner);
+    if (out->inner) {
+        XRRFreeOutputInfo(out->inner);
+    }
     return 0;
 }
 
 int output_info__index(lua_State* L) {
     output_info_t* out = luaL_checkudata(L, 1, LUA_XRANDR_OUTPUT_INFO);
-    const char* key = luaL_checkstring(L, 2);
 
-    if (strcmp(key, "timestamp") == 0) {
+    switch (luaU_checkfield(L, 2)) {
+    case OUTPUT_INFO_TIMESTAMP:
         lua_pushinteger(L, out->inner->timestamp);
-    } else if (strcmp(key, "name") == 0) {
+        break;
+    case OUTPUT_INFO_NAME:
         lua_pushlstring(L, out->inner->name, out->inner->nameLen);
-    } else if (strcmp(key, "crtc") == 0) {
+        break;
+    case OUTPUT_INFO_CRTC:
         lua_pushinteger(L, out->inner->crtc);
-    } else if (strcmp(key, "npreferred") == 0) {
+        break;
+    case OUTPUT_INFO_NPREFERRED:
         lua_pushinteger(L, out->inner->npreferred);
-    } else if (strcmp(key, "mm_width") == 0) {
+        break;
+    case OUTPUT_INFO_MM_WIDTH:
         lua_pushinteger(L, out->inner->mm_width);
-    } else if (strcmp(key, "mm_height") == 0) {
+        break;
+    case OUTPUT_INFO_MM_HEIGHT:
         lua_pushinteger(L, out->inner->mm_height);
-    } else if (strcmp(key, "connection") == 0) {
-        lua_pushstring(L, connection_states[out->inner->connection]);
-    } else if (strcmp(key, "subpixel_order") == 0) {
-        lua_pushstring(L, subpixel_orders[out->inner->subpixel_order]);
-    } else if (strcmp(key, "crtcs") == 0) {
-        lua_createtable(L, 0, out->inner->ncrtc);
-        for (int i = 0; i < out->inner->ncrtc; ++i) {
-            lua_pushinteger(L, out->inner->crtcs[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case OUTPUT_INFO_CONNECTION:
+        enum_to_lua(L, connection_states, CONNECTION_STATES_COUNT, out->inner->connection);
+        break;
+    case OUTPUT_INFO_SUBPIXEL_ORDER:
+        enum_to_lua(L, subpixel_orders, SUBPIXEL_ORDERS_COUNT, out->inner->subpixel_order);
+        break;
+    case OUTPUT_INFO_CRTCS:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, out->inner->crtcs, out->inner->ncrtc);
+            luaU_cache(L, 1, 2);
         }
-    } else if (strcmp(key, "clones") == 0) {
-        lua_createtable(L, 0, out->inner->nclone);
-        for (int i = 0; i < out->inner->nclone; ++i) {
-            lua_pushinteger(L, out->inner->clones[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case OUTPUT_INFO_CLONES:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, out->inner->clones, out->inner->nclone);
+            luaU_cache(L, 1, 2);
         }
-    } else if (strcmp(key, "modes") == 0) {
-        lua_createtable(L, 0, out->inner->nmode);
-        for (int i = 0; i < out->inner->nmode; ++i) {
-            lua_pushinteger(L, out->inner->modes[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case OUTPUT_INFO_MODES:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, out->inner->modes, out->inner->nmode);
+            luaU_cache(L, 1, 2);
         }
-    } else {
+        break;
+    default:
         lua_pushnil(L);
     }
 
@@ -152,112 +191,297 @@ int xrandr_get_screen_resources(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     lua_Integer root = luaL_optinteger(L, 2, -1);
 
-    screen_resources_t* res = lua_newuserdata(L, sizeof(screen_resources_t));
-    luaL_getmetatable(L, LUA_XRANDR_SCREEN_RESOURCES);
-    lua_setmetatable(L, -2);
-
+    // Created first, so that the resources can't leak if a Lua error is raised.
+    screen_resources_t* res = push_screen_resources(L, NULL);
+    double start = stats_begin(display->stats);
     res->inner = XRRGetScreenResources(display->inner, root);
+    stats_record(L, display->stats, "XRRGetScreenResources", 1, start);
+    if (!res->inner) {
+        return luaL_error(L, "failed to get screen resources");
+    }
 
     return 1;
 }
 
+int xrandr_get_screen_resources_current(lua_State* L) {
+    display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    Window window = (Window) luaL_checkinteger(L, 2);
+
+    // Created first, so that the resources can't leak if a Lua error is raised.
+    screen_resources_t* res = push_screen_resources(L, NULL);
+    double start = stats_begin(display->stats);
+    res->inner = XRRGetScreenResourcesCurrent(display->inner, window);
+    stats_record(L, display->stats, "XRRGetScreenResourcesCurrent", 1, start);
+    if (!res->inner) {
+        return luaL_error(L, "failed to get screen resources");
+    }
+
+    return 1;
+}
+
+screen_resources_t* push_screen_resources(lua_State* L, XRRScreenResources* inner) {
+    screen_resources_t* res = luaU_newuserdata(L, sizeof(screen_resources_t), LUA_XRANDR_SCREEN_RESOURCES);
+    res->inner = inner;
+    res->mode_ids = NULL;
+    res->refresh = NULL;
+    return res;
+}
+
 int screen_resources__gc(lua_State* L) {
     screen_resources_t* res = luaL_checkudata(L, 1, LUA_XRANDR_SCREEN_RESOURCES);
-    XRRFreeScreenResources(res->inner);
+    if (res->inner) {
+        XRRFreeScreenResources(res->inner);
+    }
+    free(res->mode_ids);
+    free(res->refresh);
     return 0;
 }
 
+double mode_refresh(const XRRModeInfo* info) {
+    double vtotal = info->vTotal;
+
+    // Double scan draws every line twice, interlaced modes draw half of the lines per field.
+    if (info->modeFlags & RR_DoubleScan) {
+        vtotal *= 2;
+    }
+    if (info->modeFlags & RR_Interlace) {
+        vtotal /= 2;
+    }
+
+    if (info->hTotal == 0 || vtotal == 0) {
+        return 0;
+    }
+
+    return (double) info->dotClock / ((double) info->hTotal * vtotal);
+}
+
+int compare_mode_ids(const void* a, const void* b) {
+    RRMode left = ((const mode_id_t*) a)->id;
+    RRMode right = ((const mode_id_t*) b)->id;
+    return (left > right) - (left < right);
+}
+
+Bool screen_resources_index_modes(screen_resources_t* res) {
+    if (res->mode_ids) {
+        return True;
+    }
+
+    int nmode = res->inner->nmode;
+    // Allocate at least one element, so that the `NULL` check above works for empty mode lists.
+    mode_id_t* ids = malloc((nmode > 0 ? nmode : 1) * sizeof(mode_id_t));
+    double* refresh = malloc((nmode > 0 ? nmode : 1) * sizeof(double));
+    if (!ids || !refresh) {
+        free(ids);
+        free(refresh);
+        return False;
+    }
+
+    for (int i = 0; i < nmode; ++i) {
+        ids[i].id = res->inner->modes[i].id;
+        ids[i].index = i;
+        refresh[i] = mode_refresh(&res->inner->modes[i]);
+    }
+    qsort(ids, nmode, sizeof(mode_id_t), compare_mode_ids);
+
+    res->mode_ids = ids;
+    res->refresh = refresh;
+    return True;
+}
+
+int screen_resources_find_mode(const screen_resources_t* res, RRMode id) {
+    mode_id_t key = { id, 0 };
+    const mode_id_t* found = bsearch(&key, res->mode_ids, res->inner->nmode, sizeof(mode_id_t), compare_mode_ids);
+    return found ? found->index : -1;
+}
+
+// Pushes the table for the mode at position `i`, converting it on first use.
+// `index` is the stack index of the screen resources.
+void push_mode(lua_State* L, int index, screen_resources_t* res, int i) {
+    XRRModeInfo* info = &res->inner->modes[i];
+
+    lua_pushinteger(L, info->id);
+    if (!luaU_pushcached(L, index, -1)) {
+        mode_to_lua(L, info, res->refresh ? res->refresh[i] : mode_refresh(info));
+        luaU_cache(L, index, -2);
+    }
+    lua_remove(L, -2);
+}
+
 int screen_resources__index(lua_State* L) {
     screen_resources_t* res = luaL_checkudata(L, 1, LUA_XRANDR_SCREEN_RESOURCES);
-    const char* key = luaL_checkstring(L, 2);
 
-    if (strcmp(key, "timestamp") == 0) {
+    switch (luaU_checkfield(L, 2)) {
+    case SCREEN_RESOURCES_TIMESTAMP:
         lua_pushinteger(L, res->inner->timestamp);
-    } else if (strcmp(key, "configTimestamp") == 0) {
+        break;
+    case SCREEN_RESOURCES_CONFIG_TIMESTAMP:
         lua_pushinteger(L, res->inner->configTimestamp);
-    } else if (strcmp(key, "outputs") == 0) {
-        lua_createtable(L, 0, res->inner->noutput);
-        for (int i = 0; i < res->inner->noutput; ++i) {
-            lua_pushinteger(L, res->inner->outputs[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case SCREEN_RESOURCES_OUTPUTS:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, res->inner->outputs, res->inner->noutput);
+            luaU_cache(L, 1, 2);
         }
-    } else if (strcmp(key, "crtcs") == 0) {
-        lua_createtable(L, 0, res->inner->ncrtc);
-        for (int i = 0; i < res->inner->ncrtc; ++i) {
-            lua_pushinteger(L, res->inner->crtcs[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case SCREEN_RESOURCES_CRTCS:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, res->inner->crtcs, res->inner->ncrtc);
+            luaU_cache(L, 1, 2);
         }
-    } else if (strcmp(key, "modes") == 0) {
-        lua_createtable(L, 0, res->inner->nmode);
-        for (int i = 0; i < res->inner->nmode; ++i) {
-            mode_to_lua(L, &res->inner->modes[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case SCREEN_RESOURCES_MODES:
+        if (!luaU_pushcached(L, 1, 2)) {
+            lua_createtable(L, res->inner->nmode, 0);
+            for (int i = 0; i < res->inner->nmode; ++i) {
+                push_mode(L, 1, res, i);
+                lua_rawseti(L, -2, i + 1);
+            }
+            luaU_cache(L, 1, 2);
         }
-    } else {
+        break;
+    default:
         lua_pushnil(L);
     }
 
     return 1;
 }
 
+int xrandr_mode_by_id(lua_State* L) {
+    screen_resources_t* res = luaL_checkudata(L, 1, LUA_XRANDR_SCREEN_RESOURCES);
+    RRMode id = (RRMode) luaL_checkinteger(L, 2);
+
+    if (!screen_resources_index_modes(res)) {
+        return luaL_error(L, "failed to allocate mode index");
+    }
+
+    int i = screen_resources_find_mode(res, id);
+    if (i < 0) {
+        return 0;
+    }
+
+    push_mode(L, 1, res, i);
+    return 1;
+}
+
+int screen_resources_best_mode(const screen_resources_t* res,
+                               unsigned int width,
+                               unsigned int height,
+                               double refresh,
+                               const XRROutputInfo* output) {
+    int n = output ? output->nmode : res->inner->nmode;
+    int best = -1;
+    double best_delta = 0;
+    for (int j = 0; j < n; ++j) {
+        int i = output ? screen_resources_find_mode(res, output->modes[j]) : j;
+        if (i < 0) {
+            continue;
+        }
+
+        const XRRModeInfo* info = &res->inner->modes[i];
+        if (info->width != width || info->height != height) {
+            continue;
+        }
+
+        // Without a requested rate, pick the highest one.
+        double delta = refresh <= 0 ? -res->refresh[i] : res->refresh[i] - refresh;
+        if (refresh > 0 && delta < 0) {
+            delta = -delta;
+        }
+        if (best < 0 || delta < best_delta) {
+            best = i;
+            best_delta = delta;
+        }
+    }
+
+    return best;
+}
+
+int xrandr_find_mode(lua_State* L) {
+    screen_resources_t* res = luaL_checkudata(L, 1, LUA_XRANDR_SCREEN_RESOURCES);
+    unsigned int width = (unsigned int) luaL_checkinteger(L, 2);
+    unsigned int height = (unsigned int) luaL_checkinteger(L, 3);
+    double refresh = luaL_optnumber(L, 4, 0);
+    output_info_t* out = lua_isnoneornil(L, 5) ? NULL : luaL_checkudata(L, 5, LUA_XRANDR_OUTPUT_INFO);
+
+    if (!screen_resources_index_modes(res)) {
+        return luaL_error(L, "failed to allocate mode index");
+    }
+
+    int best = screen_resources_best_mode(res, width, height, refresh, out ? out->inner : NULL);
+    if (best < 0) {
+        return 0;
+    }
+
+    push_mode(L, 1, res, best);
+    return 1;
+}
+
 int xrandr_get_crtc_info(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     screen_resources_t* res = luaL_checkudata(L, 2, LUA_XRANDR_SCREEN_RESOURCES);
     lua_Integer crtc = luaL_checkinteger(L, 3);
 
-    XRRCrtcInfo* info = XRRGetCrtcInfo(display->inner, res->inner, (RRCrtc) crtc);
-    if (!info) {
+    // Created first, so that the info can't leak if a Lua error is raised.
+    crtc_info_t* out = luaU_newuserdata(L, sizeof(crtc_info_t), LUA_XRANDR_CRTC_INFO);
+    double start = stats_begin(display->stats);
+    out->inner = XRRGetCrtcInfo(display->inner, res->inner, (RRCrtc) crtc);
+    stats_record(L, display->stats, "XRRGetCrtcInfo", 1, start);
+    if (!out->inner) {
         return luaL_error(L, "Failed to get info for crtc %d", crtc);
     }
 
-    crtc_info_t* out = lua_newuserdata(L, sizeof(crtc_info_t));
-    luaL_getmetatable(L, LUA_XRANDR_CRTC_INFO);
-    lua_setmetatable(L, -2);
-
-    out->inner = info;
-
     return 1;
 }
 
 int crtc_info__gc(lua_State* L) {
     crtc_info_t* crtc = luaL_checkudata(L, 1, LUA_XRANDR_CRTC_INFO);
-    XRRFreeCrtcInfo(crtc->inner);
+    if (crtc->inner) {
+        XRRFreeCrtcInfo(crtc->inner);
+    }
     return 0;
 }
 
 int crtc_info__index(lua_State* L) {
     crtc_info_t* crtc = luaL_checkudata(L, 1, LUA_XRANDR_CRTC_INFO);
-    const char* key = luaL_checkstring(L, 2);
 
-    if (strcmp(key, "timestamp") == 0) {
+    switch (luaU_checkfield(L, 2)) {
+    case CRTC_INFO_TIMESTAMP:
         lua_pushinteger(L, crtc->inner->timestamp);
-    } else if (strcmp(key, "x") == 0) {
+        break;
+    case CRTC_INFO_X:
         lua_pushinteger(L, crtc->inner->x);
-    } else if (strcmp(key, "y") == 0) {
+        break;
+    case CRTC_INFO_Y:
         lua_pushinteger(L, crtc->inner->y);
-    } else if (strcmp(key, "height") == 0) {
+        break;
+    case CRTC_INFO_HEIGHT:
         lua_pushinteger(L, crtc->inner->height);
-    } else if (strcmp(key, "width") == 0) {
+        break;
+    case CRTC_INFO_WIDTH:
         lua_pushinteger(L, crtc->inner->width);
-    } else if (strcmp(key, "mode") == 0) {
+        break;
+    case CRTC_INFO_MODE:
         lua_pushinteger(L, crtc->inner->mode);
-    } else if (strcmp(key, "rotation") == 0) {
+        break;
+    case CRTC_INFO_ROTATION:
         lua_pushinteger(L, crtc->inner->rotation);
-    } else if (strcmp(key, "rotations") == 0) {
+        break;
+    case CRTC_INFO_ROTATIONS:
         lua_pushinteger(L, crtc->inner->rotations);
-    } else if (strcmp(key, "outputs") == 0) {
-        lua_createtable(L, 0, crtc->inner->noutput);
-        for (int i = 0; i < crtc->inner->noutput; ++i) {
-            lua_pushinteger(L, crtc->inner->outputs[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case CRTC_INFO_OUTPUTS:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, crtc->inner->outputs, crtc->inner->noutput);
+            luaU_cache(L, 1, 2);
         }
-    } else if (strcmp(key, "possible") == 0) {
-        lua_createtable(L, 0, crtc->inner->npossible);
-        for (int i = 0; i < crtc->inner->npossible; ++i) {
-            lua_pushinteger(L, crtc->inner->possible[i]);
-            lua_rawseti(L, -2, i + 1);
+        break;
+    case CRTC_INFO_POSSIBLE:
+        if (!luaU_pushcached(L, 1, 2)) {
+            xids_to_lua(L, crtc->inner->possible, crtc->inner->npossible);
+            luaU_cache(L, 1, 2);
         }
-    } else {
+        break;
+    default:
         lua_pushnil(L);
     }
 
@@ -285,6 +509,7 @@ int xrandr_set_crtc_config(lua_State* L) {
         outputs[i] = luaL_checkinteger(L, -1);
     }
 
+    double start = stats_begin(display->stats);
     Status status = XRRSetCrtcConfig(display->inner,
                                      res->inner,
                                      (RRCrtc) crtc,
@@ -295,6 +520,7 @@ int xrandr_set_crtc_config(lua_State* L) {
                                      (Rotation) rotation,
                                      outputs,
                                      noutputs);
+    stats_record(L, display->stats, "XRRSetCrtcConfig", 1, start);
 
     free(outputs);
     lua_pushinteger(L, status);
@@ -302,12 +528,199 @@ int xrandr_set_crtc_config(lua_State* L) {
     return 1;
 }
 
+const char* xrandr_event_name(const XEvent* event, int code) {
+    if (code == RRScreenChangeNotify) {
+        return "RRScreenChangeNotify";
+    }
+
+    const XRRNotifyEvent* notify = (const XRRNotifyEvent*) event;
+    if (notify->subtype >= 0 && notify->subtype < (int) (sizeof(notify_names) / sizeof(notify_names[0]))) {
+        return notify_names[notify->subtype];
+    }
+
+    return NULL;
+}
+
+int xrandr_screen_change_index(lua_State* L, const XRRScreenChangeNotifyEvent* event, int field) {
+    switch (field) {
+    case EVENT_ROOT:
+        lua_pushinteger(L, event->root);
+        break;
+    case EVENT_TIMESTAMP:
+        lua_pushinteger(L, event->timestamp);
+        break;
+    case EVENT_CONFIG_TIMESTAMP:
+        lua_pushinteger(L, event->config_timestamp);
+        break;
+    case EVENT_SIZE_INDEX:
+        lua_pushinteger(L, event->size_index);
+        break;
+    case EVENT_SUBPIXEL_ORDER:
+        enum_to_lua(L, subpixel_orders, SUBPIXEL_ORDERS_COUNT, event->subpixel_order);
+        break;
+    case EVENT_ROTATION:
+        lua_pushinteger(L, event->rotation);
+        break;
+    case EVENT_WIDTH:
+        lua_pushinteger(L, event->width);
+        break;
+    case EVENT_HEIGHT:
+        lua_pushinteger(L, event->height);
+        break;
+    case EVENT_MWIDTH:
+        lua_pushinteger(L, event->mwidth);
+        break;
+    case EVENT_MHEIGHT:
+        lua_pushinteger(L, event->mheight);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+int xrandr_crtc_change_index(lua_State* L, const XRRCrtcChangeNotifyEvent* event, int field) {
+    switch (field) {
+    case EVENT_CRTC:
+        lua_pushinteger(L, event->crtc);
+        break;
+    case EVENT_MODE:
+        lua_pushinteger(L, event->mode);
+        break;
+    case EVENT_ROTATION:
+        lua_pushinteger(L, event->rotation);
+        break;
+    case EVENT_X:
+        lua_pushinteger(L, event->x);
+        break;
+    case EVENT_Y:
+        lua_pushinteger(L, event->y);
+        break;
+    case EVENT_WIDTH:
+        lua_pushinteger(L, event->width);
+        break;
+    case EVENT_HEIGHT:
+        lua_pushinteger(L, event->height);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+int xrandr_output_change_index(lua_State* L, const XRROutputChangeNotifyEvent* event, int field) {
+    switch (field) {
+    case EVENT_OUTPUT:
+        lua_pushinteger(L, event->output);
+        break;
+    case EVENT_CRTC:
+        lua_pushinteger(L, event->crtc);
+        break;
+    case EVENT_MODE:
+        lua_pushinteger(L, event->mode);
+        break;
+    case EVENT_ROTATION:
+        lua_pushinteger(L, event->rotation);
+        break;
+    case EVENT_CONNECTION:
+        enum_to_lua(L, connection_states, CONNECTION_STATES_COUNT, event->connection);
+        break;
+    case EVENT_SUBPIXEL_ORDER:
+        enum_to_lua(L, subpixel_orders, SUBPIXEL_ORDERS_COUNT, event->subpixel_order);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+int xrandr_output_property_index(lua_State* L, const XRROutputPropertyNotifyEvent* event, int field) {
+    switch (field) {
+    case EVENT_OUTPUT:
+        lua_pushinteger(L, event->output);
+        break;
+    case EVENT_PROPERTY:
+        lua_pushinteger(L, event->property);
+        break;
+    case EVENT_TIMESTAMP:
+        lua_pushinteger(L, event->timestamp);
+        break;
+    case EVENT_STATE:
+        lua_pushinteger(L, event->state);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+int xrandr_event_index(lua_State* L, const XEvent* event, int code, int field) {
+    if (code == RRScreenChangeNotify) {
+        return xrandr_screen_change_index(L, (const XRRScreenChangeNotifyEvent*) event, field);
+    }
+
+    const XRRNotifyEvent* notify = (const XRRNotifyEvent*) event;
+    if (field == EVENT_SUBTYPE) {
+        lua_pushinteger(L, notify->subtype);
+        return 1;
+    }
+
+    switch (notify->subtype) {
+    case RRNotify_CrtcChange:
+        return xrandr_crtc_change_index(L, (const XRRCrtcChangeNotifyEvent*) event, field);
+    case RRNotify_OutputChange:
+        return xrandr_output_change_index(L, (const XRROutputChangeNotifyEvent*) event, field);
+    case RRNotify_OutputProperty:
+        return xrandr_output_property_index(L, (const XRROutputPropertyNotifyEvent*) event, field);
+    default:
+        return 0;
+    }
+}
+
+void xrandr_event_dispatch(lua_State* L, int display_index, XEvent* event, int code) {
+    // Xlib caches the screen size, which would be stale after a change, e.g. for `DisplayWidth`.
+    if (code == RRScreenChangeNotify) {
+        XRRUpdateConfiguration(event);
+        return;
+    }
+
+    const XRRNotifyEvent* notify = (const XRRNotifyEvent*) event;
+    if (notify->subtype == RRNotify_OutputChange) {
+        const XRROutputChangeNotifyEvent* change = (const XRROutputChangeNotifyEvent*) event;
+        display_update_output_connection(L, display_index, change->output, change->connection);
+    } else if (notify->subtype == RRNotify_OutputProperty) {
+        const XRROutputPropertyNotifyEvent* change = (const XRROutputPropertyNotifyEvent*) event;
+        display_output_property_changed(L, display_index, change->output, change->property);
+    }
+}
+
+static const event_extension_t xrandr_events = {
+    xrandr_event_name,
+    xrandr_event_index,
+    xrandr_event_dispatch,
+};
+
+// Makes sure that RandR events on this connection are decoded when they are taken off the queue.
+Bool register_events(display_t* display, int* event_base, int* error_base) {
+    Bool status = XRRQueryExtension(display->inner, event_base, error_base);
+    if (status) {
+        display_add_event_extension(display, *event_base, RRNumberEvents, &xrandr_events);
+    }
+    return status;
+}
+
 int xrandr_query_version(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     int major = 0;
     int minor = 0;
 
+    double start = stats_begin(display->stats);
     Status status = XRRQueryVersion(display->inner, &major, &minor);
+    stats_record(L, display->stats, "XRRQueryVersion", 1, start);
     lua_pushinteger(L, status);
     lua_pushinteger(L, major);
     lua_pushinteger(L, minor);
@@ -319,7 +732,7 @@ int xrandr_query_extension(lua_State* L) {
     int event_base = 0;
     int error_base = 0;
 
-    Bool status = XRRQueryExtension(display->inner, &event_base, &error_base);
+    Bool status = register_events(display, &event_base, &error_base);
     lua_pushboolean(L, status);
     lua_pushinteger(L, event_base);
     lua_pushinteger(L, error_base);
@@ -340,7 +753,9 @@ int xrandr_get_screen_info(lua_State* L) {
     luaL_getmetatable(L, LUA_XRANDR_SCREEN_CONFIG);
     lua_setmetatable(L, -2);
 
+    double start = stats_begin(display->stats);
     XRRScreenConfiguration* inner = XRRGetScreenInfo(display->inner, window);
+    stats_record(L, display->stats, "XRRGetScreenInfo", 1, start);
     if (!inner) {
         return luaL_error(L, "failed to get screen configuration");
     }
@@ -433,7 +848,9 @@ int xrandr_set_screen_config(lua_State* L) {
     Rotation rotation = (Rotation) luaL_checkinteger(L, 5);
     Time timestamp = (Time) luaL_checkinteger(L, 6);
 
+    double start = stats_begin(display->stats);
     Status status = XRRSetScreenConfig(display->inner, config->inner, d, size_index, rotation, timestamp);
+    stats_record(L, display->stats, "XRRSetScreenConfig", 1, start);
 
     lua_pushinteger(L, status);
     return 1;
@@ -448,7 +865,9 @@ int xrandr_set_screen_config_rate(lua_State* L) {
     short rate = (short) luaL_checkinteger(L, 6);
     Time timestamp = (Time) luaL_checkinteger(L, 7);
 
+    double start = stats_begin(display->stats);
     Status status = XRRSetScreenConfigAndRate(display->inner, config->inner, d, size_index, rotation, rate, timestamp);
+    stats_record(L, display->stats, "XRRSetScreenConfigAndRate", 1, start);
 
     lua_pushinteger(L, status);
     return 1;
@@ -480,6 +899,10 @@ int xrandr_select_input(lua_State* L) {
     mask += get_mask_for_field(L, 3, "provider_property", RROutputPropertyNotifyMask);
     mask += get_mask_for_field(L, 3, "resource", RRResourceChangeNotifyMask);
 
+    int event_base;
+    int error_base;
+    register_events(display, &event_base, &error_base);
+
     XRRSelectInput(display->inner, window, mask);
 
     return 0;
@@ -493,7 +916,9 @@ int xrandr_get_screen_size_range(lua_State* L) {
     int max_width;
     int max_height;
 
+    double start = stats_begin(display->stats);
     Status status = XRRGetScreenSizeRange(display->inner, window, &min_width, &min_height, &max_width, &max_height);
+    stats_record(L, display->stats, "XRRGetScreenSizeRange", 1, start);
 
     lua_pushinteger(L, status);
     lua_pushinteger(L, min_width);
@@ -521,7 +946,9 @@ int xrandr_list_output_properties(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     RROutput output = (RROutput) luaL_checkinteger(L, 2);
     int nprop = 0;
+    double start = stats_begin(display->stats);
     Atom* properties = XRRListOutputProperties(display->inner, output, &nprop);
+    stats_record(L, display->stats, "XRRListOutputProperties", 1, start);
 
     lua_createtable(L, 0, nprop);
     for (int i = 0; i < nprop; ++i) {
@@ -537,7 +964,9 @@ int xrandr_query_output_property(lua_State* L) {
     RROutput output = (RROutput) luaL_checkinteger(L, 2);
     Atom property = (Atom) luaL_checkinteger(L, 3);
 
+    double start = stats_begin(display->stats);
     XRRPropertyInfo* info = XRRQueryOutputProperty(display->inner, output, property);
+    stats_record(L, display->stats, "XRRQueryOutputProperty", 1, start);
 
     if (!info) {
         return luaL_error(L, "Failed to query output property %d", property);
@@ -593,17 +1022,15 @@ int xrandr_change_output_property(lua_State* L) {
     display_t* display = luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
     RROutput output = (RROutput) luaL_checkinteger(L, 2);
     Atom property = (Atom) luaL_checkinteger(L, 3);
-    int mode = (int) luaL_checkinteger(L, 4);
-    // For now we only support strings, so we hardcode the type.
-    // We still keep the parameter as a placeholder, so we don't need an API change later on,
-    // and still map properly to the signature in libxrandr.
-    Atom type = XA_STRING; // (Atom) luaL_checkinteger(L, 5);
+    int mode = (int) luaL_optinteger(L, 4, PropModeReplace);
+    Atom type = (Atom) luaL_optinteger(L, 5, property_default_type(L, 6));
+    int format = (int) luaL_optinteger(L, 7, lua_type(L, 6) == LUA_TTABLE ? 32 : 8);
+    luaL_argcheck(L, format == 8 || format == 16 || format == 32, 7, "format must be one of 8, 16 or 32");
 
-    int format = 8;
-    size_t nelements;
-    const unsigned char* data = (const unsigned char*) luaL_checklstring(L, 6, &nelements);
+    int nelements = 0;
+    const unsigned char* data = property_check_data(L, 6, &format, &nelements);
 
-    XRRChangeOutputProperty(display->inner, output, property, type, format, mode, data, (int) nelements);
+    XRRChangeOutputProperty(display->inner, output, property, type, format, mode, data, nelements);
     return 0;
 }
 
@@ -615,51 +1042,81 @@ int xrandr_get_output_property(lua_State* L) {
     long length = (long) luaL_checkinteger(L, 5);
     Bool delete = (Bool) lua_toboolean(L, 6);
     Bool pending = (Bool) lua_toboolean(L, 7);
-    // As with changing the output, we hardcode the type for now and keep the parameter only as placeholder.
-    // As its the last parameter, that's trivial anyways.
-    Atom req_type = XA_STRING; // (Atom) luaL_checkinteger(L, 8);
-
-    Atom actual_type;
-    int actual_format;
-    unsigned long nitems;
-    unsigned long bytes_after;
-    unsigned char* prop;
-
-    XRRGetOutputProperty(display->inner,
-                         output,
-                         property,
-                         offset,
-                         length,
-                         delete,
-                         pending,
-                         req_type,
-                         &actual_type,
-                         &actual_format,
-                         &nitems,
-                         &bytes_after,
-                         &prop);
+    Atom req_type = (Atom) luaL_optinteger(L, 8, AnyPropertyType);
+
+    Atom actual_type = None;
+    int actual_format = 0;
+    unsigned long nitems = 0;
+    unsigned long bytes_after = 0;
+    unsigned char* prop = NULL;
+
+    double start = stats_begin(display->stats);
+    int status = XRRGetOutputProperty(display->inner,
+                                      output,
+                                      property,
+                                      offset,
+                                      length,
+                                      delete,
+                                      pending,
+                                      req_type,
+                                      &actual_type,
+                                      &actual_format,
+                                      &nitems,
+                                      &bytes_after,
+                                      &prop);
+    stats_record(L, display->stats, "XRRGetOutputProperty", 1, start);
 
     // `type == None` is returned when the property doesn't exist.
-    if (actual_type == None) {
+    if (status != Success || actual_type == None) {
+        if (prop) {
+            XFree(prop);
+        }
         return 0;
     }
 
-    // If there is a returned type, but no data, the requested type did not match the actual type.
-    if (!prop) {
-        return luaL_error(L, "Only properties of type `string` are currently supported. Got `(Atom) %d`.", actual_type);
-    }
+    // If the type didn't match `req_type`, there is no data, but the buffer still reports the actual type
+    // and size.
+    push_property(L, prop, nitems, actual_format, actual_type, bytes_after);
+    return 1;
+}
 
-    // if (actual_format != 8) {
-    //     return luaL_error(L, "Only byte format `8` is currently supported. Got `%d`.", actual_format);
-    // }
+// Adapts `XRRGetOutputProperty` to the signature of `XGetWindowProperty`, for use with property streams.
+int get_output_property_chunk(Display* display,
+                              XID output,
+                              Atom property,
+                              long offset,
+                              long length,
+                              Bool delete,
+                              Atom req_type,
+                              Atom* actual_type,
+                              int* actual_format,
+                              unsigned long* nitems,
+                              unsigned long* bytes_after,
+                              unsigned char** prop) {
+    return XRRGetOutputProperty(display,
+                                (RROutput) output,
+                                property,
+                                offset,
+                                length,
+                                delete,
+                                False,
+                                req_type,
+                                actual_type,
+                                actual_format,
+                                nitems,
+                                bytes_after,
+                                prop);
+}
 
-    lua_pushlstring(L, (char*) prop, length);
-    lua_pushinteger(L, nitems);
-    lua_pushinteger(L, actual_type);
-    lua_pushinteger(L, actual_format);
-    lua_pushinteger(L, bytes_after);
+int xrandr_output_property_stream(lua_State* L) {
+    luaL_checkudata(L, 1, LUA_XLIB_DISPLAY);
+    RROutput output = (RROutput) luaL_checkinteger(L, 2);
+    Atom property = (Atom) luaL_checkinteger(L, 3);
+    long length = (long) luaL_optinteger(L, 4, 1024);
+    Atom req_type = (Atom) luaL_optinteger(L, 5, AnyPropertyType);
 
-    return 2;
+    push_property_stream(L, 1, output, property, length, req_type, get_output_property_chunk);
+    return 1;
 }
 
 int xrandr_delete_output_property(lua_State* L) {
@@ -675,16 +1132,30 @@ int xrandr_delete_output_property(lua_State* L) {
 LUA_MOD_EXPORT int luaopen_xlib_xrandr(lua_State* L) {
     luaL_newmetatable(L, LUA_XRANDR_SCREEN_RESOURCES);
     luaL_setfuncs(L, screen_resources_mt, 0);
+    luaU_setindex(L, screen_resources__index, screen_resources_fields);
 
     luaL_newmetatable(L, LUA_XRANDR_OUTPUT_INFO);
     luaL_setfuncs(L, output_info_mt, 0);
+    luaU_setindex(L, output_info__index, output_info_fields);
 
     luaL_newmetatable(L, LUA_XRANDR_CRTC_INFO);
     luaL_setfuncs(L, crtc_info_mt, 0);
+    luaU_setindex(L, crtc_info__index, crtc_info_fields);
 
     luaL_newmetatable(L, LUA_XRANDR_SCREEN_CONFIG);
     luaL_setfuncs(L, screen_config_mt, 0);
 
+    // Property buffers, streams and futures are registered by `xlib`, which must be loaded to open a display.
+    luaL_newmetatable(L, LUA_XRANDR_EDID);
+    luaU_setindex(L, edid__index, edid_fields);
+
+    luaL_newmetatable(L, LUA_XRANDR_SNAPSHOT);
+    luaL_setfuncs(L, snapshot_mt, 0);
+    luaU_setindex(L, snapshot__index, snapshot_fields);
+
+    luaL_newmetatable(L, LUA_XRANDR_PROFILE_SET);
+    luaU_setindex(L, profile_set__index, profile_set_fields);
+
     luaL_newmetatable(L, LUA_XRANDR);
 
 #if LUA_VERSION_NUM <= 501
@@ -692,6 +1163,11 @@ LUA_MOD_EXPORT int luaopen_xlib_xrandr(lua_State* L) {
 #else
     luaL_newlib(L, xrandr_lib);
 #endif
+    luaL_setfuncs(L, snapshot_lib, 0);
+    luaL_setfuncs(L, snapshot_async_lib, 0);
+    luaL_setfuncs(L, edid_lib, 0);
+    luaL_setfuncs(L, profile_lib, 0);
+    luaL_setfuncs(L, layout_lib, 0);
 
     lua_createtable(L, 13, 0);
     luaU_setstringfield(L, -1, "BACKLIGHT", "Backlight");
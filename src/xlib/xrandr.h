@@ -23,19 +23,78 @@
 #define LUA_XRANDR_CRTC_INFO        "xlib.xrandr.crtc_info"
 #define LUA_XRANDR_SCREEN_CONFIG    "xlib.xrandr.screen_configuration"
 
+// Fields of the userdata types, as looked up by their `__index` functions. See `luaU_setindex`.
+// Enum values are the positions in the respective list of names.
+
+enum {
+    SCREEN_RESOURCES_TIMESTAMP = 1,
+    SCREEN_RESOURCES_CONFIG_TIMESTAMP,
+    SCREEN_RESOURCES_OUTPUTS,
+    SCREEN_RESOURCES_CRTCS,
+    SCREEN_RESOURCES_MODES,
+};
+
+static const char* const screen_resources_fields[] = {
+    "timestamp", "configTimestamp", "outputs", "crtcs", "modes", NULL,
+};
+
+enum {
+    OUTPUT_INFO_TIMESTAMP = 1,
+    OUTPUT_INFO_NAME,
+    OUTPUT_INFO_CRTC,
+    OUTPUT_INFO_NPREFERRED,
+    OUTPUT_INFO_MM_WIDTH,
+    OUTPUT_INFO_MM_HEIGHT,
+    OUTPUT_INFO_CONNECTION,
+    OUTPUT_INFO_SUBPIXEL_ORDER,
+    OUTPUT_INFO_CRTCS,
+    OUTPUT_INFO_CLONES,
+    OUTPUT_INFO_MODES,
+};
+
+static const char* const output_info_fields[] = {
+    "timestamp",  "name",           "crtc",  "npreferred", "mm_width", "mm_height",
+    "connection", "subpixel_order", "crtcs", "clones",     "modes",    NULL,
+};
+
+enum {
+    CRTC_INFO_TIMESTAMP = 1,
+    CRTC_INFO_X,
+    CRTC_INFO_Y,
+    CRTC_INFO_HEIGHT,
+    CRTC_INFO_WIDTH,
+    CRTC_INFO_MODE,
+    CRTC_INFO_ROTATION,
+    CRTC_INFO_ROTATIONS,
+    CRTC_INFO_OUTPUTS,
+    CRTC_INFO_POSSIBLE,
+};
+
+static const char* const crtc_info_fields[] = {
+    "timestamp", "x", "y", "height", "width", "mode", "rotation", "rotations", "outputs", "possible", NULL,
+};
+
 // Enums as defined in https://cgit.freedesktop.org/xorg/proto/randrproto/tree/randrproto.txt
 
-static const char* connection_states[3] = {
+#define CONNECTION_STATES_COUNT 3
+#define SUBPIXEL_ORDERS_COUNT   6
+
+static const char* const connection_states[CONNECTION_STATES_COUNT] = {
     "Connected",
     "Disconnected",
     "UnknownConnection",
 };
 
-static const char* subpixel_orders[6] = {
+static const char* const subpixel_orders[SUBPIXEL_ORDERS_COUNT] = {
     "SubPixelUnknown",     "SubPixelHorizontalRGB", "SubPixelHorizontalBGR",
     "SubPixelVerticalRGB", "SubPixelVerticalBGR",   "SubPixelNone",
 };
 
+static const char* notify_names[7] = {
+    "RRCrtcChangeNotify",       "RROutputChangeNotify",   "RROutputPropertyNotify", "RRProviderChangeNotify",
+    "RRProviderPropertyNotify", "RRResourceChangeNotify", "RRLeaseNotify",
+};
+
 static const char* mode_flags[14] = {
     "HSyncPositive", "HSyncNegative",  "VSyncPositive", "VSyncNegative",  "Interlace",
     "DoubleScan",    "CSync",          "CSyncPositive", "CSyncNegative",  "HSkewPresent",
@@ -77,6 +136,8 @@ static const char* mode_flags[14] = {
 int xrandr_query_version(lua_State*);
 
 /** Returns the base event codes.
+ *
+ * This also enables decoding of RandR events on this connection. See @{XRRSelectInput}.
  *
  * @function XRRQueryExtension
  * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
@@ -220,6 +281,8 @@ int xrandr_config_current_rate(lua_State*);
 
 /**
  * Contrary to the other types in this module, this is provided as an actual Lua table, rather than userdata.
+ * Tables are created once per mode and screen resources, and shared between @{XRRScreenResources}.modes,
+ * @{mode_by_id} and @{find_mode}.
  *
  * @table XRRMode
  * @field[type=number] id
@@ -235,9 +298,13 @@ int xrandr_config_current_rate(lua_State*);
  * @field[type=number] vSyncEnd
  * @field[type=number] vTotal
  * @field[type=XRRModeFlags] modeFlags
+ * @field[type=number] refresh The vertical refresh rate in Hz, accounting for interlaced and double scan modes.
  */
 
 /**
+ * The list fields are converted once, on first access. Later reads return the same table,
+ * so it should be treated as read-only.
+ *
  * @table XRRScreenResources
  * @field[type=number] timestamp
  * @field[type=number] configTimestamp
@@ -245,11 +312,35 @@ int xrandr_config_current_rate(lua_State*);
  * @field[type=table<number>] outputs
  * @field[type=table<XRRMode>] modes
  */
+typedef struct {
+    RRMode id;
+    // Position in `XRRScreenResources.modes`.
+    int index;
+} mode_id_t;
+
 typedef struct {
     XRRScreenResources* inner;
+    // Mode lookup tables, built on first use. `mode_ids` is sorted by ID, `refresh` follows the order of `modes`.
+    mode_id_t* mode_ids;
+    double* refresh;
 } screen_resources_t;
 
 
+// Wraps the given resources in a new userdatum, taking ownership of them.
+screen_resources_t* push_screen_resources(lua_State*, XRRScreenResources*);
+
+// Builds the lookup tables for the modes, unless that already happened. Returns `False` if allocation failed.
+Bool screen_resources_index_modes(screen_resources_t*);
+
+// Returns the position of the given mode in `res->inner->modes`, or `-1` if there is no such mode.
+// The index must have been built with `screen_resources_index_modes`.
+int screen_resources_find_mode(const screen_resources_t*, RRMode);
+
+// Returns the position of the mode that best matches the size and refresh rate, or `-1` if no mode has that size.
+// A refresh rate of `0` picks the highest one. If an output is given, only its modes are considered.
+// The index must have been built with `screen_resources_index_modes`.
+int screen_resources_best_mode(const screen_resources_t*, unsigned int, unsigned int, double, const XRROutputInfo*);
+
 int screen_resources__gc(lua_State*);
 int screen_resources__index(lua_State*);
 
@@ -267,15 +358,63 @@ int screen_resources__index(lua_State*);
  */
 int xrandr_get_screen_resources(lua_State*);
 
+/** Queries the current @{XRRScreenResources} without probing for hardware changes.
+ *
+ * @{XRRGetScreenResources} makes the server poll every connector for changes, which can take
+ * hundreds of milliseconds on real hardware. This returns the server's current view instead.
+ * Changes to the hardware are still picked up when the server is notified of them through other means,
+ * or after the next call to @{XRRGetScreenResources}.
+ *
+ * @function XRRGetScreenResourcesCurrent
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number window The XID of the window to query.
+ * @treturn XRRScreenResources
+ */
+int xrandr_get_screen_resources_current(lua_State*);
+
+/** Returns the mode with the given ID.
+ *
+ * Other than @{XRRScreenResources}.modes, this only converts the requested mode.
+ * Lookups use an index that is built once per screen resources.
+ *
+ * @function mode_by_id
+ * @tparam XRRScreenResources resources
+ * @tparam number id The mode's XID, e.g. from @{XRRCrtcInfo}.mode.
+ * @treturn[opt] XRRMode `nil` if there is no such mode.
+ * @usage
+ * local info = xrandr.XRRGetCrtcInfo(display, res, res.crtcs[1])
+ * local mode = xrandr.mode_by_id(res, info.mode)
+ * printf("%dx%d@%.2f", mode.width, mode.height, mode.refresh)
+ */
+int xrandr_mode_by_id(lua_State*);
+
+/** Finds the mode that best matches the given size and refresh rate.
+ *
+ * Only modes with exactly the given size are considered. Among those, the one with the refresh rate closest
+ * to the requested one wins. Without a requested rate, the highest rate wins.
+ *
+ * @function find_mode
+ * @tparam XRRScreenResources resources
+ * @tparam number width
+ * @tparam number height
+ * @tparam[opt] number refresh The refresh rate in Hz.
+ * @tparam[opt] XRROutputInfo output Only consider modes supported by this output.
+ * @treturn[opt] XRRMode `nil` if no mode has the given size.
+ * @usage
+ * local mode = xrandr.find_mode(res, 1920, 1080, 60, info)
+ */
+int xrandr_find_mode(lua_State*);
+
 
 static const struct luaL_Reg screen_resources_mt[] = {
-    {"__gc",     screen_resources__gc   },
-    { "__index", screen_resources__index},
-    { NULL,      NULL                   }
+    {"__gc", screen_resources__gc},
+    { NULL,  NULL                }
 };
 
 
 /**
+ * As with @{XRRScreenResources}, list fields are cached after the first access.
+ *
  * @table XRROutputInfo
  * @field[type=string] name
  * @field[type=number] mm_width
@@ -340,17 +479,6 @@ int xrandr_get_output_primary(lua_State*);
 int xrandr_set_output_primary(lua_State*);
 
 
-/*
- * Internal representation of the property data.
- */
-typedef struct {
-    int type;
-    void* data;
-} output_property_data_t;
-
-#define LUA_TINTEGER
-
-
 /** Returns the list of properties on the given output.
  *
  * This returns a list of `Atom`s (mapped to simple integer numbers).
@@ -408,7 +536,8 @@ int xrandr_configure_output_property(lua_State*);
  *
  * The value has to match with the metadata from @{XRRQueryOutputProperty}.
  *
- * For now, only @{string} values are supported, and they are treated as raw, unsigned byte buffers.
+ * The data may be a string of bytes for format `8`, a list of integers for any format,
+ * or an @{xlib.XProperty} buffer, e.g. as returned by @{XRRGetOutputProperty}. Buffers bring their own format.
  *
  * If "append" or "prepend" modes are chosen, the types of the existing and new values must match.
  * For undefined properties, all three modes work the same.
@@ -421,47 +550,63 @@ int xrandr_configure_output_property(lua_State*);
  * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
  * @tparam number output The XID of the output.
  * @tparam number property An X11 `Atom`.
- * @tparam number type An X11 `Atom`.
  * @tparam number|nil mode If `1`, prepend data. If `2`, append data. Otherwise replace data.
- * @tparam string data
+ * @tparam[opt] number type An X11 `Atom`, e.g. `INTEGER`, `CARDINAL` or `ATOM`. Defaults to `CARDINAL` for
+ *   tables, the buffer's own type for @{xlib.XProperty} and `STRING` otherwise.
+ * @tparam string|table|XProperty data
+ * @tparam[opt] number format One of `8`, `16` or `32`. Defaults to `32` for tables and `8` otherwise.
+ * @usage
+ * local integer = xlib.XInternAtom(display, "INTEGER", false)
+ * xrandr.XRRChangeOutputProperty(display, output, backlight, 0, integer, { 400 }, 32)
  */
 int xrandr_change_output_property(lua_State*);
 
 /** Returns the value of an output property.
- *
- * As with @{XRRChangeOutputProperty}, only properties of type @{string}
- * (which maps to Xorg's `XA_STRING` from `X11/Xatom.h`) are currently supported. The `req_type` property
- * is just a placeholder because of that.
  *
  * If there is no such property, the function will return nothing.
  *
- * For properties of unknown length, first call this function with `offset == 0`, `length == 0`,
- * and the second return value will report the full length of the value. Then call the function
- * a second time with the desired offset and length.
+ * `offset` and `length` are given in 32-bit units, regardless of the property's format.
+ * For properties of unknown length, first call this function with `length == 0`,
+ * and the `bytes_after` field of the result will report the full length of the value.
+ *
+ * If `req_type` doesn't match the property's actual type, the result is empty, but still reports
+ * the actual type and format.
  *
  * @function XRRGetOutputProperty
  * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
  * @tparam number output The XID of the output.
  * @tparam number property An X11 `Atom`.
- * @tparam number offset The offset at which to start reading the return value.
- * @tparam number length The amount of bytes (regardless of the element size) to read into the return value.
+ * @tparam number offset The offset at which to start reading the return value, in 32-bit units.
+ * @tparam number length The amount of data to read, in 32-bit units.
  * @tparam boolean delete If `true`, delete the property after reading.
  * @tparam boolean pending If `true` and there is a pending change for the property, return that change
  *  instead of the current value.
- * @tparam[opt] number req_type An X11 `Atom`. Currently ignored and hardcoded to XLib's `XA_STRING`.
- * @treturn string The data.
- * @treturn number The number of elements in the value, as passed when setting the property
- *  (see @{XRRChangeOutputProperty}).
- * @treturn number The element size of the byte array as passed when setting the property. One of `8`, `16`, `32`.
- * @treturn number The number of bytes (regardless of the element size) left in the value.
+ * @tparam[opt] number req_type An X11 `Atom`. Defaults to `AnyPropertyType` (`0`).
+ * @treturn[opt] xlib.XProperty
  * @usage
- * -- Check the length
- * local _, length = xrandr.XRRGetOutputProperty(display, output, atom, 0, 0)
- * local value, nitems, format = xrandr.XRRGetOutputProperty(display, output, atom, 0, length)
- * print(value) -- may be arbitrary, non-printable bytes. If so, use `nitems` and `format` to interpret it
+ * local edid = xlib.XInternAtom(display, xrandr.RR_OUTPUT.RANDR_EDID, false)
+ * local value = xrandr.XRRGetOutputProperty(display, output, edid, 0, 128, false, false)
+ * if value then
+ *     print(#value, value.format, value[1])
+ * end
  */
 int xrandr_get_output_property(lua_State*);
 
+/** Returns a stream that reads an output property in chunks.
+ *
+ * This is the equivalent of @{xlib.property_stream} for output properties, e.g. for EDID blocks
+ * that don't fit into a single reply. Pending values are not supported.
+ *
+ * @function output_property_stream
+ * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
+ * @tparam number output The XID of the output.
+ * @tparam number property An X11 `Atom`.
+ * @tparam[opt=1024] number length The size of each chunk, in 32-bit units.
+ * @tparam[opt] number req_type An X11 `Atom`. Defaults to `AnyPropertyType` (`0`).
+ * @treturn xlib.XPropertyStream
+ */
+int xrandr_output_property_stream(lua_State*);
+
 /** Deletes the property from the given output.
  *
  * @function XRRDeleteOutputProperty
@@ -473,9 +618,8 @@ int xrandr_delete_output_property(lua_State*);
 
 
 static const struct luaL_Reg output_info_mt[] = {
-    {"__gc",     output_info__gc   },
-    { "__index", output_info__index},
-    { NULL,      NULL              }
+    {"__gc", output_info__gc},
+    { NULL,  NULL           }
 };
 
 
@@ -547,12 +691,71 @@ int xrandr_set_crtc_config(lua_State*);
 
 
 static const struct luaL_Reg crtc_info_mt[] = {
-    {"__gc",     crtc_info__gc   },
-    { "__index", crtc_info__index},
-    { NULL,      NULL            }
+    {"__gc", crtc_info__gc},
+    { NULL,  NULL         }
 };
 
+/**
+ * Fields of `RRScreenChangeNotify` events, in addition to those of @{xlib.XEvent}.
+ *
+ * @{xlib.DisplayWidth} and @{xlib.DisplayHeight} are updated automatically when this event is received.
+ *
+ * @table XRRScreenChangeNotifyEvent
+ * @field[type=number] root
+ * @field[type=number] timestamp
+ * @field[type=number] config_timestamp
+ * @field[type=number] size_index
+ * @field[type=string] subpixel_order
+ * @field[type=number] rotation
+ * @field[type=number] width
+ * @field[type=number] height
+ * @field[type=number] mwidth
+ * @field[type=number] mheight
+ */
+
+/**
+ * Fields of `RRCrtcChangeNotify` events, in addition to those of @{xlib.XEvent}.
+ *
+ * @table XRRCrtcChangeNotifyEvent
+ * @field[type=number] subtype
+ * @field[type=number] crtc
+ * @field[type=number] mode
+ * @field[type=number] rotation
+ * @field[type=number] x
+ * @field[type=number] y
+ * @field[type=number] width
+ * @field[type=number] height
+ */
+
+/**
+ * Fields of `RROutputChangeNotify` events, in addition to those of @{xlib.XEvent}.
+ *
+ * @table XRROutputChangeNotifyEvent
+ * @field[type=number] subtype
+ * @field[type=number] output
+ * @field[type=number] crtc
+ * @field[type=number] mode
+ * @field[type=number] rotation
+ * @field[type=string] connection
+ * @field[type=string] subpixel_order
+ */
+
+/**
+ * Fields of `RROutputPropertyNotify` events, in addition to those of @{xlib.XEvent}.
+ *
+ * @table XRROutputPropertyNotifyEvent
+ * @field[type=number] subtype
+ * @field[type=number] output
+ * @field[type=number] property An X11 `Atom`.
+ * @field[type=number] timestamp
+ * @field[type=number] state `0` if the property changed, `1` if it was deleted.
+ */
+
 /** Configures which types of events the X server should enable.
+ *
+ * The events will be decoded by @{xlib.drain_events} and @{xlib.XNextEvent}, with their `name` being
+ * one of `RRScreenChangeNotify`, `RRCrtcChangeNotify`, `RROutputChangeNotify`, `RROutputPropertyNotify`,
+ * `RRProviderChangeNotify`, `RRProviderPropertyNotify`, `RRResourceChangeNotify` or `RRLeaseNotify`.
  *
  * @function XRRSelectInput
  * @tparam display display A display connection opened with @{xlib.XOpenDisplay}.
@@ -568,6 +771,11 @@ static const struct luaL_Reg crtc_info_mt[] = {
  * @usage
  * -- Enable notifications for CRTCs and outputs
  * xrandr.XRRSelectInput(display, root, { crtc = true, output = true })
+ * for _, event in ipairs(xlib.drain_events(display)) do
+ *     if event.name == "RROutputChangeNotify" then
+ *         print(event.output, event.connection)
+ *     end
+ * end
  */
 int xrandr_select_input(lua_State* L);
 
@@ -606,6 +814,9 @@ static const struct luaL_Reg xrandr_lib[] = {
     {"XRRQueryVersion",                xrandr_query_version               },
     { "XRRQueryExtension",             xrandr_query_extension             },
     { "XRRGetScreenResources",         xrandr_get_screen_resources        },
+    { "XRRGetScreenResourcesCurrent",  xrandr_get_screen_resources_current},
+    { "mode_by_id",                    xrandr_mode_by_id                  },
+    { "find_mode",                     xrandr_find_mode                   },
     { "XRRGetOutputInfo",              xrandr_get_output_info             },
     { "XRRGetOutputPrimary",           xrandr_get_output_primary          },
     { "XRRGetCrtcInfo",                xrandr_get_crtc_info               },
@@ -622,12 +833,14 @@ static const struct luaL_Reg xrandr_lib[] = {
     { "XRRConfigCurrentRate",          xrandr_config_current_rate         },
     { "XRRGetScreenSizeRange",         xrandr_get_screen_size_range       },
     { "XRRSetScreenSize",              xrandr_set_screen_size             },
+    { "XRRSelectInput",                xrandr_select_input                },
     { "XRRListOutputProperties",       xrandr_list_output_properties      },
     { "XRRQueryOutputProperty",        xrandr_query_output_property       },
     { "XRRConfigureOutputProperty",    xrandr_configure_output_property   },
     { "XRRChangeOutputProperty",       xrandr_change_output_property      },
     { "XRRDeleteOutputProperty",       xrandr_delete_output_property      },
     { "XRRGetOutputProperty",          xrandr_get_output_property         },
+    { "output_property_stream",        xrandr_output_property_stream      },
     { NULL,                            NULL                               }
 };
 